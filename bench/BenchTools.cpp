@@ -0,0 +1,103 @@
+#include "BenchTools.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using std::string;
+
+namespace irc {
+namespace bench {
+
+int connectFrom(const string &host, int port, int net, int id, int rcvbuf) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (rcvbuf > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in src;
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl((127U << 24) | ((net & 0xff) << 16)
+                                | (((id / 250) & 0xff) << 8)
+                                | (id % 250 + 1));
+    struct sockaddr_in dst;
+    memset(&dst, 0, sizeof(dst));
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&src, sizeof(src)) == -1
+        || inet_pton(AF_INET, host.c_str(), &dst.sin_addr) != 1
+        || fcntl(fd, F_SETFL, O_NONBLOCK) == -1
+        || (connect(fd, (struct sockaddr *)&dst, sizeof(dst)) == -1
+            && errno != EINPROGRESS))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* utime and stime are fields 14 and 15, counting after the ')' that
+ * ends the process name (which may contain spaces) */
+ServerUsage readServerUsage(int pid) {
+    ServerUsage usage = {false, 0, 0, 0};
+    if (pid <= 0) {
+        return usage;
+    }
+    std::ostringstream path;
+    path << "/proc/" << pid;
+    std::ifstream stat((path.str() + "/stat").c_str());
+    string line;
+    if (!std::getline(stat, line) || line.rfind(')') == string::npos) {
+        return usage;
+    }
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    string skip;
+    for (int i = 3; i < 14; i++) {
+        fields >> skip;
+    }
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    fields >> utime >> stime;
+    usage.cpu_ticks = utime + stime;
+
+    std::ifstream status((path.str() + "/status").c_str());
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            usage.rss_kb = strtoul(line.c_str() + 6, NULL, 10);
+        } else if (line.compare(0, 6, "VmHWM:") == 0) {
+            usage.peak_rss_kb = strtoul(line.c_str() + 6, NULL, 10);
+        }
+    }
+    usage.ok = true;
+    return usage;
+}
+
+void printServerUsage(const ServerUsage &before, const ServerUsage &after,
+                      double seconds)
+{
+    if (!before.ok || !after.ok) {
+        return ;
+    }
+    double cpu_s = (double)(after.cpu_ticks - before.cpu_ticks)
+                   / sysconf(_SC_CLK_TCK);
+    std::cout << std::fixed << std::setprecision(1)
+              << "server : cpu " << 100.0 * cpu_s / seconds << "%, rss "
+              << after.rss_kb / 1024.0 << " MiB, peak rss "
+              << after.peak_rss_kb / 1024.0 << " MiB\n";
+}
+
+} // bench
+} // irc
@@ -0,0 +1,34 @@
+#ifndef IRC42_BENCHTOOLS_H
+# define IRC42_BENCHTOOLS_H
+
+#include <string>
+
+/* Shared by the bench/ programs (loadgen, replay) */
+
+namespace irc {
+namespace bench {
+
+typedef struct ServerUsage {
+    bool ok;
+    unsigned long cpu_ticks;    // utime + stime
+    unsigned long rss_kb;
+    unsigned long peak_rss_kb;
+} ServerUsage;
+
+/* Non blocking socket bound to 127.<net>.<id / 250>.<id % 250 + 1>, so
+ * every client is its own source for the server's per source limits.
+ * The connection may still be in progress : sends fail with EAGAIN
+ * until poll reports POLLOUT. rcvbuf > 0 shrinks the receive buffer.
+ * -1 on error. */
+int connectFrom(const std::string &host, int port, int net, int id,
+                int rcvbuf);
+
+/* From /proc/<pid>, ok is false if it can't be read */
+ServerUsage readServerUsage(int pid);
+void printServerUsage(const ServerUsage &before, const ServerUsage &after,
+                      double seconds);
+
+} // bench
+} // irc
+
+#endif /* IRC42_BENCHTOOLS_H */
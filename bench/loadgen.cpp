@@ -0,0 +1,552 @@
+#include "BenchTools.hpp"
+#include "Metrics.hpp"
+#include "Tools.hpp"
+#include "Types.hpp"
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Load generator for ircserv (make bench).
+ *
+ * Opens N client connections, each from its own loopback address
+ * (127.20.x.y) so the per source limits of the server never kick in,
+ * registers them, joins each to J of M channels, then drives a mix of
+ * PRIVMSG / JOIN / PART / NICK at a target rate for a while.
+ *
+ * Channel PRIVMSGs carry the send time ("B <monotonic us>"), members
+ * that receive them record the delivery latency. Client and server run
+ * on the same host, so CLOCK_MONOTONIC is the same clock.
+ *
+ * Clients keep a copy of the server's flood bucket (FLOOD_CONFIG and
+ * COMMAND_PENALTY, from the server's Types.hpp) and only pick a client that can
+ * afford the operation : what is measured is the server, not its flood
+ * control. Operations no client could afford are reported as skipped.
+ *
+ * Slow readers register and join like everyone else, with a tiny
+ * receive buffer, and are never read again : the server should drop
+ * them (SendQ exceeded) without slowing the others down.
+ *
+ * With -x <pid>, server CPU and RSS are read from /proc.
+ */
+
+using std::string;
+using std::vector;
+using namespace irc;
+
+typedef enum {
+    OP_PRIVMSG = 0,
+    OP_JOIN,
+    OP_PART,
+    OP_NICK,
+    OP_COUNT
+} BENCH_OP;
+
+typedef enum {
+    REGISTER_TIMEOUT_US = 5000000,
+    DRAIN_US = 1000000,         // reading after the last operation
+    SLOW_RCVBUF = 1024,
+    READ_SIZE = 65536,
+    FLOOD_MARGIN = 4            // the server refills on whole seconds
+} BENCH_CONFIG;
+
+static const char *op_names[] = {"privmsg", "join", "part", "nick"};
+static const int op_penalty[] = {
+    PENALTY_PRIVMSG, PENALTY_JOIN, PENALTY_PART, PENALTY_NICK
+};
+
+typedef struct Options {
+    string host;
+    int port;
+    string password;
+    int clients;
+    int channels;
+    int joins;          // channels joined by every client at start
+    bool zipf;          // channel popularity, else uniform
+    int rate;           // operations per second, all clients
+    int duration;       // seconds
+    int mix[OP_COUNT];  // weights
+    int slow;           // slow readers, on top of clients
+    int server_pid;
+} Options;
+
+typedef struct Client {
+    int fd;
+    int id;
+    string nick;
+    int nick_gen;
+    string in;
+    string out;
+    bool slow;
+    bool registered;
+    bool dead;
+    vector<int> joined;
+    int tokens;
+    unsigned long refill_us;
+} Client;
+
+typedef struct Totals {
+    unsigned long sent[OP_COUNT];
+    unsigned long skipped;
+    unsigned long delivered;
+    unsigned long disconnected;
+} Totals;
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [options]\n"
+        "  -h host       server address (127.0.0.1)\n"
+        "  -p port       server port (6667)\n"
+        "  -P password   server password\n"
+        "  -c clients    connections (100)\n"
+        "  -C channels   channels (10)\n"
+        "  -j joins      channels joined per client (2)\n"
+        "  -D dist       channel sizes : uniform | zipf (zipf)\n"
+        "  -r rate       operations per second (80)\n"
+        "  -d seconds    duration (10)\n"
+        "  -m mix        privmsg,join,part,nick weights (85,5,5,5)\n"
+        "  -S slow       slow readers (2)\n"
+        "  -x pid        server pid, for CPU and RSS\n";
+    exit(2);
+}
+
+static bool parseMix(const char *arg, int *mix) {
+    std::istringstream in(arg);
+    char comma;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (!(in >> mix[op]) || mix[op] < 0) {
+            return false;
+        }
+        if (op + 1 < OP_COUNT && !(in >> comma)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options opt;
+    opt.host = "127.0.0.1";
+    opt.port = 6667;
+    opt.clients = 100;
+    opt.channels = 10;
+    opt.joins = 2;
+    opt.zipf = true;
+    opt.rate = 80;
+    opt.duration = 10;
+    int mix[OP_COUNT] = {85, 5, 5, 5};
+    for (int op = 0; op < OP_COUNT; op++) {
+        opt.mix[op] = mix[op];
+    }
+    opt.slow = 2;
+    opt.server_pid = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "h:p:P:c:C:j:D:r:d:m:S:x:")) != -1) {
+        switch (c) {
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 'P': opt.password = optarg; break;
+            case 'c': opt.clients = atoi(optarg); break;
+            case 'C': opt.channels = atoi(optarg); break;
+            case 'j': opt.joins = atoi(optarg); break;
+            case 'D': opt.zipf = string(optarg) == "zipf"; break;
+            case 'r': opt.rate = atoi(optarg); break;
+            case 'd': opt.duration = atoi(optarg); break;
+            case 'm':
+                if (!parseMix(optarg, opt.mix)) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'S': opt.slow = atoi(optarg); break;
+            case 'x': opt.server_pid = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (opt.clients < 1 || opt.channels < 1 || opt.rate < 1
+        || opt.duration < 1 || opt.joins < 0 || opt.slow < 0)
+    {
+        usage(argv[0]);
+    }
+    return opt;
+}
+
+/* Channel popularity : P(k) ~ 1 / (k + 1) for zipf, flat otherwise */
+class ChannelPicker {
+    public:
+    ChannelPicker(int channels, bool zipf) : cdf(channels) {
+        double total = 0;
+        for (int k = 0; k < channels; k++) {
+            total += zipf ? 1.0 / (k + 1) : 1.0;
+            cdf[k] = total;
+        }
+        for (int k = 0; k < channels; k++) {
+            cdf[k] /= total;
+        }
+    }
+    int pick(void) const {
+        double r = (double)rand() / ((double)RAND_MAX + 1);
+        for (size_t k = 0; k < cdf.size(); k++) {
+            if (r < cdf[k]) {
+                return k;
+            }
+        }
+        return cdf.size() - 1;
+    }
+    private:
+    vector<double> cdf;
+};
+
+static string channelName(int k) {
+    std::ostringstream name;
+    name << "#bench" << k;
+    return name.str();
+}
+
+/* Nicks stay under NAME_MAX_SIZE : b<id><generation letter> */
+static string nickFor(int id, int gen) {
+    std::ostringstream nick;
+    nick << "b" << id << (char)('a' + gen % 26);
+    return nick.str();
+}
+
+static void refill(Client &client, unsigned long now) {
+    unsigned long step = 1000000UL / FLOOD_REFILL_PER_S;
+    while (now - client.refill_us >= step) {
+        client.refill_us += step;
+        if (client.tokens < FLOOD_BURST - FLOOD_MARGIN) {
+            client.tokens++;
+        }
+    }
+}
+
+static void queueLine(Client &client, const string &line, int penalty) {
+    client.out += line + CRLF;
+    client.tokens -= penalty;
+}
+
+static void writeOut(Client &client) {
+    while (!client.out.empty() && !client.dead) {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(),
+                         MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                client.dead = true;
+            }
+            return ;
+        }
+        client.out.erase(0, n);
+    }
+}
+
+static void handleLine(Client &client, const string &line,
+                       Metrics::Histogram &latency, Totals &totals,
+                       unsigned long now)
+{
+    if (line.compare(0, 5, "PING ") == 0) {
+        client.out += "PONG " + line.substr(5) + CRLF;
+        return ;
+    }
+    if (line.compare(0, 6, "ERROR ") == 0) {
+        client.dead = true;
+        return ;
+    }
+    size_t pos = line.find(' ');
+    if (pos == string::npos) {
+        return ;
+    }
+    if (line.compare(pos, 5, " 001 ") == 0) {
+        client.registered = true;
+        return ;
+    }
+    if (line.compare(pos, 9, " PRIVMSG ") != 0) {
+        return ;
+    }
+    size_t mark = line.find(" :B ", pos);
+    if (mark == string::npos) {
+        return ;
+    }
+    unsigned long sent = strtoul(line.c_str() + mark + 4, NULL, 10);
+    latency.observe(now > sent ? now - sent : 0);
+    totals.delivered++;
+}
+
+static void readIn(Client &client, Metrics::Histogram &latency,
+                   Totals &totals)
+{
+    char buff[READ_SIZE];
+    while (!client.dead) {
+        ssize_t n = recv(client.fd, buff, sizeof(buff), 0);
+        if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK
+                       && errno != EINTR))
+        {
+            client.dead = true;
+            break ;
+        }
+        if (n == -1) {
+            break ;
+        }
+        client.in.append(buff, n);
+    }
+    unsigned long now = tools::monotonicUs();
+    size_t start = 0;
+    size_t end;
+    while ((end = client.in.find(CRLF, start)) != string::npos) {
+        handleLine(client, client.in.substr(start, end - start),
+                   latency, totals, now);
+        start = end + 2;
+    }
+    client.in.erase(0, start);
+}
+
+/* One poll round : write what is queued, read who has something */
+static void pump(vector<Client> &clients, Metrics::Histogram &latency,
+                 Totals &totals, int timeout_ms)
+{
+    vector<struct pollfd> fds;
+    vector<int> idx;
+    for (size_t i = 0; i < clients.size(); i++) {
+        Client &client = clients[i];
+        writeOut(client);
+        if (client.dead) {
+            continue ;
+        }
+        struct pollfd p;
+        p.fd = client.fd;
+        p.events = client.slow ? 0 : POLLIN;
+        if (!client.out.empty()) {
+            p.events |= POLLOUT;
+        }
+        if (p.events == 0) {
+            continue ;
+        }
+        p.revents = 0;
+        fds.push_back(p);
+        idx.push_back(i);
+    }
+    if (fds.empty() || poll(&fds[0], fds.size(), timeout_ms) <= 0) {
+        return ;
+    }
+    for (size_t f = 0; f < fds.size(); f++) {
+        Client &client = clients[idx[f]];
+        if (fds[f].revents & (POLLIN | POLLHUP | POLLERR)) {
+            readIn(client, latency, totals);
+        }
+    }
+}
+
+static int pickOp(const Options &opt) {
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += opt.mix[op];
+    }
+    int r = rand() % (total > 0 ? total : 1);
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (r < opt.mix[op]) {
+            return op;
+        }
+        r -= opt.mix[op];
+    }
+    return OP_PRIVMSG;
+}
+
+static bool isMember(const Client &client, int channel) {
+    for (size_t i = 0; i < client.joined.size(); i++) {
+        if (client.joined[i] == channel) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Sends op from a random client that can afford it. Tries a few
+ * clients, so a busy one does not turn into a skipped operation. */
+static bool issueOp(int op, vector<Client> &clients, int normal,
+                    const ChannelPicker &picker, Totals &totals,
+                    unsigned long now)
+{
+    for (int attempt = 0; attempt < 8; attempt++) {
+        Client &client = clients[rand() % normal];
+        if (client.dead || !client.registered) {
+            continue ;
+        }
+        refill(client, now);
+        if (client.tokens < op_penalty[op]) {
+            continue ;
+        }
+        std::ostringstream line;
+        if (op == OP_PRIVMSG) {
+            if (client.joined.empty()) {
+                continue ;
+            }
+            int k = client.joined[rand() % client.joined.size()];
+            line << "PRIVMSG " << channelName(k) << " :B " << now;
+        } else if (op == OP_JOIN) {
+            int k = picker.pick();
+            if (isMember(client, k)) {
+                continue ;
+            }
+            client.joined.push_back(k);
+            line << "JOIN " << channelName(k);
+        } else if (op == OP_PART) {
+            if (client.joined.empty()) {
+                continue ;
+            }
+            size_t i = rand() % client.joined.size();
+            line << "PART " << channelName(client.joined[i]);
+            client.joined.erase(client.joined.begin() + i);
+        } else {
+            client.nick = nickFor(client.id, ++client.nick_gen);
+            line << "NICK " << client.nick;
+        }
+        queueLine(client, line.str(), op_penalty[op]);
+        totals.sent[op]++;
+        return true;
+    }
+    totals.skipped++;
+    return false;
+}
+
+static void report(const Options &opt, const Totals &totals,
+                   const Metrics::Histogram &latency, int registered,
+                   int slow_dropped, double seconds,
+                   const bench::ServerUsage &before,
+                   const bench::ServerUsage &after)
+{
+    std::cout << std::fixed << std::setprecision(1)
+        << "clients " << opt.clients << " (+" << opt.slow << " slow), "
+        << "registered " << registered << ", channels " << opt.channels
+        << " (" << (opt.zipf ? "zipf" : "uniform") << "), joins "
+        << opt.joins << " per client\n"
+        << "target " << opt.rate << " ops/s for " << opt.duration << "s\n"
+        << "ops sent :";
+    for (int op = 0; op < OP_COUNT; op++) {
+        std::cout << " " << op_names[op] << " " << totals.sent[op] << ",";
+    }
+    std::cout << " skipped (no flood budget) " << totals.skipped << "\n"
+        << "deliveries " << totals.delivered << ", "
+        << totals.delivered / seconds << " msg/s\n"
+        << "latency us : p50 " << latency.quantile(0.5)
+        << ", p90 " << latency.quantile(0.9)
+        << ", p99 " << latency.quantile(0.99)
+        << ", p99.9 " << latency.quantile(0.999)
+        << ", max " << latency.max << "\n"
+        << "disconnected " << totals.disconnected
+        << ", slow readers dropped " << slow_dropped << "/" << opt.slow
+        << "\n";
+    bench::printServerUsage(before, after, seconds);
+}
+
+int main(int argc, char **argv) {
+    Options opt = parseOptions(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    srand(42);
+
+    ChannelPicker picker(opt.channels, opt.zipf);
+    Metrics::Histogram latency(1, 24, 4);
+    Totals totals;
+    memset(&totals, 0, sizeof(totals));
+
+    vector<Client> clients;
+    int total = opt.clients + opt.slow;
+    for (int id = 0; id < total; id++) {
+        Client client;
+        client.id = id;
+        client.slow = id >= opt.clients;
+        client.fd = bench::connectFrom(opt.host, opt.port, 20, id,
+                                       client.slow ? SLOW_RCVBUF : 0);
+        if (client.fd == -1) {
+            std::cerr << "connect " << id << " : " << strerror(errno) << "\n";
+            return 1;
+        }
+        client.nick_gen = 0;
+        client.nick = nickFor(id, 0);
+        client.registered = false;
+        client.dead = false;
+        client.tokens = FLOOD_BURST - FLOOD_MARGIN;
+        client.refill_us = tools::monotonicUs();
+        if (!opt.password.empty()) {
+            queueLine(client, "PASS " + opt.password, 2);
+        }
+        queueLine(client, "NICK " + client.nick, 4);
+        queueLine(client, "USER " + client.nick + " 0 * :loadgen", 2);
+        for (int j = 0; j < opt.joins; j++) {
+            int k = picker.pick();
+            if (!isMember(client, k)) {
+                client.joined.push_back(k);
+                queueLine(client, "JOIN " + channelName(k), 4);
+            }
+        }
+        clients.push_back(client);
+    }
+
+    /* registration : every normal client got its 001 */
+    unsigned long deadline = tools::monotonicUs() + REGISTER_TIMEOUT_US;
+    int registered = 0;
+    while (registered < opt.clients && tools::monotonicUs() < deadline) {
+        pump(clients, latency, totals, 10);
+        registered = 0;
+        for (int i = 0; i < opt.clients; i++) {
+            registered += clients[i].registered;
+        }
+    }
+    if (registered == 0) {
+        std::cerr << "no client registered\n";
+        return 1;
+    }
+
+    bench::ServerUsage before = bench::readServerUsage(opt.server_pid);
+    unsigned long start = tools::monotonicUs();
+    unsigned long end = start + opt.duration * 1000000UL;
+    unsigned long issued = 0;
+    unsigned long now;
+    while ((now = tools::monotonicUs()) < end) {
+        unsigned long due = (now - start) * (unsigned long)opt.rate / 1000000;
+        for (; issued < due; issued++) {
+            issueOp(pickOp(opt), clients, opt.clients, picker, totals, now);
+        }
+        pump(clients, latency, totals, 1);
+    }
+    unsigned long drain_end = tools::monotonicUs() + DRAIN_US;
+    while (tools::monotonicUs() < drain_end) {
+        pump(clients, latency, totals, 10);
+    }
+    double seconds = (tools::monotonicUs() - start) / 1000000.0;
+    bench::ServerUsage after = bench::readServerUsage(opt.server_pid);
+
+    /* slow readers : read them now, to see if the server closed them */
+    for (int i = 0; i < opt.clients; i++) {
+        totals.disconnected += clients[i].dead;
+    }
+    int slow_dropped = 0;
+    for (int i = opt.clients; i < total; i++) {
+        char buff[READ_SIZE];
+        ssize_t n;
+        while ((n = recv(clients[i].fd, buff, sizeof(buff), 0)) > 0) {
+            if (string(buff, n).find("ERROR :") != string::npos) {
+                clients[i].dead = true;
+            }
+        }
+        if (n == 0 || (n == -1 && errno == ECONNRESET)) {
+            clients[i].dead = true;
+        }
+        slow_dropped += clients[i].dead;
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        close(clients[i].fd);
+    }
+    report(opt, totals, latency, registered, slow_dropped, seconds,
+           before, after);
+    return 0;
+}
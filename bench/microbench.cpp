@@ -0,0 +1,894 @@
+#include "Server/AIrcCommands.hpp"
+#include "AllocProfile.hpp"
+#include "Server/MemoryTransport.hpp"
+#include "Server/Server.hpp"
+#include "Channel.hpp"
+#include "Command.hpp"
+#include "User.hpp"
+#include "Tools.hpp"
+#include "Types.hpp"
+#include "WelcomeBurst.hpp"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Micro benchmarks for the hot functions of the server (make microbench).
+ *
+ * A tiny harness in the spirit of Google Benchmark : every benchmark is a
+ * function run over a State, whose loop is the timed part :
+ *
+ *   static void benchFoo(State &st) {
+ *       ... setup, not timed ...
+ *       while (st.keepRunning()) {
+ *           ... one operation ...
+ *       }
+ *   }
+ *
+ * The iteration count grows until a run lasts at least -t seconds, and the
+ * time per operation of that last run is reported. Arguments (user and
+ * channel counts ...) are registered with the benchmark, each combination
+ * is a separate result, named "function/arg:value/...".
+ *
+ * Channel benchmarks run against SinkServer : the command layer, with
+ * DataToUser and the numerics written in place counting bytes instead
+ * of queueing them, populated with
+ * <users> users that all joined <channels> channels. The measured channel
+ * is the first one, so it has <users> members.
+ *
+ * Server::runOnce embeds a whole Server on a MemoryTransport, with
+ * <users> registered clients in one channel, and times idle loop
+ * iterations : the cost every iteration pays whatever the traffic.
+ *
+ * Every allocation of the process goes through the operator new below
+ * (the server's own in ALLOC_PROFILE builds), so besides the time each
+ * result has the allocations per iteration ("allocs"), what the loop
+ * itself cost the heap. Each benchmark is registered with a ceiling
+ * for that figure : -a (make microbench-allocs) fails the run when one
+ * goes over it, so a change that makes a hot path allocate again is
+ * caught, not just shown.
+ *
+ * -o writes the results as JSON, same layout as Google Benchmark
+ * (context + one object per line in "benchmarks"). -c compares this run
+ * with such a file, e.g. one made on the previous commit :
+ *
+ *   git stash; make microbench MICROBENCH_ARGS="-o before.json"
+ *   git stash pop; make microbench MICROBENCH_ARGS="-c before.json"
+ */
+
+using std::string;
+using std::vector;
+using namespace irc;
+
+typedef struct Options {
+    double min_time;
+    string filter;
+    string json_out;
+    string compare;
+    bool check_allocs;
+} Options;
+
+/* ---------------------------------------------------------------------- */
+/* Harness                                                                */
+/* ---------------------------------------------------------------------- */
+
+static unsigned long cpuNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned long wallNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+#ifdef ALLOC_PROFILE
+/* The server's own operator new counts them (see AllocProfile) */
+static unsigned long allocationCount(void) {
+    return AllocProfile::allocations();
+}
+#else
+/* Counted by operator new, read by State around the timed loop */
+static unsigned long allocations = 0;
+
+static unsigned long allocationCount(void) {
+    return allocations;
+}
+
+/* new[] and the nothrow forms end up here too, and the operator delete
+ * of libstdc++ frees with free() : no need to replace it */
+void* operator new(size_t size) throw(std::bad_alloc) {
+    allocations++;
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+#endif
+
+class State {
+    public:
+    State(unsigned long iterations, const vector<long> &args)
+    :
+        iterations(iterations),
+        args(args),
+        done(0),
+        wall_ns(0),
+        cpu_ns(0),
+        allocs(0)
+    {}
+
+    /* The first call starts the clocks, the one after the last iteration
+     * stops them */
+    bool keepRunning(void) {
+        if (done == 0) {
+            wall_start = wallNs();
+            cpu_start = cpuNs();
+            alloc_start = allocationCount();
+        }
+        if (done++ < iterations) {
+            return true;
+        }
+        wall_ns = wallNs() - wall_start;
+        cpu_ns = cpuNs() - cpu_start;
+        allocs = allocationCount() - alloc_start;
+        return false;
+    }
+
+    long arg(size_t i) const { return args[i]; }
+
+    unsigned long iterations;
+    vector<long> args;
+    unsigned long done;
+    unsigned long wall_ns;
+    unsigned long cpu_ns;
+    unsigned long allocs;
+
+    private:
+    unsigned long wall_start;
+    unsigned long cpu_start;
+    unsigned long alloc_start;
+};
+
+typedef void (*BenchFunction)(State &);
+
+typedef struct Benchmark {
+    string name;
+    BenchFunction function;
+    double max_allocs;  // per iteration, any arguments, for -a
+    vector<string> arg_names;
+    vector<vector<long> > arg_sets;
+} Benchmark;
+
+/* Leeway over a ceiling : containers growing now and then leave
+ * a fraction of an allocation per iteration */
+static const double ALLOC_SLACK = 0.05;
+
+typedef struct Result {
+    string name;
+    unsigned long iterations;
+    double real_ns;
+    double cpu_ns;
+    double allocs;      // per iteration
+} Result;
+
+/* Results are folded in here, so the compiler can't drop the work */
+static volatile unsigned long sink_value;
+
+static vector<Benchmark>& registry(void) {
+    static vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+static Benchmark& addBenchmark(const string &name, BenchFunction function,
+                               double max_allocs)
+{
+    Benchmark bench;
+    bench.name = name;
+    bench.function = function;
+    bench.max_allocs = max_allocs;
+    registry().push_back(bench);
+    return registry().back();
+}
+
+/* Cartesian product of the values of each argument */
+static void setArgs(Benchmark &bench, const string &names,
+                    const vector<vector<long> > &values)
+{
+    string list = names;
+    tools::split(bench.arg_names, list, ",");
+    vector<size_t> idx(values.size(), 0);
+    while (true) {
+        vector<long> set;
+        for (size_t i = 0; i < values.size(); i++) {
+            set.push_back(values[i][idx[i]]);
+        }
+        bench.arg_sets.push_back(set);
+        size_t i = values.size();
+        while (i > 0 && ++idx[i - 1] == values[i - 1].size()) {
+            idx[--i] = 0;
+        }
+        if (i == 0) {
+            return ;
+        }
+    }
+}
+
+static vector<long> values(long a, long b = -1, long c = -1, long d = -1) {
+    vector<long> ret(1, a);
+    if (b != -1) ret.push_back(b);
+    if (c != -1) ret.push_back(c);
+    if (d != -1) ret.push_back(d);
+    return ret;
+}
+
+static string resultName(const Benchmark &bench, const vector<long> &args) {
+    std::ostringstream name;
+    name << bench.name;
+    for (size_t i = 0; i < args.size(); i++) {
+        name << "/" << bench.arg_names[i] << ":" << args[i];
+    }
+    return name.str();
+}
+
+/* Same growth rule as Google Benchmark : aim 40% past the minimum
+ * time, never more than 10x per step */
+static Result runBenchmark(const Benchmark &bench, const vector<long> &args,
+                           double min_time)
+{
+    const double min_ns = min_time * 1e9;
+    unsigned long iterations = 1;
+    while (true) {
+        State st(iterations, args);
+        bench.function(st);
+        if (st.wall_ns >= min_ns || iterations >= 1000000000UL) {
+            Result res;
+            res.name = resultName(bench, args);
+            res.iterations = iterations;
+            res.real_ns = (double)st.wall_ns / iterations;
+            res.cpu_ns = (double)st.cpu_ns / iterations;
+            res.allocs = (double)st.allocs / iterations;
+            return res;
+        }
+        double multiplier = st.wall_ns > 0
+                            ? min_ns * 1.4 / st.wall_ns
+                            : 10.0;
+        if (multiplier > 10.0) {
+            multiplier = 10.0;
+        }
+        unsigned long next = (unsigned long)(iterations * multiplier);
+        iterations = next > iterations ? next : iterations + 1;
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Fixtures                                                               */
+/* ---------------------------------------------------------------------- */
+
+/*
+ * The command layer without the network : it listens on a
+ * MemoryTransport nobody connects to, and replies are counted, not
+ * queued.
+ */
+class SinkServer : public AIrcCommands {
+    public:
+    SinkServer(Transport &transport, string &host, string &port)
+    :
+        AIrcCommands(transport, host, port),
+        lines(0),
+        bytes(0)
+    {}
+    virtual ~SinkServer() {}
+
+    bool serverHasPassword(void) { return false; }
+    void maybeRegisterUser(User &) {}
+    void registerUser(User &user) { user.registered = true; }
+    void DataFromUser(int) {}
+    void DataToUser(int, const string &data, int) {
+        lines++;
+        bytes += data.size() + 2; // + CRLF
+    }
+    string& outputOf(int) { return sink; }
+    void lineQueued(int, size_t start, int n) {
+        lines += n;
+        bytes += sink.size() - start;
+        sink.clear();
+    }
+    void flushSendQueue(int) {}
+    void loadCommandMap(void) {}
+    void sendStatsReport(User &, char, int) {}
+
+    /* <users> registered users u<i>, all members of <channels> channels
+     * #c<j>, the first user is their operator. Plus <lonely> channels
+     * #l<k> where the first user is alone. */
+    void populate(long users, long channels, long lonely = 0) {
+        channel_map.clear();
+        size_buckets.clear();
+        channel_folds.clear();
+        nick_fd_map.clear();
+        fd_user_map.clear();
+        for (long i = 0; i < users; i++) {
+            int fd = FIRST_FD + i;
+            addNewUser(fd, "127.0.0.1");
+            std::ostringstream nick;
+            nick << "u" << i;
+            string real_nick = nick.str();
+            string upper = real_nick;
+            tools::ToUpperCase(upper);
+            updateUserNick(fd, upper, real_nick);
+            User &user = getUserFromFd(fd);
+            user.name = real_nick;
+            user.setPrefixFromHost("127.0.0.1");
+            user.registered = true;
+        }
+        for (long j = 0; j < channels; j++) {
+            std::ostringstream name;
+            name << "#c" << j;
+            User &op = getUserFromFd(FIRST_FD);
+            Channel &joined = addNewChannel(Atom(name.str()), op);
+            op.ch_name_mask_map.insert(
+                std::pair<Atom, unsigned char>(joined.name, 0x80));
+            joined.topic = "benchmark channel";
+            for (long i = 1; i < users; i++) {
+                User &user = getUserFromFd(FIRST_FD + i);
+                addChannelMember(joined, user);
+                user.ch_name_mask_map.insert(
+                    std::pair<Atom, unsigned char>(joined.name, 0x00));
+            }
+        }
+        for (long k = 0; k < lonely; k++) {
+            std::ostringstream name;
+            name << "#l" << k;
+            User &op = getUserFromFd(FIRST_FD);
+            Channel &channel = addNewChannel(Atom(name.str()), op);
+            op.ch_name_mask_map.insert(
+                std::pair<Atom, unsigned char>(channel.name, 0x80));
+        }
+    }
+
+    Channel& firstChannel(void) { return channel_map.begin()->second; }
+
+    enum { FIRST_FD = 10 };
+
+    unsigned long lines;
+    unsigned long bytes;
+    string sink;    // in place numerics, dropped once counted
+};
+
+static SinkServer *server = NULL;
+
+/* ---------------------------------------------------------------------- */
+/* Benchmarks                                                             */
+/* ---------------------------------------------------------------------- */
+
+static void benchParse(State &st) {
+    const string line = "PRIVMSG #general :hello everyone, how is it going?";
+    while (st.keepRunning()) {
+        string copy = line;
+        Command cmd;
+        cmd.Parse(copy);
+        sink_value += cmd.args.size();
+    }
+}
+
+static void benchSplit(State &st) {
+    string buffer;
+    for (long i = 0; i < st.arg(0); i++) {
+        buffer += "PRIVMSG #general :hello everyone\r\n";
+    }
+    while (st.keepRunning()) {
+        vector<string> lines;
+        tools::split(lines, buffer, "\r\n");
+        sink_value += lines.size();
+    }
+}
+
+static void benchTrimRepeatedChar(State &st) {
+    const string list = "#one,,#two,,,#three,#four,,,,#five,#six,,#seven";
+    while (st.keepRunning()) {
+        string copy = list;
+        sink_value += tools::trimRepeatedChar(copy, ',').size();
+    }
+}
+
+static void benchToUpperCase(State &st) {
+    const string nick = "caRCe-b042";
+    while (st.keepRunning()) {
+        string copy = nick;
+        tools::ToUpperCase(copy);
+        sink_value += copy[0];
+    }
+}
+
+/* Lookups rotate over every nick, as commands would */
+static void benchGetUserFromNick(State &st) {
+    server->populate(st.arg(0), 0);
+    vector<string> nicks;
+    for (IrcDataBase::NickFdMap::iterator it = server->nick_fd_map.begin();
+         it != server->nick_fd_map.end(); it++)
+    {
+        nicks.push_back(it->first.str());
+    }
+    size_t i = 0;
+    while (st.keepRunning()) {
+        sink_value += server->getUserFromNick(nicks[i]).fd;
+        i = (i + 1 == nicks.size()) ? 0 : i + 1;
+    }
+}
+
+static void benchUserIsInChannel(State &st) {
+    server->populate(st.arg(0), 1);
+    Channel &channel = server->firstChannel();
+    vector<Atom> nicks(channel.users.begin(), channel.users.end());
+    size_t i = 0;
+    while (st.keepRunning()) {
+        sink_value += channel.userIsInChannel(nicks[i]);
+        i = (i + 1 == nicks.size()) ? 0 : i + 1;
+    }
+}
+
+/* <bans> masks that do not match, the verdict is computed every time */
+static void banChannel(State &st) {
+    server->populate(2, 1);
+    Channel &channel = server->firstChannel();
+    for (long i = 0; i < st.arg(0); i++) {
+        std::ostringstream mask;
+        mask << "spam" << i << "*!*@10." << i % 256 << ".*";
+        channel.banUser(mask.str(), SinkServer::FIRST_FD);
+    }
+}
+
+static void benchUserInBlackList(State &st) {
+    banChannel(st);
+    Channel &channel = server->firstChannel();
+    User &user = server->getUserFromFd(SinkServer::FIRST_FD + 1);
+    while (st.keepRunning()) {
+        user.ban_cache.clear();
+        sink_value += channel.userInBlackList(user);
+    }
+}
+
+static void benchUserInBlackListCached(State &st) {
+    banChannel(st);
+    Channel &channel = server->firstChannel();
+    User &user = server->getUserFromFd(SinkServer::FIRST_FD + 1);
+    while (st.keepRunning()) {
+        sink_value += channel.userInBlackList(user);
+    }
+}
+
+/* TOPIC, 353 lines split at 512 bytes, and 366 */
+static void benchSendNamesReply(State &st) {
+    server->populate(st.arg(0), st.arg(1));
+    Channel &channel = server->firstChannel();
+    User &user = server->getUserFromFd(SinkServer::FIRST_FD);
+    while (st.keepRunning()) {
+        server->sendNamesReply(SinkServer::FIRST_FD, user, channel);
+    }
+    sink_value += server->bytes;
+}
+
+/* What every JOIN / NAMES paid before the cache, and still does after
+ * a PART, QUIT, NICK or +o / +v in the channel */
+static void benchSendNamesReplyRebuild(State &st) {
+    server->populate(st.arg(0), st.arg(1));
+    Channel &channel = server->firstChannel();
+    User &user = server->getUserFromFd(SinkServer::FIRST_FD);
+    while (st.keepRunning()) {
+        channel.invalidateNamesCache();
+        server->sendNamesReply(SinkServer::FIRST_FD, user, channel);
+    }
+    sink_value += server->bytes;
+}
+
+static void benchSendListLine(State &st) {
+    server->populate(st.arg(0), 1);
+    Channel &channel = server->firstChannel();
+    while (st.keepRunning()) {
+        server->sendListLine(SinkServer::FIRST_FD, "u0", channel);
+    }
+    sink_value += server->bytes;
+}
+
+/* A whole LIST, every batch continueList sends, over 4 channels of 200
+ * users and <lonely> of 1 : all of them, or those over 100 users */
+static void runList(State &st, const char *conditions) {
+    server->populate(200, 4, st.arg(0));
+    User &user = server->getUserFromFd(SinkServer::FIRST_FD);
+    ListFilter filter;
+    filter.parse(conditions);
+    while (st.keepRunning()) {
+        server->sendListReply(SinkServer::FIRST_FD, user, "", filter);
+        while (user.listing) {
+            server->continueList(SinkServer::FIRST_FD, user);
+        }
+    }
+    sink_value += server->bytes;
+}
+
+static void benchListAll(State &st) {
+    runList(st, "");
+}
+
+static void benchListBig(State &st) {
+    runList(st, ">100");
+}
+
+static void benchSendMessageToChannel(State &st) {
+    server->populate(st.arg(0), 1);
+    Channel &channel = server->firstChannel();
+    User &sender = server->getUserFromFd(SinkServer::FIRST_FD);
+    string message = sender.source + "PRIVMSG " + channel.name
+                     + " :hello everyone, how is it going?";
+    while (st.keepRunning()) {
+        server->sendMessageToChannel(channel, message, sender.nick);
+    }
+    sink_value += server->bytes;
+}
+
+/* The whole command, header included, to a user or to a channel */
+static void runPrivmsg(State &st, const char *target) {
+    server->populate(st.arg(0), 1);
+    string line = string("PRIVMSG ") + target
+                  + " :hello everyone, how is it going?";
+    Command cmd;
+    cmd.Parse(line);
+    while (st.keepRunning()) {
+        server->PRIVMSG(cmd, SinkServer::FIRST_FD);
+    }
+    sink_value += server->bytes;
+}
+
+static void benchPrivmsgUser(State &st) {
+    runPrivmsg(st, "u1");
+}
+
+static void benchPrivmsgChannel(State &st) {
+    runPrivmsg(st, "#c0");
+}
+
+/* A connection accepted then closed, what the user store pays per
+ * client */
+static void benchAddNewUser(State &st) {
+    server->populate(1, 0);
+    int fd = SinkServer::FIRST_FD + 1;
+    while (st.keepRunning()) {
+        server->addNewUser(fd, "127.0.0.1");
+        server->removeFdUserPair(fd);
+    }
+    sink_value += server->fd_user_map.size();
+}
+
+/* JOIN of a channel nobody is in, then PART : the channel store
+ * insert path, with the replies of both commands */
+static void benchJoinNewChannel(State &st) {
+    server->populate(1, 0);
+    string join_line = "JOIN #new";
+    string part_line = "PART #new";
+    Command join, part;
+    join.Parse(join_line);
+    part.Parse(part_line);
+    while (st.keepRunning()) {
+        server->JOIN(join, SinkServer::FIRST_FD);
+        server->PART(part, SinkServer::FIRST_FD);
+    }
+    sink_value += server->bytes;
+}
+
+/* A registration burst with no MOTD, appended to a send queue */
+static void benchWelcomeBurst(State &st) {
+    WelcomeBurst burst;
+    burst.loadMotd("/nonexistent/ircserv.motd");
+    burst.build(":irc.example.org", "irc.example.org", 0);
+    string queue;
+    while (st.keepRunning()) {
+        queue.clear();
+        burst.render(queue, "u0", "u0!u0@irc.example.org");
+        sink_value += queue.size();
+    }
+}
+
+static void benchRunOnceIdle(State &st) {
+    MemoryTransport net;
+    string host = "127.0.0.1";
+    string port = "6667";
+    Server irc(net, host, port);
+    irc.start();
+    char buff[4096];
+    vector<int> clients;
+    for (long i = 0; i < st.arg(0); i++) {
+        std::ostringstream source, lines;
+        source << "10.0." << i / 250 << "." << i % 250 + 1;
+        lines << "NICK u" << i << "\r\nUSER u" << i << " 0 * :u" << i
+              << "\r\nJOIN #bench\r\n";
+        int fd = net.connect(host, port, source.str());
+        net.send(fd, lines.str().c_str(), lines.str().size());
+        clients.push_back(fd);
+        irc.runOnce(0);
+    }
+    for (int i = 0; i < 4; i++) {
+        irc.runOnce(0);
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        while (net.recv(clients[i], buff, sizeof(buff)) > 0)
+            ;
+    }
+    while (st.keepRunning()) {
+        irc.runOnce(0);
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        net.close(clients[i]);
+    }
+}
+
+/* The last argument is the ceiling on allocations per iteration (-a).
+ * Raising one is a decision, made in the commit that needs it. */
+static void registerBenchmarks(void) {
+    vector<vector<long> > v;
+
+    addBenchmark("Command::Parse", benchParse, 22);
+    v.assign(1, values(1, 16));
+    setArgs(addBenchmark("tools::split", benchSplit, 52), "lines", v);
+    addBenchmark("tools::trimRepeatedChar", benchTrimRepeatedChar, 2);
+    addBenchmark("tools::ToUpperCase", benchToUpperCase, 0);
+
+    v.assign(1, values(10, 1000, 10000));
+    setArgs(addBenchmark("getUserFromNick", benchGetUserFromNick, 0),
+            "users", v);
+    v.assign(1, values(10, 100, 1000));
+    setArgs(addBenchmark("Channel::userIsInChannel", benchUserIsInChannel, 0),
+            "users", v);
+    v.assign(1, values(1, 10, 100));
+    setArgs(addBenchmark("Channel::userInBlackList", benchUserInBlackList, 1),
+            "bans", v);
+    setArgs(addBenchmark("Channel::userInBlackList/cached",
+                         benchUserInBlackListCached, 0), "bans", v);
+
+    v.assign(1, values(10, 100, 1000));
+    v.push_back(values(1, 20));
+    setArgs(addBenchmark("sendNamesReply", benchSendNamesReply, 0),
+            "users,channels", v);
+    setArgs(addBenchmark("sendNamesReply/rebuild",
+                         benchSendNamesReplyRebuild, 0),
+            "users,channels", v);
+    v.assign(1, values(10, 1000));
+    setArgs(addBenchmark("sendListLine", benchSendListLine, 0),
+            "users", v);
+    v.assign(1, values(1000, 100000));
+    setArgs(addBenchmark("LIST/all", benchListAll, 0), "lonely", v);
+    setArgs(addBenchmark("LIST/>100", benchListBig, 0), "lonely", v);
+    v.assign(1, values(10, 100, 1000));
+    setArgs(addBenchmark("sendMessageToChannel",
+                         benchSendMessageToChannel, 0), "users", v);
+    v.assign(1, values(2, 100));
+    setArgs(addBenchmark("PRIVMSG/user", benchPrivmsgUser, 0), "users", v);
+    setArgs(addBenchmark("PRIVMSG/channel", benchPrivmsgChannel, 0),
+            "users", v);
+    addBenchmark("IrcDataBase::addNewUser", benchAddNewUser, 1);
+    addBenchmark("JOIN+PART/new channel", benchJoinNewChannel, 6);
+    addBenchmark("WelcomeBurst::render", benchWelcomeBurst, 1);
+    v.assign(1, values(1, 10, 100, 200));
+    setArgs(addBenchmark("Server::runOnce/idle", benchRunOnceIdle, 0),
+            "users", v);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Output                                                                 */
+/* ---------------------------------------------------------------------- */
+
+static string jsonString(const string &str) {
+    string ret = "\"";
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] == '"' || str[i] == '\\') {
+            ret += '\\';
+        }
+        ret += str[i];
+    }
+    return ret + "\"";
+}
+
+/* One benchmark per line, so two files diff line by line */
+static bool writeJson(const string &path, const vector<Result> &results,
+                      const char *executable)
+{
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    out << "{\n"
+        << "  \"context\": {\n"
+        << "    \"date\": " << jsonString(date) << ",\n"
+        << "    \"host_name\": " << jsonString(host) << ",\n"
+        << "    \"executable\": " << jsonString(executable) << ",\n"
+        << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << "\n"
+        << "  },\n"
+        << "  \"benchmarks\": [\n"
+        << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < results.size(); i++) {
+        out << "    {\"name\": " << jsonString(results[i].name)
+            << ", \"iterations\": " << results[i].iterations
+            << ", \"real_time\": " << results[i].real_ns
+            << ", \"cpu_time\": " << results[i].cpu_ns
+            << ", \"time_unit\": \"ns\""
+            << ", \"allocs_per_iter\": " << results[i].allocs << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return true;
+}
+
+/* name -> cpu_time, from a file written by writeJson (or by Google
+ * Benchmark, as long as each benchmark is on its own line) */
+static std::map<string, double> readBaseline(const string &path) {
+    std::map<string, double> baseline;
+    std::ifstream in(path.c_str());
+    string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t cpu = line.find("\"cpu_time\": ");
+        if (name == string::npos || cpu == string::npos) {
+            continue;
+        }
+        name += 9;
+        size_t end = line.find('"', name);
+        double value = strtod(line.c_str() + cpu + 12, NULL);
+        baseline[line.substr(name, end - name)] = value;
+    }
+    return baseline;
+}
+
+static void printHeader(std::ostream &out, bool compare) {
+    out << std::left << std::setw(52) << "benchmark"
+              << std::right << std::setw(14) << "time (ns)"
+              << std::setw(14) << "cpu (ns)"
+              << std::setw(14) << "iterations"
+              << std::setw(10) << "allocs";
+    if (compare) {
+        out << std::setw(14) << "baseline" << std::setw(10) << "delta";
+    }
+    out << "\n" << string(compare ? 128 : 104, '-') << "\n";
+}
+
+static void printResult(std::ostream &out, const Result &res,
+                        const std::map<string, double> &baseline,
+                        bool compare)
+{
+    out << std::left << std::setw(52) << res.name << std::right
+              << std::fixed << std::setprecision(1)
+              << std::setw(14) << res.real_ns
+              << std::setw(14) << res.cpu_ns
+              << std::setw(14) << res.iterations
+              << std::setw(10) << std::setprecision(2) << res.allocs
+              << std::setprecision(1);
+    if (compare) {
+        std::map<string, double>::const_iterator it = baseline.find(res.name);
+        if (it != baseline.end() && it->second > 0) {
+            double delta = (res.cpu_ns - it->second) * 100.0 / it->second;
+            out << std::setw(14) << it->second
+                      << std::setw(9) << std::showpos << delta
+                      << std::noshowpos << "%";
+        } else {
+            out << std::setw(14) << "-" << std::setw(10) << "new";
+        }
+    }
+    out << std::endl;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [options]\n"
+        "  -f filter     only benchmarks whose name contains filter\n"
+        "  -t seconds    minimum time per benchmark (0.2)\n"
+        "  -o file       write the results as JSON\n"
+        "  -c file       compare cpu time with a previous JSON\n"
+        "  -a            fail if a benchmark allocates over its ceiling\n";
+    exit(2);
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options opt;
+    opt.min_time = 0.2;
+    opt.check_allocs = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "f:t:o:c:a")) != -1) {
+        switch (c) {
+            case 'f': opt.filter = optarg; break;
+            case 't': opt.min_time = atof(optarg); break;
+            case 'o': opt.json_out = optarg; break;
+            case 'c': opt.compare = optarg; break;
+            case 'a': opt.check_allocs = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (opt.min_time <= 0) {
+        usage(argv[0]);
+    }
+    return opt;
+}
+
+int main(int argc, char **argv) {
+    Options opt = parseOptions(argc, argv);
+    std::map<string, double> baseline;
+    if (!opt.compare.empty()) {
+        baseline = readBaseline(opt.compare);
+        if (baseline.empty()) {
+            std::cerr << "no results in " << opt.compare << "\n";
+            return 1;
+        }
+    }
+
+    /* The server logs to stdout (set up, and Command::Parse dumps every
+     * command), that output is discarded : it would be the terminal that
+     * gets measured. The table goes to the real stdout. */
+    std::ostream report(std::cout.rdbuf(NULL));
+    MemoryTransport net;
+    string host = "127.0.0.1";
+    string port = "6667";
+    try {
+        server = new SinkServer(net, host, port);
+    } catch (std::exception &e) {
+        std::cerr << "server set up failed: " << e.what() << "\n";
+        return 1;
+    }
+
+    registerBenchmarks();
+    vector<Result> results;
+    vector<string> over_ceiling;
+    printHeader(report, !opt.compare.empty());
+    for (size_t b = 0; b < registry().size(); b++) {
+        const Benchmark &bench = registry()[b];
+        vector<vector<long> > arg_sets = bench.arg_sets;
+        if (arg_sets.empty()) {
+            arg_sets.push_back(vector<long>());
+        }
+        for (size_t a = 0; a < arg_sets.size(); a++) {
+            if (resultName(bench, arg_sets[a]).find(opt.filter)
+                == string::npos)
+            {
+                continue;
+            }
+            results.push_back(runBenchmark(bench, arg_sets[a], opt.min_time));
+            const Result &res = results.back();
+            printResult(report, res, baseline, !opt.compare.empty());
+            if (res.allocs > bench.max_allocs + ALLOC_SLACK) {
+                std::ostringstream line;
+                line << res.name << ": " << res.allocs
+                     << " allocs per iteration, ceiling " << bench.max_allocs;
+                over_ceiling.push_back(line.str());
+            }
+        }
+    }
+    if (!opt.json_out.empty() && !writeJson(opt.json_out, results, argv[0])) {
+        std::cerr << "could not write " << opt.json_out << "\n";
+        return 1;
+    }
+    delete server;
+    if (opt.check_allocs && !over_ceiling.empty()) {
+        for (size_t i = 0; i < over_ceiling.size(); i++) {
+            std::cerr << "over ceiling: " << over_ceiling[i] << "\n";
+        }
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,417 @@
+#include "BenchTools.hpp"
+#include "Capture.hpp"
+#include "Metrics.hpp"
+#include "Tools.hpp"
+#include "Types.hpp"
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Replays a traffic capture (IRCSERV_CAPTURE, see Capture.hpp) :
+ * one connection per captured connection, from its own loopback source
+ * (127.21.x.y), sending the same bytes at the same offsets, divided by
+ * the speed factor (-s 10 is ten times faster, -s 0 as fast as possible).
+ * Whatever the server answers is read and counted, never interpreted.
+ *
+ * Replayed traffic says nothing about latency by itself, so a few probe
+ * clients (127.22.0.x) PING the server all along and time the PONGs.
+ * A probe sends one PING every PROBE_INTERVAL_US, within the flood
+ * budget of the server. Two builds replaying the same capture at the
+ * same speed give comparable numbers : wall time, throughput, PONG
+ * round trips, and server CPU and RSS with -x <pid>.
+ */
+
+using std::string;
+using std::vector;
+using namespace irc;
+
+typedef enum {
+    PROBE_INTERVAL_US = 500000,     // FLOOD_REFILL_PER_S PINGs per second
+    REGISTER_TIMEOUT_US = 5000000,
+    DRAIN_US = 1000000,
+    CLOSE_QUIET_US = 100000,        // see Conn::close_at
+    CLOSE_GRACE_US = 1000000,
+    READ_SIZE = 65536
+} REPLAY_CONFIG;
+
+typedef struct Options {
+    string host;
+    int port;
+    string path;
+    double speed;
+    int probes;
+    int server_pid;
+} Options;
+
+typedef struct Event {
+    unsigned long at_us;    // since the start of the capture
+    Capture::Record record;
+} Event;
+
+/* A replayed CLOSE waits for out to be sent, then for the server to be
+ * done answering (CLOSE_QUIET_US without input, CLOSE_GRACE_US at most) :
+ * sped up, the close would otherwise land before the lines are run. */
+typedef struct Conn {
+    int fd;
+    string out;
+    unsigned long close_at; // 0 : not closing
+    unsigned long last_in_us;
+} Conn;
+
+typedef struct Probe {
+    int fd;
+    string in;
+    string out;
+    bool registered;
+    unsigned long next_us;
+    unsigned long sent_us;  // 0 : no PING in flight
+} Probe;
+
+typedef struct Totals {
+    unsigned long conns;
+    unsigned long failed_conns;
+    unsigned long bytes_out;
+    unsigned long bytes_in;
+    unsigned long lines_in;
+    unsigned long reset;    // connections closed by the server
+} Totals;
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [options] <capture file>\n"
+        "  -h host     server address (127.0.0.1)\n"
+        "  -p port     server port (6667)\n"
+        "  -s speed    time divided by speed, 0 : no waiting (1)\n"
+        "  -n probes   PING probes (4)\n"
+        "  -x pid      server pid, for CPU and RSS\n";
+    exit(2);
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options opt;
+    opt.host = "127.0.0.1";
+    opt.port = 6667;
+    opt.speed = 1;
+    opt.probes = 4;
+    opt.server_pid = 0;
+    int c;
+    while ((c = getopt(argc, argv, "h:p:s:n:x:")) != -1) {
+        switch (c) {
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 's': opt.speed = atof(optarg); break;
+            case 'n': opt.probes = atoi(optarg); break;
+            case 'x': opt.server_pid = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || opt.speed < 0 || opt.probes < 0) {
+        usage(argv[0]);
+    }
+    opt.path = argv[optind];
+    return opt;
+}
+
+static bool loadCapture(const string &path, vector<Event> &events) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open() || !Capture::readHeader(file)) {
+        return false;
+    }
+    unsigned long at = 0;
+    Event event;
+    while (Capture::readRecord(file, event.record)) {
+        at += event.record.delta_us;
+        event.at_us = at;
+        events.push_back(event);
+    }
+    return true;
+}
+
+/* Reads what is there, counted. Kept in keep if not NULL, else thrown
+ * away. false once the connection is closed. */
+static bool drainSocket(int fd, unsigned long &bytes, unsigned long &lines,
+                        string *keep)
+{
+    char buff[READ_SIZE];
+    while (42) {
+        ssize_t n = recv(fd, buff, sizeof(buff), 0);
+        if (n > 0) {
+            bytes += n;
+            for (ssize_t i = 0; i < n; i++) {
+                lines += buff[i] == '\n';
+            }
+            if (keep != NULL) {
+                keep->append(buff, n);
+            }
+            continue ;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR))
+        {
+            return true;
+        }
+        return false;
+    }
+}
+
+static bool writeSocket(int fd, string &out, unsigned long &bytes) {
+    while (!out.empty()) {
+        ssize_t n = send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+        if (n == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        bytes += n;
+        out.erase(0, n);
+    }
+    return true;
+}
+
+static void closeConn(std::map<unsigned long, Conn> &conns,
+                      std::map<unsigned long, Conn>::iterator it)
+{
+    close(it->second.fd);
+    conns.erase(it);
+}
+
+static void applyEvent(const Options &opt, const Event &event,
+                       std::map<unsigned long, Conn> &conns, Totals &totals)
+{
+    const Capture::Record &record = event.record;
+    std::map<unsigned long, Conn>::iterator it = conns.find(record.conn);
+    if (record.type == Capture::OPEN) {
+        if (it != conns.end()) {
+            closeConn(conns, it);
+        }
+        int fd = bench::connectFrom(opt.host, opt.port, 21,
+                                    record.conn % 62500, 0);
+        if (fd == -1) {
+            totals.failed_conns++;
+            return ;
+        }
+        Conn conn = {fd, "", 0, tools::monotonicUs()};
+        conns[record.conn] = conn;
+        totals.conns++;
+        return ;
+    }
+    if (it == conns.end()) {
+        return ;
+    }
+    if (record.type == Capture::DATA) {
+        it->second.out += record.data;
+    } else if (it->second.close_at == 0) {
+        it->second.close_at = tools::monotonicUs();
+    }
+}
+
+static void probeLine(Probe &probe, const string &line,
+                      Metrics::Histogram &rtt)
+{
+    size_t pos = line.find(' ');
+    if (pos != string::npos && line.compare(pos, 5, " 001 ") == 0) {
+        probe.registered = true;
+    } else if (line.compare(0, 5, "PONG ") == 0 && probe.sent_us != 0) {
+        rtt.observe(tools::monotonicUs() - probe.sent_us);
+        probe.sent_us = 0;
+    }
+}
+
+/* Probe traffic is not counted with the replayed one */
+static void pollProbe(Probe &probe, Metrics::Histogram &rtt) {
+    unsigned long bytes = 0;
+    unsigned long lines = 0;
+    drainSocket(probe.fd, bytes, lines, &probe.in);
+    size_t start = 0;
+    size_t end;
+    while ((end = probe.in.find(CRLF, start)) != string::npos) {
+        probeLine(probe, probe.in.substr(start, end - start), rtt);
+        start = end + 2;
+    }
+    probe.in.erase(0, start);
+    unsigned long now = tools::monotonicUs();
+    if (probe.registered && probe.sent_us == 0 && now >= probe.next_us) {
+        std::ostringstream ping;
+        ping << "PING :" << now << CRLF;
+        probe.out += ping.str();
+        probe.sent_us = now;
+        probe.next_us = now + PROBE_INTERVAL_US;
+    }
+    writeSocket(probe.fd, probe.out, bytes);
+}
+
+/* One poll round over connections and probes */
+static void pump(std::map<unsigned long, Conn> &conns,
+                 vector<Probe> &probes, Metrics::Histogram &rtt,
+                 Totals &totals, int timeout_ms)
+{
+    vector<struct pollfd> fds;
+    for (std::map<unsigned long, Conn>::iterator it = conns.begin();
+         it != conns.end(); it++)
+    {
+        struct pollfd p = {it->second.fd, POLLIN, 0};
+        if (!it->second.out.empty()) {
+            p.events |= POLLOUT;
+        }
+        fds.push_back(p);
+    }
+    for (size_t i = 0; i < probes.size(); i++) {
+        struct pollfd p = {probes[i].fd, POLLIN, 0};
+        if (!probes[i].out.empty()) {
+            p.events |= POLLOUT;
+        }
+        fds.push_back(p);
+    }
+    if (!fds.empty()) {
+        poll(&fds[0], fds.size(), timeout_ms);
+    }
+    unsigned long now = tools::monotonicUs();
+    size_t f = 0;
+    std::map<unsigned long, Conn>::iterator it = conns.begin();
+    while (it != conns.end()) {
+        Conn &conn = it->second;
+        bool alive = true;
+        if (fds[f].revents & (POLLIN | POLLHUP | POLLERR)) {
+            unsigned long before = totals.bytes_in;
+            alive = drainSocket(conn.fd, totals.bytes_in, totals.lines_in,
+                                NULL);
+            if (totals.bytes_in != before) {
+                conn.last_in_us = now;
+            }
+        }
+        alive = alive && writeSocket(conn.fd, conn.out, totals.bytes_out);
+        f++;
+        if (!alive) {
+            totals.reset++;
+        }
+        bool done = conn.close_at != 0 && conn.out.empty()
+                    && (now - conn.last_in_us >= CLOSE_QUIET_US
+                        || now - conn.close_at >= CLOSE_GRACE_US);
+        if (!alive || done) {
+            closeConn(conns, it++);
+        } else {
+            it++;
+        }
+    }
+    for (size_t i = 0; i < probes.size(); i++) {
+        pollProbe(probes[i], rtt);
+    }
+}
+
+static bool startProbes(const Options &opt, vector<Probe> &probes) {
+    for (int i = 0; i < opt.probes; i++) {
+        std::ostringstream nick;
+        nick << "probe" << i;
+        Probe probe = {-1, "", "", false, 0, 0};
+        probe.fd = bench::connectFrom(opt.host, opt.port, 22, i, 0);
+        if (probe.fd == -1) {
+            return false;
+        }
+        probe.out = "NICK " + nick.str() + CRLF
+                    + "USER " + nick.str() + " 0 * :replay probe" CRLF;
+        probes.push_back(probe);
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Options opt = parseOptions(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<Event> events;
+    if (!loadCapture(opt.path, events)) {
+        std::cerr << opt.path << " : not a capture file\n";
+        return 1;
+    }
+    Metrics::Histogram rtt(1, 24, 4);
+    Totals totals;
+    memset(&totals, 0, sizeof(totals));
+    std::map<unsigned long, Conn> conns;
+    vector<Probe> probes;
+    if (!startProbes(opt, probes)) {
+        std::cerr << "probe connect : " << strerror(errno) << "\n";
+        return 1;
+    }
+    unsigned long deadline = tools::monotonicUs() + REGISTER_TIMEOUT_US;
+    bool ready = false;
+    while (!ready && tools::monotonicUs() < deadline) {
+        pump(conns, probes, rtt, totals, 10);
+        ready = true;
+        for (size_t i = 0; i < probes.size(); i++) {
+            ready = ready && probes[i].registered;
+        }
+    }
+    /* stagger the probes over one interval */
+    unsigned long start = tools::monotonicUs();
+    for (size_t i = 0; i < probes.size(); i++) {
+        probes[i].next_us = start + PROBE_INTERVAL_US * i / probes.size();
+    }
+
+    bench::ServerUsage before = bench::readServerUsage(opt.server_pid);
+    size_t next = 0;
+    while (next < events.size() || !conns.empty()) {
+        unsigned long elapsed = tools::monotonicUs() - start;
+        while (next < events.size()
+               && (opt.speed == 0
+                   || events[next].at_us / opt.speed <= elapsed))
+        {
+            applyEvent(opt, events[next++], conns, totals);
+        }
+        /* still open at the end of the capture : left open by the
+         * client, or the capture was cut short */
+        if (next == events.size()) {
+            for (std::map<unsigned long, Conn>::iterator it = conns.begin();
+                 it != conns.end(); it++)
+            {
+                if (it->second.close_at == 0) {
+                    it->second.close_at = tools::monotonicUs();
+                }
+            }
+        }
+        pump(conns, probes, rtt, totals, 1);
+    }
+    double seconds = (tools::monotonicUs() - start) / 1000000.0;
+    unsigned long drain_end = tools::monotonicUs() + DRAIN_US;
+    while (tools::monotonicUs() < drain_end) {
+        pump(conns, probes, rtt, totals, 10);
+    }
+    bench::ServerUsage after = bench::readServerUsage(opt.server_pid);
+    for (size_t i = 0; i < probes.size(); i++) {
+        close(probes[i].fd);
+    }
+
+    unsigned long captured = events.empty() ? 0 : events.back().at_us;
+    std::ostringstream speed;
+    if (opt.speed == 0) {
+        speed << "full speed";
+    } else {
+        speed << "x" << opt.speed;
+    }
+    std::cout << std::fixed << std::setprecision(1)
+        << "capture " << opt.path << " : " << events.size() << " records, "
+        << captured / 1000000.0 << "s, replayed at " << speed.str() << "\n"
+        << "replay " << seconds << "s : connections " << totals.conns
+        << " (" << totals.failed_conns << " failed, " << totals.reset
+        << " closed by the server)\n"
+        << "sent " << totals.bytes_out << " bytes, "
+        << totals.bytes_out / seconds / 1024 << " KiB/s, received "
+        << totals.bytes_in << " bytes, " << totals.lines_in << " lines, "
+        << totals.lines_in / seconds << " lines/s\n"
+        << "probe PING rtt us : p50 " << rtt.quantile(0.5)
+        << ", p90 " << rtt.quantile(0.9)
+        << ", p99 " << rtt.quantile(0.99)
+        << ", max " << rtt.max << " (" << rtt.count << " samples)\n";
+    bench::printServerUsage(before, after, seconds);
+    return 0;
+}
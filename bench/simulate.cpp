@@ -0,0 +1,356 @@
+#include "BenchTools.hpp"
+#include "Server/Server.hpp"
+#include "Server/MemoryTransport.hpp"
+#include "Atom.hpp"
+#include "Clock.hpp"
+#include "Tools.hpp"
+#include "Types.hpp"
+
+#include <unistd.h>
+#include <stdlib.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Deterministic simulation (make simulate).
+ *
+ * Runs the server, embedded, on a MemoryTransport with a ManualClock :
+ * thousands of virtual clients over a simulated day, in seconds of real
+ * time. Every step moves the clock -t seconds, lets each client read and
+ * react, then runs the server. Same options and seed, same run.
+ *
+ * Clients are of three kinds :
+ *   active  talk in their channel every -i minutes (on average), and
+ *           answer PINGs
+ *   quiet   never talk, answer PINGs
+ *   dead    never answer : pinged, timed out, and they reconnect -r
+ *           seconds later, for ever
+ *
+ * Every simulated hour prints the ping traffic (PINGs received, PONGs
+ * sent, their bytes), timeouts and reconnections, and what the server
+ * holds : users, interned atoms, tracked sources, and the process RSS.
+ */
+
+using std::string;
+using std::vector;
+using namespace irc;
+
+typedef enum {
+    ACTIVE = 0,
+    QUIET,
+    DEAD
+} CLIENT_KIND;
+
+typedef enum {
+    SIM_START = 1700000000,     // simulated epoch, any fixed date
+    ITERATIONS_PER_STEP = 2,    // read + run, then what that queued
+    READ_SIZE = 4096
+} SIMULATE_CONFIG;
+
+typedef struct Options {
+    int clients;
+    int channels;
+    int hours;
+    int step_s;
+    int active_pct;
+    int dead_pct;
+    int msg_interval_min;
+    int reconnect_s;
+    unsigned int seed;
+} Options;
+
+typedef struct Client {
+    int id;
+    CLIENT_KIND kind;
+    int fd;                 // -1 while disconnected
+    time_t reconnect_at;
+    time_t next_msg_at;
+    string channel;
+    string partial;         // incomplete line read so far
+} Client;
+
+typedef struct Totals {
+    unsigned long pings;
+    unsigned long ping_bytes;
+    unsigned long pongs;
+    unsigned long pong_bytes;
+    unsigned long timeouts;
+    unsigned long connects;
+    unsigned long messages;
+    unsigned long bytes_in;     // read by clients
+    unsigned long bytes_out;    // sent by clients
+} Totals;
+
+static void usage(const char *name) {
+    std::cerr << "usage: " << name << " [options]\n"
+        "  -c clients    virtual clients (1000)\n"
+        "  -C channels   channels (50)\n"
+        "  -H hours      simulated hours (24)\n"
+        "  -t seconds    simulated time per step (10)\n"
+        "  -a percent    active clients (20)\n"
+        "  -d percent    dead clients (5)\n"
+        "  -i minutes    mean time between messages of active clients (10)\n"
+        "  -r seconds    reconnection delay of dead clients (60)\n"
+        "  -s seed       random seed (42)\n";
+    exit(2);
+}
+
+static Options parseOptions(int argc, char **argv) {
+    Options opt;
+    opt.clients = 1000;
+    opt.channels = 50;
+    opt.hours = 24;
+    opt.step_s = 10;
+    opt.active_pct = 20;
+    opt.dead_pct = 5;
+    opt.msg_interval_min = 10;
+    opt.reconnect_s = 60;
+    opt.seed = 42;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:C:H:t:a:d:i:r:s:")) != -1) {
+        switch (c) {
+            case 'c': opt.clients = atoi(optarg); break;
+            case 'C': opt.channels = atoi(optarg); break;
+            case 'H': opt.hours = atoi(optarg); break;
+            case 't': opt.step_s = atoi(optarg); break;
+            case 'a': opt.active_pct = atoi(optarg); break;
+            case 'd': opt.dead_pct = atoi(optarg); break;
+            case 'i': opt.msg_interval_min = atoi(optarg); break;
+            case 'r': opt.reconnect_s = atoi(optarg); break;
+            case 's': opt.seed = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (opt.clients < 1 || opt.channels < 1 || opt.hours < 1
+        || opt.step_s < 1 || opt.active_pct < 0 || opt.dead_pct < 0
+        || opt.active_pct + opt.dead_pct > 100 || opt.msg_interval_min < 1
+        || opt.reconnect_s < 0)
+    {
+        usage(argv[0]);
+    }
+    return opt;
+}
+
+/* The simulation's own generator, apart from the server's */
+static unsigned int sim_rng;
+
+static unsigned int nextRandom(void) {
+    sim_rng ^= sim_rng << 13;
+    sim_rng ^= sim_rng >> 17;
+    sim_rng ^= sim_rng << 5;
+    return sim_rng;
+}
+
+/* Uniform in [mean / 2, mean * 3 / 2] */
+static time_t around(int mean_s) {
+    return mean_s / 2 + nextRandom() % (mean_s + 1);
+}
+
+static void sendLine(MemoryTransport &net, Client &client,
+                     const string &line, Totals &totals)
+{
+    string data = line + CRLF;
+    net.send(client.fd, data.data(), data.size());
+    totals.bytes_out += data.size();
+}
+
+static void connectClient(MemoryTransport &net, Client &client,
+                          const string &host, const string &port,
+                          Totals &totals)
+{
+    std::ostringstream source, nick;
+    source << "10." << client.id / 62500 << "." << client.id / 250 % 250
+           << "." << client.id % 250 + 1;
+    client.fd = net.connect(host, port, source.str());
+    if (client.fd == -1) {
+        return ;
+    }
+    totals.connects++;
+    nick << "sim" << client.id;
+    client.partial.clear();
+    sendLine(net, client, "NICK " + nick.str(), totals);
+    sendLine(net, client, "USER " + nick.str() + " 0 * :" + nick.str(),
+             totals);
+    sendLine(net, client, "JOIN " + client.channel, totals);
+}
+
+/* Reads everything waiting, answers PINGs. False once the server
+ * closed the connection. */
+static bool readClient(MemoryTransport &net, Client &client,
+                       Totals &totals)
+{
+    char buff[READ_SIZE];
+    ssize_t len;
+    while ((len = net.recv(client.fd, buff, sizeof(buff))) > 0) {
+        totals.bytes_in += len;
+        client.partial.append(buff, len);
+    }
+    size_t start = 0;
+    size_t end;
+    while ((end = client.partial.find(CRLF, start)) != string::npos) {
+        string line = client.partial.substr(start, end - start);
+        start = end + 2;
+        if (line.compare(0, 5, "PING ") == 0) {
+            totals.pings++;
+            totals.ping_bytes += line.size() + 2;
+            if (client.kind != DEAD) {
+                string pong = "PONG " + line.substr(5);
+                sendLine(net, client, pong, totals);
+                totals.pongs++;
+                totals.pong_bytes += pong.size() + 2;
+            }
+        } else if (line.compare(0, 6, "ERROR ") == 0
+                   && line.find("Ping timeout") != string::npos)
+        {
+            totals.timeouts++;
+        }
+    }
+    client.partial.erase(0, start);
+    return len != 0;
+}
+
+static void printHeader(std::ostream &out) {
+    out << std::setw(5) << "hour"
+        << std::setw(8) << "users"
+        << std::setw(9) << "pings"
+        << std::setw(9) << "pongs"
+        << std::setw(10) << "ping KB"
+        << std::setw(9) << "timeout"
+        << std::setw(9) << "connect"
+        << std::setw(9) << "msgs"
+        << std::setw(10) << "in KB"
+        << std::setw(9) << "atoms"
+        << std::setw(9) << "sources"
+        << std::setw(10) << "rss KB"
+        << std::setw(8) << "wall s" << "\n";
+}
+
+static void printHour(std::ostream &out, int hour, Server &irc,
+                      const Totals &t, const Totals &before,
+                      double wall_s)
+{
+    bench::ServerUsage usage = bench::readServerUsage(getpid());
+    out << std::setw(5) << hour
+        << std::setw(8) << irc.fd_user_map.size()
+        << std::setw(9) << t.pings - before.pings
+        << std::setw(9) << t.pongs - before.pongs
+        << std::setw(10) << (t.ping_bytes + t.pong_bytes
+                             - before.ping_bytes - before.pong_bytes) / 1024
+        << std::setw(9) << t.timeouts - before.timeouts
+        << std::setw(9) << t.connects - before.connects
+        << std::setw(9) << t.messages - before.messages
+        << std::setw(10) << (t.bytes_in - before.bytes_in) / 1024
+        << std::setw(9) << Atom::tableSize()
+        << std::setw(9) << irc.sources.size()
+        << std::setw(10) << usage.rss_kb
+        << std::setw(8) << std::fixed << std::setprecision(1) << wall_s
+        << std::endl;
+}
+
+int main(int argc, char **argv) {
+    Options opt = parseOptions(argc, argv);
+    sim_rng = opt.seed ? opt.seed : 1;
+    tools::rngSeed(opt.seed);
+
+    /* The server logs every line it sends to stdout : that output is
+     * discarded, the report goes to the real stdout */
+    std::ostream report(std::cout.rdbuf(NULL));
+    ManualClock clock(SIM_START);
+    MemoryTransport net;
+    string host = "127.0.0.1";
+    string port = "6667";
+    Server irc(net, host, port);
+    irc.setClock(clock);
+    irc.setMaxFds(opt.clients + 2); // + listener, admin listener
+    irc.start();
+
+    vector<Client> clients(opt.clients);
+    Totals totals = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < opt.clients; i++) {
+        Client &client = clients[i];
+        int roll = nextRandom() % 100;
+        client.id = i;
+        client.kind = roll < opt.active_pct ? ACTIVE
+                      : roll < opt.active_pct + opt.dead_pct ? DEAD
+                      : QUIET;
+        client.fd = -1;
+        /* connections are spread over the first minute */
+        client.reconnect_at = SIM_START + nextRandom() % 60;
+        client.next_msg_at = SIM_START + around(opt.msg_interval_min * 60);
+        std::ostringstream channel;
+        channel << "#sim" << nextRandom() % opt.channels;
+        client.channel = channel.str();
+    }
+
+    report << opt.clients << " clients, " << opt.hours << "h in steps of "
+           << opt.step_s << "s, seed " << opt.seed << "\n";
+    printHeader(report);
+    bench::ServerUsage usage_start = bench::readServerUsage(getpid());
+    unsigned long wall_start = tools::monotonicUs();
+    Totals hour_start = totals;
+    time_t end = SIM_START + opt.hours * 3600;
+    int hour = 0;
+    while (clock.now() < end) {
+        clock.advance(opt.step_s * 1000000UL);
+        time_t now = clock.now();
+        unsigned long connects = totals.connects;
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client &client = clients[i];
+            if (client.fd == -1) {
+                if (now >= client.reconnect_at) {
+                    connectClient(net, client, host, port, totals);
+                }
+                continue;
+            }
+            if (!readClient(net, client, totals)) {
+                net.close(client.fd);
+                client.fd = -1;
+                client.reconnect_at = now + opt.reconnect_s;
+                continue;
+            }
+            if (client.kind == ACTIVE && now >= client.next_msg_at) {
+                sendLine(net, client, "PRIVMSG " + client.channel
+                         + " :still here", totals);
+                totals.messages++;
+                client.next_msg_at = now + around(opt.msg_interval_min * 60);
+            }
+        }
+        /* the server accepts one connection per iteration, and a real
+         * one would have iterated that many times in step_s */
+        int iterations = ITERATIONS_PER_STEP + totals.connects - connects;
+        for (int i = 0; i < iterations; i++) {
+            irc.runOnce(0);
+        }
+        if (now - SIM_START >= (hour + 1) * 3600) {
+            hour++;
+            printHour(report, hour, irc, totals, hour_start,
+                      (tools::monotonicUs() - wall_start) / 1e6);
+            hour_start = totals;
+        }
+    }
+
+    bench::ServerUsage usage_end = bench::readServerUsage(getpid());
+    double wall_s = (tools::monotonicUs() - wall_start) / 1e6;
+    report << "\n"
+           << opt.hours << "h simulated in " << std::setprecision(1)
+           << wall_s << "s (" << std::setprecision(0)
+           << opt.hours * 3600 / (wall_s > 0 ? wall_s : 1) << "x)\n"
+           << "ping traffic : " << totals.pings << " PINGs, "
+           << totals.pongs << " PONGs, "
+           << (totals.ping_bytes + totals.pong_bytes) / 1024 << " KB, "
+           << std::setprecision(2)
+           << (double)(totals.ping_bytes + totals.pong_bytes)
+              / (totals.bytes_in + totals.bytes_out) * 100
+           << "% of all traffic\n"
+           << "timeouts : " << totals.timeouts << ", connections : "
+           << totals.connects << "\n"
+           << "rss : " << usage_start.rss_kb << " KB after set up, "
+           << usage_end.rss_kb << " KB at the end, peak "
+           << usage_end.peak_rss_kb << " KB\n";
+    return 0;
+}
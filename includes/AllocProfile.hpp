@@ -0,0 +1,79 @@
+#ifndef IRC42_ALLOCPROFILE_H
+# define IRC42_ALLOCPROFILE_H
+
+#include <cstddef>
+
+namespace irc {
+
+/*
+ * Allocation profiling, only in builds made with ALLOC_PROFILE=1
+ * (make re ALLOC_PROFILE=1 : objects built without it don't count).
+ *
+ * The global operator new / delete are replaced (AllocProfile.cpp), and
+ * every allocation is charged to the subsystem of the innermost
+ * AllocScope alive when it happens. Its free goes to the same one, so
+ * live allocations are per subsystem too, wherever they are freed :
+ *
+ *   void IrcDataBase::addNewUser(...) {
+ *       AllocScope scope(ALLOC_USERS);
+ *       ...
+ *   }
+ *
+ * In other builds AllocScope is empty and enabled() is false : nothing
+ * is counted, and STATS a / the metrics say so instead.
+ */
+typedef enum {
+    ALLOC_OTHER = 0,    // outside any scope : start up, the poll loop
+    ALLOC_PARSER,       // reads cut in lines, Command::Parse
+    ALLOC_COMMANDS,     // handlers, the replies they build included
+    ALLOC_USERS,        // user store
+    ALLOC_CHANNELS,     // channel store, ban lists
+    ALLOC_SENDQ,        // send queues
+    ALLOC_LOG,          // LOG
+    ALLOC_TAGS
+} ALLOC_TAG;
+
+class AllocProfile {
+
+    public:
+    struct Counters {
+        unsigned long allocs;
+        unsigned long bytes;
+        unsigned long live;
+        unsigned long live_bytes;
+    };
+
+    static bool enabled(void);
+    static const char* name(ALLOC_TAG tag);
+    static const Counters& counters(ALLOC_TAG tag);
+    static unsigned long allocations(void);     // every subsystem
+
+    /* Makes tag the current one, returns the previous (see AllocScope) */
+    static ALLOC_TAG enter(ALLOC_TAG tag);
+
+    private:
+    AllocProfile(void);
+};
+
+class AllocScope {
+
+    public:
+#ifdef ALLOC_PROFILE
+    explicit AllocScope(ALLOC_TAG tag) : previous(AllocProfile::enter(tag)) {}
+    ~AllocScope() { AllocProfile::enter(previous); }
+#else
+    explicit AllocScope(ALLOC_TAG) {}
+#endif
+
+    private:
+    AllocScope(const AllocScope &other);
+    AllocScope& operator=(const AllocScope &other);
+
+#ifdef ALLOC_PROFILE
+    ALLOC_TAG previous;
+#endif
+};
+
+} // namespace
+
+#endif /* IRC42_ALLOCPROFILE_H */
@@ -0,0 +1,71 @@
+#ifndef IRC42_ATOM_H
+# define IRC42_ATOM_H
+
+#include <string>
+#include <map>
+#include <ostream>
+
+namespace irc {
+
+/*
+ * Interned, refcounted string. Every distinct nick / channel name / mask
+ * living in the server is stored exactly once in a global intern table,
+ * and every container (channel_map, nick_fd_map, ch_name_mask_map,
+ * Channel::users, white_list, black_list ...) holds an Atom, which is
+ * just a pointer to the table entry.
+ *
+ * - Equality is a pointer comparison.
+ * - Ordering compares pointers first, and falls back to the string
+ *   contents, so maps keyed by Atom keep their alphabetical order
+ *   (LIST output does not change).
+ * - An entry is erased from the table when its last Atom dies.
+ *
+ * Atom(str) interns (creates the entry if needed). For lookups of
+ * strings coming from the network, which may not exist, use
+ * Atom::lookup(str), which never touches the table: an unknown string
+ * gives back an empty Atom, which is never a key anywhere.
+ */
+class Atom {
+
+    typedef std::map<std::string, unsigned long> InternTable;
+    typedef InternTable::value_type Entry;
+
+    public:
+    Atom(void);
+    explicit Atom(const std::string &str);
+    Atom(const Atom &other);
+    ~Atom();
+
+    Atom& operator=(const Atom &other);
+
+    static Atom lookup(const std::string &str);
+    static size_t tableSize(void);
+    static size_t tableBytes(void);
+
+    const std::string& str(void) const;
+    const char* c_str(void) const;
+    size_t size(void) const;
+    bool empty(void) const;
+    int compare(const std::string &other) const;
+
+    bool operator==(const Atom &other) const;
+    bool operator!=(const Atom &other) const;
+    bool operator<(const Atom &other) const;
+
+    private:
+    static InternTable& table(void);
+    void retain(void);
+    void release(void);
+
+    Entry *entry;
+};
+
+std::string operator+(const std::string &lhs, const Atom &rhs);
+std::string operator+(const char *lhs, const Atom &rhs);
+std::string operator+(const Atom &lhs, const std::string &rhs);
+std::string operator+(const Atom &lhs, const char *rhs);
+std::ostream& operator<<(std::ostream &o, const Atom &rhs);
+
+} // namespace
+
+#endif /* IRC42_ATOM_H */
@@ -0,0 +1,78 @@
+#ifndef IRC42_BANLIST_H
+# define IRC42_BANLIST_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Atom.hpp"
+#include "CidrTrie.hpp"
+
+namespace irc {
+
+/*
+ * Channel ban list (+b). Masks are compiled when they are added, so
+ * matching a user never parses a mask again :
+ *
+ *   *!*@*                   -> all_banned counter
+ *   nick!*@*   (no globs)   -> literal nick set
+ *   *!*@host   (no globs)   -> literal host set
+ *   *!*@a.b.c.d/n, ipv6/n   -> CIDR radix trie
+ *   anything else           -> glob list, matched against NICK!USER@HOST
+ *
+ * Everything is stored upper cased, nicks are case insensitive.
+ * Every change bumps generation(), which is unique across all ban lists
+ * of the server, so callers can cache verdicts and check they are still
+ * valid with a single integer comparison (see User::ban_cache).
+ */
+class BanList {
+
+    public:
+    typedef std::map<Atom, int> MaskSetterMap;
+
+    BanList(void);
+    ~BanList();
+
+    static std::string normalizeMask(const std::string &mask);
+
+    bool add(const std::string &mask, int setter_fd);
+    bool remove(const std::string &mask);
+    bool contains(const std::string &mask) const;
+    bool matches(const std::string &nick, const std::string &user,
+                 const std::string &host) const;
+
+    bool empty(void) const;
+    size_t size(void) const;
+    unsigned long generation(void) const;
+    const MaskSetterMap& entries(void) const;
+
+    private:
+    typedef enum {
+        MASK_ALL = 0,
+        MASK_NICK,
+        MASK_HOST,
+        MASK_CIDR,
+        MASK_GLOB
+    } MASK_KIND;
+
+    static MASK_KIND classify(const std::string &mask, std::string &key,
+                              IpAddr &addr, int &len);
+    void compile(const std::string &mask, bool add);
+    void bump(void);
+
+    MaskSetterMap masks;    // as shown in RPL_BANLIST, <mask, setter fd>
+
+    unsigned long all_banned;
+    std::map<std::string, unsigned long> nicks;
+    std::map<std::string, unsigned long> hosts;
+    CidrTrie cidrs;
+    std::vector<std::string> globs;
+
+    unsigned long gen;
+    static unsigned long last_gen;
+};
+
+} // namespace
+
+#endif /* IRC42_BANLIST_H */
@@ -0,0 +1,40 @@
+#ifndef IRC42_BUFFERPOOL_H
+# define IRC42_BUFFERPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+namespace irc {
+
+/*
+ * BUFF_MAX_SIZE blocks for the partial lines users keep between reads
+ * (see User::addLeftovers). Most users never have more than a few bytes
+ * waiting, if any, so a user only holds a block while a long line is
+ * incomplete : it is given back as soon as the line is. Given back
+ * blocks are kept for the next one, up to BUFFER_POOL_MAX_FREE, so a
+ * busy server keeps reusing the same few.
+ */
+class BufferPool {
+
+    public:
+    static BufferPool& global(void);
+
+    char* take(void);
+    void give(char *block);
+
+    size_t inUse(void) const;
+    size_t pooled(void) const;
+
+    private:
+    BufferPool(void);
+    ~BufferPool();
+    BufferPool(const BufferPool &other);
+    BufferPool& operator=(const BufferPool &other);
+
+    std::vector<char*> free_blocks;
+    size_t in_use;
+};
+
+} // namespace
+
+#endif /* IRC42_BUFFERPOOL_H */
@@ -0,0 +1,78 @@
+#ifndef IRC42_CAPTURE_H
+# define IRC42_CAPTURE_H
+
+#include <fstream>
+#include <istream>
+#include <map>
+#include <string>
+
+namespace irc {
+
+/*
+ * Traffic capture : everything clients send, and when, so bench/replay
+ * can play it again against another build. Enabled by starting the
+ * server with IRCSERV_CAPTURE=<file>.
+ *
+ * File : the magic line, then one record per event
+ *
+ *   <type : 1 byte> <connection : varint> <time : varint>
+ *   DATA only : <length : varint> <bytes>
+ *
+ * Connections are numbered in accept order (fds get reused, those
+ * numbers don't). Times are microseconds since the previous record.
+ * Varints are LEB128 : 7 bits per byte, high bit set if more follow.
+ * CLOSE is written for every close, the client's or the server's (QUIT,
+ * ping timeout, kills) : replayed, both become a client side close.
+ */
+class Capture {
+
+    public:
+    typedef enum {
+        OPEN = 0,
+        DATA,
+        CLOSE
+    } RECORD_TYPE;
+
+    typedef struct Record {
+        RECORD_TYPE type;
+        unsigned long conn;
+        unsigned long delta_us;
+        std::string data;
+    } Record;
+
+    Capture(void);
+    ~Capture();
+
+    bool open(const std::string &path);
+    bool isOpen(void) const;
+
+    void opened(int fd);
+    void received(int fd, const char *data, size_t len);
+    void closed(int fd);
+    void flush(void);
+
+    /* Reading, for the replay tool */
+    static bool readHeader(std::istream &in);
+    static bool readRecord(std::istream &in, Record &record);
+
+    private:
+    /* one file, one writer */
+    Capture(const Capture &other);
+    Capture& operator=(const Capture &other);
+
+    void putRecord(RECORD_TYPE type, int fd);
+    void putVarint(unsigned long value);
+    static bool getVarint(std::istream &in, unsigned long &value);
+
+    static const char magic[];
+
+    std::ofstream file;
+    std::map<int, unsigned long> conn_ids; // <fd, connection>
+    unsigned long next_conn;
+    unsigned long last_us;
+    bool dirty;
+};
+
+} // namespace
+
+#endif /* IRC42_CAPTURE_H */
@@ -1,9 +1,13 @@
 #ifndef IRC42_CHANNEL_H
 #define IRC42_CHANNEL_H
 
+#include <ctime>
 #include <list>
 #include <map>
+#include <set>
 #include <string>
+#include "Atom.hpp"
+#include "BanList.hpp"
 
 namespace irc {
 
@@ -11,47 +15,63 @@ class User;
 
 class Channel {
 
-    typedef std::list<std::string> NickList;
-    typedef std::map<std::string, int> BlackListOpMap;
+    typedef std::list<Atom> NickList;
 
 
     public:
-    Channel(std::string name, User& user);
+    explicit Channel(const Atom &name);
     ~Channel();
 
     /* Class functions */
+    void addFounder(User& user);
     void addUser(User& user);
     void deleteUser(User& user);
-    void banUser(std::string &user, int fd);
-    bool unbanUser(std::string &user);
-    bool userInBlackList(std::string nick, std::string ip_address);
+    bool banUser(const std::string &mask, int fd);
+    bool unbanUser(const std::string &mask);
+    bool userInBlackList(User &user);
     bool inviteModeOn();
     bool keyModeOn();
     bool topicModeOn();
     bool banModeOn();
     bool moderatedModeOn();
-    bool isInvited(std::string &nick);
-    void addToWhitelist(std::string &nick);
-    bool userIsInChannel(std::string& nick);
+    bool isInvited(const Atom &nick);
+    void addToWhitelist(const Atom &nick);
+    bool userIsInChannel(const Atom &nick);
     bool isUserOperator(User& user);
     void addMode(int bits);
     void deleteMode(int bits);
     std::string getModeStr();
-    void updateUserNick(std::string &old_nick, std::string &new_nick);
+    void updateUserNick(const Atom &old_nick, const Atom &new_nick);
+    void invalidateNamesCache(void);
 
     /* ATTRIBUTES */
     NickList users;
     NickList white_list;
-    BlackListOpMap black_list;
+    BanList black_list;
+    /* fds with a verdict for this channel in their User::ban_cache,
+     * members or not : erased from them when the channel goes */
+    std::set<int> ban_cached;
 
-    std::string name;
+    Atom name;
     unsigned char mode;
     std::string key;
-    bool all_banned;
     /**
      * Channel topic
      */
     std::string topic;
+    time_t topic_set_at;    // 0 : never set
+    time_t created_at;
+
+    /* NAMES payload, "@op +voiced nick ...", built by
+     * AIrcCommands::getChannelNames. Joins append to it, anything
+     * else that changes a member or its prefix invalidates it */
+    std::string names_cache;
+    bool names_cache_valid;
+
+    /* Traffic sent to the channel (STATS t) : messages, and bytes
+     * written because of them, fan-out included */
+    unsigned long messages;
+    unsigned long bytes_out;
 
 };
 
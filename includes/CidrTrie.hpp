@@ -0,0 +1,71 @@
+#ifndef IRC42_CIDRTRIE_H
+# define IRC42_CIDRTRIE_H
+
+#include <string>
+
+struct sockaddr;
+
+namespace irc {
+
+/*
+ * 128 bit address. IPv4 addresses are stored as IPv4-mapped IPv6
+ * (::ffff:a.b.c.d), so a single trie holds both families and an
+ * IPv4 /24 is just a /120.
+ */
+struct IpAddr {
+    unsigned char bytes[16];
+
+    static bool parse(const std::string &str, IpAddr &addr);
+    static bool parseCidr(const std::string &str, IpAddr &addr, int &len);
+    static bool fromSockaddr(const struct sockaddr *sa, IpAddr &addr);
+    bool isV4(void) const;
+    IpAddr masked(int len) const;
+    bool operator<(const IpAddr &other) const;
+};
+
+/*
+ * Path compressed binary radix trie (PATRICIA) of CIDR prefixes.
+ * Every node holds the full prefix it represents, so chains of single
+ * child nodes never exist : a lookup costs at most one comparison per
+ * branching point, not one per bit.
+ * Prefixes are refcounted, inserting the same range twice needs two
+ * removes.
+ */
+class CidrTrie {
+
+    struct Node {
+        IpAddr key;
+        int len;
+        unsigned long refs;
+        Node *child[2];
+    };
+
+    public:
+    CidrTrie(void);
+    CidrTrie(const CidrTrie &other);
+    ~CidrTrie();
+
+    CidrTrie& operator=(const CidrTrie &other);
+
+    void insert(const IpAddr &addr, int len);
+    bool remove(const IpAddr &addr, int len);
+    bool contains(const IpAddr &addr) const;
+    void clear(void);
+    bool empty(void) const;
+    size_t size(void) const;
+    size_t nodeBytes(void) const;
+
+    private:
+    static Node* newNode(const IpAddr &addr, int len, unsigned long refs);
+    static Node* copyNodes(const Node *node);
+    static void deleteNodes(Node *node);
+    static void collapse(Node **link);
+    static size_t countNodes(const Node *node);
+
+    Node *root;
+    size_t prefixes;
+};
+
+} // namespace
+
+#endif /* IRC42_CIDRTRIE_H */
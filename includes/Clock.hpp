@@ -0,0 +1,70 @@
+#ifndef IRC42_CLOCK_H
+# define IRC42_CLOCK_H
+
+#include <ctime>
+
+namespace irc {
+
+/*
+ * Where the server gets its time from : the system clock, unless another
+ * one is made current (Server::setClock). The clock is process wide,
+ * users, flood control and connection throttling read it too. An
+ * embedder that steps the server with runOnce can time iterations with
+ * its own clock, and a simulation can run a day of pings and timeouts
+ * in seconds with a ManualClock.
+ */
+class Clock {
+
+    public:
+    virtual ~Clock();
+
+    /* Seconds since the epoch, what time(NULL) gives */
+    virtual time_t now(void) = 0;
+    /* Microseconds from an arbitrary point, never goes back. For
+     * durations : loop lag, command handlers. */
+    virtual unsigned long monotonicUs(void) = 0;
+
+    /* Function static, like the Metrics registry */
+    static Clock& system(void);
+    static Clock& current(void);
+    /* Not owned, it has to outlive its use */
+    static void setCurrent(Clock &clock);
+
+    private:
+    static Clock*& currentPtr(void);
+};
+
+class SystemClock : public Clock {
+
+    public:
+    SystemClock(void);
+    ~SystemClock();
+
+    time_t now(void);
+    unsigned long monotonicUs(void);
+
+    private:
+    SystemClock(const SystemClock &other);
+};
+
+/* Only moves when told to */
+class ManualClock : public Clock {
+
+    public:
+    ManualClock(time_t start);
+    ~ManualClock();
+
+    time_t now(void);
+    unsigned long monotonicUs(void);
+    void advance(unsigned long us);
+
+    private:
+    time_t start;
+    unsigned long elapsed_us;
+
+    ManualClock(const ManualClock &other);
+};
+
+} // namespace
+
+#endif /* IRC42_CLOCK_H */
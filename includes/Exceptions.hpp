@@ -31,7 +31,7 @@ class ServerSetUpError : public std::exception {
 class FatalError : public std::exception {
     
     public:
-    FatalError(const std::string msg) : m_msg(msg) {}
+    FatalError(const std::string &msg) : m_msg(msg) {}
     virtual ~FatalError() throw() {}
 
     virtual const char* what() const throw ()  {
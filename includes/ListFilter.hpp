@@ -0,0 +1,68 @@
+#ifndef IRC42_LISTFILTER_H
+# define IRC42_LISTFILTER_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace irc {
+
+class Channel;
+
+/*
+ * LIST conditions (ELIST=CMNTU), comma separated, all of them must hold :
+ *
+ *   >n  <n       more / fewer than n users
+ *   C>n C<n      created more / less than n minutes ago
+ *   T>n T<n      topic set more / less than n minutes ago
+ *   mask !mask   channel name matches / does not match the glob
+ *
+ * Masks are ascii case insensitive, like channel names (see
+ * IrcDataBase::channelAtom). parse() fails on anything else, LIST then
+ * takes the parameter as a channel name.
+ *
+ * Besides matches(), a filter tells which part of the channels can
+ * match at all, so LIST only walks that part : the member count
+ * buckets between firstBucket() and lastBucket() (see
+ * IrcDataBase::size_buckets), and the names starting with prefix().
+ */
+class ListFilter {
+
+    public:
+    ListFilter(void);
+    ~ListFilter();
+
+    bool parse(const std::string &conditions);
+    bool matches(const Channel &channel, time_t now) const;
+
+    bool restricts(void) const;
+    bool sizeBounded(void) const;
+    int firstBucket(void) const;
+    int lastBucket(void) const;
+    const std::string& prefix(void) const;
+    bool inNameRange(const std::string &name) const;
+
+    static int sizeBucket(size_t members);
+
+    private:
+    typedef enum {
+        UNSET = -1
+    } FILTER_CONFIG;
+
+    static bool parseNumber(const std::string &str, long &value);
+    void addMask(const std::string &mask, bool negated);
+
+    long more_than;         // users
+    long fewer_than;
+    long created_before;    // minutes ago, i.e. older than
+    long created_after;
+    long topic_before;
+    long topic_after;
+    std::vector<std::string> masks;
+    std::vector<std::string> negated_masks;
+    std::string name_prefix;
+};
+
+} // namespace
+
+#endif /* IRC42_LISTFILTER_H */
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include "AllocProfile.hpp"
 
 enum typelog {
     DEBUG = 0,
@@ -36,6 +37,8 @@ public:
         return *this;
     }
 private:
+    /* what the line costs is charged to logging (ALLOC_PROFILE) */
+    irc::AllocScope scope;
     bool opened;
 };
 
@@ -0,0 +1,102 @@
+#ifndef IRC42_METRICS_H
+# define IRC42_METRICS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace irc {
+
+/*
+ * Metrics registry, rendered in Prometheus text format on the admin port
+ * (see Server::serveAdmin).
+ *
+ * Metrics are registered once, and the reference kept by whoever updates
+ * them (file statics, CommandInfo), so an update is a plain integer add :
+ * no lookups, no locks (the server has a single thread).
+ * Registering the same name + labels twice returns the same metric.
+ *
+ *   static Metrics::Counter &bytes_in =
+ *       Metrics::global().counter("ircserv_received_bytes_total",
+ *                                 "Bytes read from clients");
+ *   bytes_in.inc(n);
+ */
+class Metrics {
+
+    public:
+    struct Counter {
+        unsigned long value;
+        Counter(void) : value(0) {}
+        void inc(unsigned long n = 1) { value += n; }
+    };
+
+    struct Gauge {
+        long value;
+        Gauge(void) : value(0) {}
+        void set(long v) { value = v; }
+        void inc(long n = 1) { value += n; }
+        void dec(long n = 1) { value -= n; }
+    };
+
+    /* Log buckets, HDR style : every power of two range above
+     * first_bound, (first << (o - 1), first << o], is cut in sub_buckets
+     * equal parts. Precision stays a fixed fraction of the value, from
+     * microseconds to seconds, with a few dozen buckets. Plus +Inf. */
+    class Histogram {
+        public:
+        Histogram(void);
+        Histogram(unsigned long first_bound, int nb_octaves,
+                  int sub_buckets = 1);
+
+        void observe(unsigned long value);
+        unsigned long quantile(double q) const;
+
+        std::vector<unsigned long> bounds;
+        std::vector<unsigned long> counts; // bounds.size() + 1 (+Inf)
+        unsigned long sum;
+        unsigned long count;
+        unsigned long max;
+    };
+
+    static Metrics& global(void);
+
+    Counter& counter(const std::string &name, const std::string &help,
+                     const std::string &labels = "");
+    Gauge& gauge(const std::string &name, const std::string &help,
+                 const std::string &labels = "");
+    Histogram& histogram(const std::string &name, const std::string &help,
+                         unsigned long first_bound, int nb_octaves,
+                         int sub_buckets = 1,
+                         const std::string &labels = "");
+
+    std::string render(void) const;
+
+    static std::string label(const std::string &key, const std::string &value);
+
+    private:
+    typedef enum {
+        COUNTER = 0,
+        GAUGE,
+        HISTOGRAM
+    } METRIC_TYPE;
+
+    /* One metric name, and all its label sets. std::map never moves its
+     * values, so the references handed out stay valid. */
+    struct Family {
+        METRIC_TYPE type;
+        std::string help;
+        std::map<std::string, Counter> counters;
+        std::map<std::string, Gauge> gauges;
+        std::map<std::string, Histogram> histograms;
+    };
+    typedef std::map<std::string, Family> FamilyMap;
+
+    Family& family(const std::string &name, const std::string &help,
+                   METRIC_TYPE type);
+
+    FamilyMap families;
+};
+
+} // namespace
+
+#endif /* IRC42_METRICS_H */
@@ -13,6 +13,49 @@
 # define RPL_WELCOME " 001 "
 # define RPL_WELCOME_STR_1 " :Welcome to the Internet Relay Network, "
 
+/**
+ * The rest of the registration burst (see WelcomeBurst)
+ * 002 :Your host is <servername>, running version <version>
+ * 003 :This server was created <date>
+ * 004 <servername> <version> <user modes> <channel modes>
+ * 005 <token>[=<value>] ... :are supported by this server
+ */
+# define RPL_YOURHOST " 002 "
+# define STR_YOURHOST " :Your host is "
+# define RPL_CREATED " 003 "
+# define STR_CREATED " :This server was created "
+# define RPL_MYINFO " 004 "
+# define RPL_ISUPPORT " 005 "
+# define STR_ISUPPORT " :are supported by this server"
+
+/**
+ *  STATS l : one per connection
+ *  <linkname> <sendq> <sent messages> <sent Kbytes> <received messages>
+ *  <received Kbytes> <time open>
+ */
+# define RPL_STATSLINKINFO " 211 "
+
+/**
+ *  STATS m : one per command, <command> <count> <byte count> <remote count>
+ */
+# define RPL_STATSCOMMANDS " 212 "
+
+/**
+ *  Sent as the last reply to the STATS command
+ */
+# define RPL_ENDOFSTATS " 219 "
+# define STR_ENDOFSTATS " :End of STATS report"
+
+/**
+ *  STATS u
+ */
+# define RPL_STATSUPTIME " 242 "
+
+/**
+ *  Free form STATS lines (loop lag, memory, top channels)
+ */
+# define RPL_STATSDEBUG " 249 "
+
 /**
  *  Sent as the first reply of WHOIS command
  */
@@ -97,6 +140,16 @@
 # define RPL_ENDOFBANLIST " 368 "
 # define STR_ENDOFBANLIST " :End of channel ban list"
 
+/**
+ * Message of the day : 375, one 372 per line of MOTD_FILE, 376
+ */
+# define RPL_MOTD " 372 "
+# define STR_MOTD " :- "
+# define RPL_MOTDSTART " 375 "
+# define STR_MOTDSTART " Message of the day - "
+# define RPL_ENDOFMOTD " 376 "
+# define STR_ENDOFMOTD " :End of /MOTD command."
+
 /**
  * Indicates that no client can be found for the supplied nickname
  */
@@ -116,12 +169,24 @@
 # define ERR_CANNOTSENDTOCHAN " 404 "
 # define STR_CANNOTSENDTOCHAN " :You cannot send messages to this channel whilst "
 
+/**
+ * Sent when a filtered LIST reaches LIST_MAX_RESULTS, before the end
+ */
+# define ERR_TOOMANYMATCHES " 416 "
+# define STR_TOOMANYMATCHES " :Too many matches, restrict your query"
+
 # define ERR_INPUTTOOLONG " 417 "
 # define STR_INPUTTOOLONG " :Input line was too long"
 
 # define ERR_UNKNOWNCOMMAND " 421 "
 # define STR_UNKNOWNCOMMAND " :Unknown command"
 
+/**
+ * Instead of the MOTD when there is no MOTD_FILE
+ */
+# define ERR_NOMOTD " 422 "
+# define STR_NOMOTD " :MOTD File is missing"
+
 /**
  * The desired nickname contains characters that are disallowed by the server
  */
@@ -180,6 +245,18 @@
 # define ERR_PASSWDMISMATCH " 464 "
 # define STR_PASSWDMISMATCH " :Password incorrect"
 
+/**
+ * Sent back to a successful OPER
+ */
+# define RPL_YOUREOPER " 381 "
+# define STR_YOUREOPER " :You are now an IRC operator"
+
+/**
+ * Operator only command, and the user is not one
+ */
+# define ERR_NOPRIVILEGES " 481 "
+# define STR_NOPRIVILEGES " :Permission Denied- You're not an IRC operator"
+
 /**
  * Returned to indicate that a MODE argument is unrecognized
  */
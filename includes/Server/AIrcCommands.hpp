@@ -4,6 +4,10 @@
 #include "FdManager.hpp"
 #include "IrcDataBase.hpp"
 
+#include <deque>
+
+#include "ListFilter.hpp"
+
 // A stands for Abstract
 
 /* 
@@ -26,6 +30,9 @@ class AIrcCommands : public FdManager,
     AIrcCommands(std::string &password);
     AIrcCommands(std::string &ip, std::string &port);
     AIrcCommands(std::string &ip, std::string &port, std::string &password);
+    AIrcCommands(Transport &transport, std::string &ip, std::string &port);
+    AIrcCommands(Transport &transport, std::string &ip, std::string &port,
+                 std::string &password);
     AIrcCommands(const AIrcCommands &other);
     ~AIrcCommands();
     
@@ -36,8 +43,19 @@ class AIrcCommands : public FdManager,
     virtual void registerUser(User &user) = 0;
 
     virtual void DataFromUser(int fd) = 0;
-    virtual void DataToUser(int fd, std::string data, int type) = 0;
+    virtual void DataToUser(int fd, const std::string &data, int type) = 0;
+    /* Lines written in place : where fd's output goes, and the lines
+     * from start to its end have been appended (see startNumeric) */
+    virtual std::string& outputOf(int fd) = 0;
+    virtual void lineQueued(int fd, size_t start, int lines) = 0;
+    virtual void flushSendQueue(int fd) = 0;
     virtual void loadCommandMap(void) = 0;
+    virtual void sendStatsReport(User &user, char query, int fd) = 0;
+
+    /* IRC operators, <name, password>, from OPER_FILE */
+    typedef std::map<std::string, std::string> OperMap;
+    OperMap opers;
+    int loadOpers(const std::string &path);
 
     /* Command implementations */
     void NICK(Command &cmd, int fd);
@@ -56,35 +74,54 @@ class AIrcCommands : public FdManager,
     void LIST(Command &cmd, int fd);
     void PRIVMSG(Command &cmd, int fd);
     void WHOIS(Command &cmd, int fd);
+    void OPER(Command &cmd, int fd);
+    void STATS(Command &cmd, int fd);
 
     /* Common replies  ? todas privadas ?*/
-    void sendWelcome(std::string& name, std::string &prefix, int fd);
     void sendNeedMoreParams(std::string &nick, std::string& cmd_name, int fd);
-    void sendParamNeeded(std::string &nick, std::string &ch_name,
-                         std::string mode, std::string mode_msg, int fd);
+    void sendParamNeeded(std::string &nick, const std::string &ch_name,
+                         const char *mode, const char *mode_msg, int fd);
     void sendNotRegistered(std::string &nick, std::string &cmd_name, int fd);
-    void sendNoSuchChannel(std::string &nick, std::string &ch_name, int fd);
-    void sendNotOnChannel(std::string &nick, std::string &ch_name, int fd);
-    void sendBadChannelMask(std::string &nick, std::string &ch_name, int fd);
+    void sendNoSuchChannel(std::string &nick, const std::string &ch_name, int fd);
+    void sendNotOnChannel(std::string &nick, const std::string &ch_name, int fd);
+    void sendBadChannelMask(std::string &nick, const std::string &ch_name, int fd);
     void sendNoChannelModes(std::string &cmd_name, int fd);
     void sendChannelOperatorNeeded(std::string &nick,
-                                   std::string &ch_name, int fd);
+                                   const std::string &ch_name, int fd);
     void sendAlreadyRegistered(std::string &nick, int fd);
     void sendPasswordMismatch(std::string &nick, int fd);
     void sendJoinReply(int fd, User &user, Channel &channel, bool send_all);
     void sendNamesReply(int fd, User &user, Channel &channel);
-    void sendListReply(int fd, User &user, std::string ch_name);
-    void sendPartMessage(std::string &extra_msg, int fd,
+    void sendListReply(int fd, User &user, const std::string &ch_name,
+                       const ListFilter &filter);
+    /* Users with a LIST in progress, resumed by the server's loop */
+    std::deque<int> list_queue;
+    bool continueList(int fd, User &user);
+    Channel* nextListChannel(const Atom &from, bool after,
+                             const ListFilter &filter);
+    void sendSplitReply(int fd, const char *numeric,
+                        const std::string &head, const std::string &items);
+    void sendPartMessage(const std::string &extra_msg, int fd,
                          User &user, Channel &channel);
-    void sendNoSuchNick(int fd, std::string nick, std::string notFoundNick);
-    void sendChannelModes(int fd, std::string nick, Channel &channel);
+    void sendNoSuchNick(int fd, const std::string &nick,
+                        const std::string &notFoundNick);
+    void sendChannelModes(int fd, const std::string &nick, Channel &channel);
     void sendKickMessage(int fd, User &user, Channel &channel,
                          std::string &kicked);
     void sendMessageToChannel(Channel &channel, std::string &message,
-                              std::string &nick);
-    std::string constructNamesReply(std::string nick, Channel &channel);
-    std::string constructListReply(std::string nick, Channel &channel);
-    std::string constructWhoisChannelRpl(User &user, std::string &real_nick);
+                              const Atom &nick);
+    /* Line being built by a command, reused (see startMessage) */
+    std::string out;
+    std::string& startMessage(const User &user, const char *command);
+    /* Numeric being written at the end of a user's output */
+    int numeric_fd;
+    size_t numeric_start;
+    std::string& startNumeric(int fd, const char *numeric,
+                              const std::string &target);
+    void endNumeric(void);
+    const std::string& getChannelNames(Channel &channel);
+    void sendListLine(int fd, const std::string &nick, Channel &channel);
+    std::string constructWhoisChannels(User &user);
     void createNewChannel(const Command &cmd, int size, User &user, int fd);
     void sendWhoisReply(const Command &cmd, int fd, User &user,
                         std::string &nick);
@@ -93,7 +130,7 @@ class AIrcCommands : public FdManager,
     void checkModeToAddOrDelete(const Command &cmd, Channel &channel,
                                 User &user, char m, int mode);
     void checkKeyMode(const Command &cmd, Channel &channel, User &user);
-    void checkOpMode(const irc::Command &cmd, std::string nick,
+    void checkOpMode(const irc::Command &cmd, const std::string &nick,
                      User &user, Channel &channel, int fd);
     std::string checkAndGetVoiceRpl(const Command &cmd, const User &user,
                                     Channel &channel, const std::string &mode,
@@ -7,7 +7,12 @@
 #include <poll.h>
 
 #include <string>
+#include <map>
+#include <vector>
+#include <ctime>
 #include "Types.hpp"
+#include "CidrTrie.hpp"
+#include "Server/Transport.hpp"
 
 namespace irc {
 
@@ -16,6 +21,8 @@ namespace irc {
  * Se encarga de inicializar el que está en esucha, de trabajar con
  * la estructura de poll, y de aceptar y derivar conexiones de forma
  * agnóstica: ni lee ni escribe de los sockets.
+ * Every socket call goes through transport : the kernel's unless one
+ * is given (see Transport.hpp). It is not owned.
  */
 
 class FdManager {
@@ -23,24 +30,59 @@ class FdManager {
     public:
     FdManager(void);
     FdManager(std::string &ip, std::string &port);
+    FdManager(Transport &transport, std::string &ip, std::string &port);
     FdManager(const FdManager &other);
     ~FdManager();
 
     /* Setup */
-    int setUpAddress(void);
-    int setUpAddress(std::string &hostname, std::string &port);
-    int setUpListener(void);
+    int setUpListener(const std::string &host, const std::string &port);
+    int setUpAdminListener(void);
     void setUpPoll(void);
+    void setMaxFds(int max);
 
     /* main utils */
-    void Poll(void);
+    void Poll(int timeout_ms);
 
     int acceptConnection(void);
     const char* acceptConnection(int *fd) ;
-    void closeConnection(int fd_idx);
+    int acceptAdminConnection(void);
+    int addPollFd(int fd, short events);
+    void setPollEvents(int fd, short events);
+    virtual void closeConnection(int fd);
+    void rejectConnection(int fd, const char *error_line, size_t len);
+
+    /* Flood control : stop / restart polling a socket for input */
+    void pauseReading(int fd);
+    void resumeReading(int fd);
+    /* Send queues : poll for POLLOUT only while something is pending */
+    void watchWrite(int fd, bool on);
+
+    /* Server wide bans (Z-lines), checked right after accept(),
+     * before any User exists */
+    int loadZLines(const std::string &path);
+    bool isZLined(const std::string &ip_address) const;
+
+    /* Per source accounting. A source is an IPv4 address or an
+     * IPv6 /64 (what a single host usually gets). */
+    typedef struct SourceInfo {
+        int connections;
+        int tokens;         // connect token bucket
+        time_t last_refill;
+    } SourceInfo;
+    typedef std::map<IpAddr, SourceInfo> SourceMap;
+    typedef std::map<int, IpAddr> FdSourceMap;
+
+    /* Limits from the environment (IRCSERV_MAX_CONNS_PER_SOURCE,
+     * IRCSERV_CONNECT_BURST, IRCSERV_CONNECT_REFILL_S), defaults if
+     * unset. Read once, at start up (see Server::init). */
+    void loadSourceLimits(void);
+    const char* admitSource(const IpAddr &source, time_t now);
+    void releaseSource(int fd);
+    void pruneSources(time_t now);
 
     /* accessors */
     bool hasDataToRead(int entry);
+    bool hasRoomToWrite(int entry);
     bool skipFd(int fd_idx);
     int getFdFromIndex(int fd_idx);
 
@@ -55,7 +97,7 @@ class FdManager {
      * most recently accepted connection. */
     typedef struct ConnInfo {
         int new_fd;
-        char ip_address[20];
+        char ip_address[INET6_ADDRSTRLEN]; // NUL terminated
     } ConnInfo;
 
     // whoever allocates, deallocates.
@@ -66,11 +108,21 @@ class FdManager {
 
     ConnInfo last_connection;
 
-    struct pollfd fds[255]; // MAX_FDS
+    CidrTrie zlines;
+    SourceMap sources;
+    FdSourceMap fd_source;
+
+    Transport *transport;
+    std::vector<struct pollfd> fds; // grows up to max_fds
     int fds_size;
-    struct addrinfo *servinfo;
+    int max_fds;
+    int max_conns_per_source;
+    int connect_burst;
+    int connect_refill_s;
     int listener;
+    int admin_listener;     // -1 if the admin port could not be bound
     std::string hostname;
+    std::string server_prefix;  // ":" + hostname, starts every numeric
 };
 
 }
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <map>
+#include <set>
+#include <vector>
+#include "Atom.hpp"
 
 namespace irc {
 
@@ -23,31 +26,44 @@ class User;
 
 class IrcDataBase {
 
-    typedef std::map<std::string, irc::Channel> ChannelMap;
+    public:
+    typedef std::map<Atom, irc::Channel> ChannelMap;
     typedef std::map<int, irc::User> FdUserMap;
-    typedef std::map<std::string, int> NickFdMap;
+    typedef std::map<Atom, int> NickFdMap;
+    typedef std::map<std::string, Atom> FoldedNameMap;
+    typedef std::vector<std::set<Atom> > SizeBuckets;
 
-    public:
     IrcDataBase(void);
     IrcDataBase(const IrcDataBase& other);
     ~IrcDataBase();
 
     /* Data Bases */
-    ChannelMap channel_map; // <string name, Channel> 
-    NickFdMap nick_fd_map;  // <string nick, int fd>
+    ChannelMap channel_map; // <Atom name, Channel> 
+    NickFdMap nick_fd_map;  // <Atom nick, int fd>
     FdUserMap fd_user_map;  // <int fd, User>
+    /* Channel names by member count, for LIST filters : bucket b holds
+     * the channels of 2^b to 2^(b+1) - 1 members (bucket 0 : 0 and 1) */
+    SizeBuckets size_buckets;
+    /* Channel names upper cased -> name as created : channels are kept
+     * under the name they were created with, but found whatever the
+     * case (CASEMAPPING=ascii, like nicks) */
+    FoldedNameMap channel_folds;
 
     /* checkers */
     bool fdExists(int fd);
-    bool nickExists(std::string& nick);
+    bool nickExists(const std::string& nick);
+    bool nickExists(const Atom& nick);
     bool nickFormatOk(std::string &nickname);
-    bool channelExists(std::string &channel_name);
+    bool channelExists(const std::string &channel_name);
     
     /* accessors */
     User& getUserFromFd(int fd);
-    User& getUserFromNick(std::string& nick);
-    int getFdFromNick(std::string& nick);
-    Channel& getChannelFromName(std::string& name);
+    User& getUserFromNick(const std::string& nick);
+    User& getUserFromNick(const Atom& nick);
+    int getFdFromNick(const Atom& nick);
+    Channel& getChannelFromName(const std::string& name);
+    Channel& getChannelFromName(const Atom& name);
+    Atom channelAtom(const std::string &channel_name);
 
     /* interactors */
     void addNewUser(int new_fd, const char *ip_address);
@@ -56,17 +72,21 @@ class IrcDataBase {
     void updateUserNick(int fd, std::string &new_nick,
                                 std::string &new_real_nick);
 
-    void addNickFdPair(std::string &nick, int fd);
-    void removeNickFdPair(std::string &nick);
+    void addNickFdPair(const Atom &nick, int fd);
+    void removeNickFdPair(const Atom &nick);
 
-    void addFdUserPair(int fd, User& user);
     void removeFdUserPair(int fd);
 
-    void addNewChannel(Channel& new_channel);
+    Channel& addNewChannel(const Atom &name, User &creator);
     void maybeRemoveChannel(Channel& channel);
+    void addChannelMember(Channel &channel, User &user);
+    void deleteChannelMember(Channel &channel, User &user);
+    void indexChannel(const Atom &name, size_t members);
+    void unindexChannel(const Atom &name, size_t members);
+    void moveChannel(const Atom &name, size_t before, size_t after);
     void removeUserFromChannels(int fd);
 
-    void updateUserInChannels(User &user, std::string new_nick);
+    void updateUserInChannels(User &user, const Atom &new_nick);
 
     void debugNickFdMap();
     void debugFdUserMap();
@@ -0,0 +1,91 @@
+#ifndef IRC42_MEMORYTRANSPORT_H
+# define IRC42_MEMORYTRANSPORT_H
+
+#include "Server/Transport.hpp"
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+namespace irc {
+
+/*
+ * Transport without the kernel : connections are pairs of byte queues in
+ * this process. Both ends are plain fds of this transport, the server
+ * gets one from accept, whoever drives the clients gets the other from
+ * connect, and both use the same send / recv / close.
+ *
+ *   MemoryTransport net;
+ *   ... an AIrcCommands built with (net, "127.0.0.1", "6667") ...
+ *   int c = net.connect("127.0.0.1", "6667", "10.0.0.1");
+ *   net.send(c, "NICK a\r\n", 8);
+ *   ... let the server run ...
+ *   net.recv(c, buff, sizeof(buff));
+ *
+ * Nothing happens behind the caller's back, so runs are deterministic :
+ * poll never waits (only this thread could make something ready), fds
+ * are the lowest free number, like the kernel does. Each direction
+ * holds up to capacity bytes, past that send is -1 / EAGAIN, which is
+ * what makes a client that does not read a slow reader.
+ */
+class MemoryTransport : public Transport {
+
+    public:
+    enum { DEFAULT_CAPACITY = 212992 }; // Linux default socket buffer
+
+    MemoryTransport(size_t capacity = DEFAULT_CAPACITY);
+    ~MemoryTransport();
+
+    int listen(const std::string &host, const std::string &port,
+               std::string &bound);
+    int accept(int listener, struct sockaddr_storage *addr);
+    ssize_t recv(int fd, char *buff, size_t len);
+    ssize_t send(int fd, const char *buff, size_t len);
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
+    int close(int fd);
+    int socketError(int fd);
+    size_t pending(int fd) const;
+
+    /* Client side : a connection to host:port, coming from the IPv4 or
+     * IPv6 address source. Pending until the server accepts it, but
+     * usable right away. -1 / ECONNREFUSED if nobody listens there. */
+    int connect(const std::string &host, const std::string &port,
+                const std::string &source);
+
+    size_t openFds(void) const;
+
+    private:
+    typedef enum {
+        LISTENER = 0,
+        STREAM
+    } ENDPOINT_TYPE;
+
+    typedef struct Endpoint {
+        ENDPOINT_TYPE type;
+        int peer;                   // -1 once the other end closed
+        std::string in;             // what the peer sent, not read yet
+        std::string address;        // peer's address, for accept
+        std::string listen_key;     // listeners : "host:port"
+        std::deque<int> backlog;    // listeners : connected, not accepted
+    } Endpoint;
+    typedef std::map<int, Endpoint> EndpointMap;
+
+    int newFd(ENDPOINT_TYPE type);
+    Endpoint* find(int fd);
+    const Endpoint* find(int fd) const;
+    static bool fillAddress(const std::string &address,
+                            struct sockaddr_storage *addr);
+
+    size_t capacity;
+    EndpointMap endpoints;
+    std::map<std::string, int> listeners;   // "host:port" -> fd
+    std::set<int> free_fds;                 // below next_fd
+    int next_fd;
+
+    MemoryTransport(const MemoryTransport &other);
+};
+
+} // namespace
+
+#endif /* IRC42_MEMORYTRANSPORT_H */
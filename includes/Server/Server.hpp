@@ -3,21 +3,81 @@
 
 #include "Types.hpp"
 #include "Server/AIrcCommands.hpp"
+#include "Metrics.hpp"
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include "WelcomeBurst.hpp"
+
+#include <deque>
+#include <vector>
 
 namespace irc {
 
 class Server : public AIrcCommands {
 
     typedef void (irc::AIrcCommands::*CommandFnx)(Command &cmd, int fd);
-    typedef std::map<std::string, CommandFnx> CommandMap;
+    /* penalty : flood control tokens the command costs
+     * calls, bytes, duration : this command's ircserv_commands_total,
+     * ircserv_command_received_bytes_total and
+     * ircserv_command_duration_microseconds
+     * allocs : ircserv_command_allocations_total, NULL unless the
+     * server is built with ALLOC_PROFILE (see AllocProfile) */
+    typedef struct CommandInfo {
+        CommandFnx fnx;
+        int penalty;
+        Metrics::Counter *calls;
+        Metrics::Counter *bytes;
+        Metrics::Histogram *duration;
+        Metrics::Counter *allocs;
+    } CommandInfo;
+    typedef std::map<std::string, CommandInfo> CommandMap;
+
+    /* Admin port connection : request read so far, response left */
+    typedef struct AdminConn {
+        std::string request;
+        std::string response;
+    } AdminConn;
+    typedef std::map<int, AdminConn> AdminConnMap;
+
+    /* Where a mainLoop iteration spends its time */
+    typedef enum {
+        PHASE_ACCEPT = 0,
+        PHASE_READ,         // recv + parse, admin port
+        PHASE_DISPATCH,     // runQueue + floodLoop + listLoop
+        PHASE_PING,
+        PHASE_FLUSH,
+        PHASE_COUNT
+    } LOOP_PHASE;
+
+    /* what processPendingLines left behind */
+    typedef enum {
+        WORK_DRAINED = 0,   // nothing queued anymore
+        WORK_YIELDED,       // used its turn, more lines queued
+        WORK_THROTTLED,     // over flood budget
+        WORK_GONE           // user was removed
+    } WORK_STATUS;
 
     public:
     Server(void);
     Server(std::string &password);
     Server(std::string &ip, std::string &port);
     Server(std::string &ip, std::string &port, std::string &password);
+    Server(Transport &transport, std::string &ip, std::string &port);
+    Server(Transport &transport, std::string &ip, std::string &port,
+           std::string &password);
     Server(const Server &other);
     ~Server();
+
+    /* Driving the server (see run) */
+    void start(void);
+    void runOnce(int timeout_ms);
+    void run(void);
+    void stop(void);
+    bool isRunning(void) const;
+    void setClock(Clock &clock);
+    void rehash(void);
+    /* 001 to 005 and the MOTD, built on rehash (see registerUser) */
+    WelcomeBurst welcome;
     
     private:
 
@@ -28,26 +88,85 @@ class Server : public AIrcCommands {
     void registerUser(User &user);
 
     void DataFromUser(int fd);
-    void DataToUser(int fd, std::string data, int type);
-    
-    int mainLoop(void);
+    void DataToUser(int fd, const std::string &data, int type);
+    std::string& outputOf(int fd);
+    void lineQueued(int fd, size_t start, int lines);
+
+    /* Output : DataToUser only queues, the flush phase writes */
+    std::vector<int> flush_queue;
+    std::map<int, std::string> doomed; // <fd, reason>, removed when flushing
+    void queueFlush(int fd, bool writable = false);
+    bool writeSendQueue(User &user);
+    void flushSendQueue(int fd);
+    void flushSendQueues(void);
+    void killUser(int fd, const std::string &reason);
+
+    /* IRCSERV_CAPTURE=<file> : inbound traffic, for bench/replay.
+     * Every close goes through closeConnection, which records it */
+    Capture capture;
+    void closeConnection(int fd);
+
+    bool started;
+    bool stopping;
+    unsigned long loop_stall_us;
+    void checkLoopLag(unsigned long start, const unsigned long *phases);
 
     void pingLoop(void);
     void sendPingToUser(int fd);
 
     CommandMap cmd_map;
     void loadCommandMap();
+    void loadCommand(const char *name, CommandFnx fnx, int penalty);
 
     /* Buffer management */
     char srv_buff[BUFF_MAX_SIZE];
     int srv_buff_size;
     std::string processLeftovers(int fd);
     void parseCommandBuffer(std::string &cmd_content, int fd);
+    WORK_STATUS processPendingLines(int fd, int max_lines);
+    void runCommand(CommandInfo &info, Command &command, int fd);
+    unsigned long slow_command_us;
+    void floodLoop(void);
+
+    /* Scheduling : users with lines ready to run, served in turns of
+     * LINES_PER_TURN lines */
+    std::deque<int> run_queue;
+    int poll_start;
+    void scheduleUser(int fd);
+    void runQueue(void);
+    /* LIST replies in progress (see AIrcCommands::continueList) */
+    void listLoop(void);
+    bool listCanProgress(void);
+
+    /* Admin port, plain HTTP/1.0 : GET /metrics (AdminPort.cpp) */
+    AdminConnMap admin_conns;
+    void acceptAdmin(void);
+    void serveAdmin(int fd_idx);
+    void closeAdmin(int fd);
+    std::string adminResponse(const std::string &request);
+    void updateGauges(void);
+
+    /* STATS replies, from the same counters as the metrics (Stats.cpp) */
+    time_t started_at;
+    void sendStatsReport(User &user, char query, int fd);
+    void sendStatsLine(User &user, const char *numeric,
+                       const std::string &text, int fd);
+    void statsCommands(User &user, int fd);
+    void statsUptime(User &user, int fd);
+    /* ircserv_loop_lag_microseconds and ircserv_loop_stalls_total,
+     * registered once in Server.cpp */
+    static Metrics::Histogram& loopLag(void);
+    static Metrics::Counter& loopStalls(void);
+    void statsLinks(User &user, int fd);
+    void statsMemory(User &user, int fd);
+    void statsTopChannels(User &user, int fd);
+    void statsAllocations(User &user, int fd);
 };
 
 /**
  * Reglas propias servidor :
- * - El número mázimo de usuarios conectados a la vez será de 255 (MAX_FDS).
+ * - El número mázimo de usuarios conectados a la vez será de 255 (MAX_FDS),
+ *  salvo que se cambie con setMaxFds.
  * - Los usuarios se guardan, con comandos no finalizados en CRLF, un buffer
  *  interno, de donde reconstruir un comando que se haya enviado troceado.
  *  La suma de los bytes en este buffer y los del comando al que se añaden
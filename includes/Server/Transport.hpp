@@ -0,0 +1,74 @@
+#ifndef IRC42_TRANSPORT_H
+# define IRC42_TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#include <string>
+
+namespace irc {
+
+/*
+ * Every socket call of the server goes through a Transport : FdManager
+ * polls, accepts and closes with it, Server and the admin port read and
+ * write with it. The calls mirror the system calls they replace, same
+ * return values and errno, so the code using them reads the same :
+ *
+ *   - sockets are non blocking : no data is -1 / EAGAIN, not a wait
+ *   - send never raises SIGPIPE, a closed peer is -1 / EPIPE
+ *   - recv returns 0 once the peer closed and everything was read
+ *
+ * KernelTransport is the real thing (Transport::kernel(), what the
+ * server uses unless told otherwise). MemoryTransport keeps everything
+ * in process, for benchmarks and simulations without the TCP stack.
+ */
+class Transport {
+
+    public:
+    virtual ~Transport();
+
+    /* Listening endpoint on host:port. bound gets the address it got,
+     * which the server uses as its name. -1 on error. */
+    virtual int listen(const std::string &host, const std::string &port,
+                       std::string &bound) = 0;
+    /* Next pending connection, already non blocking, and its source
+     * address. -1 / EAGAIN if there is none. */
+    virtual int accept(int listener, struct sockaddr_storage *addr) = 0;
+    virtual ssize_t recv(int fd, char *buff, size_t len) = 0;
+    virtual ssize_t send(int fd, const char *buff, size_t len) = 0;
+    virtual int poll(struct pollfd *fds, nfds_t nfds, int timeout_ms) = 0;
+    virtual int close(int fd) = 0;
+    /* Why the last call on fd failed : the socket's pending error
+     * (SO_ERROR) if it has one, errno otherwise */
+    virtual int socketError(int fd) = 0;
+    /* Bytes received on fd and not read yet (FIONREAD), 0 if unknown */
+    virtual size_t pending(int fd) const = 0;
+
+    /* Function static, like the Metrics registry */
+    static Transport& kernel(void);
+};
+
+class KernelTransport : public Transport {
+
+    public:
+    KernelTransport(void);
+    ~KernelTransport();
+
+    int listen(const std::string &host, const std::string &port,
+               std::string &bound);
+    int accept(int listener, struct sockaddr_storage *addr);
+    ssize_t recv(int fd, char *buff, size_t len);
+    ssize_t send(int fd, const char *buff, size_t len);
+    int poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
+    int close(int fd);
+    int socketError(int fd);
+    size_t pending(int fd) const;
+
+    private:
+    KernelTransport(const KernelTransport &other);
+};
+
+} // namespace
+
+#endif /* IRC42_TRANSPORT_H */
@@ -8,15 +8,16 @@ namespace irc {
 namespace tools {
 
 std::vector<std::string>& split(std::vector<std::string> &to_fill,
-                                std::string &str, std::string del);
+                                std::string &str, const std::string &del);
 
-bool starts_with_mask(std::string const);
+bool starts_with_mask(const std::string &str);
 void ToUpperCase(std::string &str);
 bool isEqual(const std::string &str1, const std::string &str2);
 bool endsWith(std::string const &str, std::string const &suffix);
 bool hasUnknownChannelFlag(const std::string &mode);
 bool charIsInString(const std::string &str, const char c);
 bool anyRepeatedChar(std::string &s);
+bool globMatch(const std::string &mask, const std::string &str);
 
 std::string& trimRepeatedChar(std::string& str, char c);
 void ReplaceAll(std::string& str, const std::string& from,
@@ -24,9 +25,14 @@ void ReplaceAll(std::string& str, const std::string& from,
 size_t findLastCRLF(std::string& haystack);
 
 void cleanBuffer(char *buff, size_t size);
-void printError(std::string error_str);
+void printError(const std::string &error_str);
 
+void rngSeed(unsigned int seed);
+unsigned int rngNext(void);
 std::string rngString(int len);
+unsigned long monotonicUs(void);
+size_t heapBytes(const std::string &str);
+void appendNumber(std::string &str, unsigned long n);
 
 } // tools
 } // irc
@@ -11,6 +11,12 @@
 #define CR "\r"
 #define LF "\n"
 #define PING_TIMEOUT_S_STR "120"
+#define ZLINE_FILE "ircserv.zlines" // reloaded on SIGHUP
+#define OPER_FILE "ircserv.opers"   // <name> <password>, reloaded on SIGHUP
+#define MOTD_FILE "ircserv.motd"    // reloaded on SIGHUP
+#define SERVER_VERSION "ircserv-42"
+#define ADMIN_HOST "127.0.0.1"       // metrics endpoint, loopback only
+#define ADMIN_PORT "9667"
 
 /*
  * On why enums are chosen over macros for integers :
@@ -23,9 +29,67 @@ typedef enum {
     NAME_MAX_SIZE = 12, // no me deja sino poner christian97 >:(
     POLL_TIMEOUT_MS = 1000,
     BUFF_MAX_SIZE = 512,
-    PING_TIMEOUT_S = 120
+    PING_TIMEOUT_S = 120,
+    LINES_PER_TURN = 4, // commands run per user before the next one's turn
+    SLOW_COMMAND_US = 20000, // default, env IRCSERV_SLOW_COMMAND_US
+    LOOP_STALL_US = 50000,  // default, env IRCSERV_LOOP_STALL_US
+    SENDQ_MAX = 65536,      // bytes queued for a user before SendQ exceeded
+    LIST_LINES_PER_TURN = 64,   // LIST lines queued per user and iteration
+    LIST_SENDQ_LOW = 8192,  // LIST waits while more than this is queued
+    LIST_SCAN_PER_TURN = 1024,  // channels a filtered LIST checks per turn
+    LIST_MAX_RESULTS = 1000 // lines a filtered LIST sends, at most
 } SERVER_CONFIG;
 
+/*
+ * Flood control. Every command has a penalty (COMMAND_PENALTY below)
+ * paid from a per user token bucket. Lines over budget wait in the
+ * user's pending queue and the socket is not read until it refills.
+ */
+typedef enum {
+    FLOOD_BURST = 32,           // bucket size
+    FLOOD_REFILL_PER_S = 2,     // tokens regained every second
+    FLOOD_DEFAULT_PENALTY = 2,  // unknown commands
+    FLOOD_MAX_RECVQ = 8192      // unread bytes while paused -> Excess Flood
+} FLOOD_CONFIG;
+
+/* Penalty of each command, what Server::loadCommandMap registers and
+ * bench/loadgen pays in its copy of the bucket */
+typedef enum {
+    PENALTY_PONG = 0,
+    PENALTY_QUIT = 0,
+    PENALTY_PING = 1,
+    PENALTY_USER = 2,
+    PENALTY_PASS = 2,
+    PENALTY_PART = 2,
+    PENALTY_KICK = 2,
+    PENALTY_TOPIC = 2,
+    PENALTY_MODE = 2,
+    PENALTY_PRIVMSG = 2,
+    PENALTY_WHOIS = 2,
+    PENALTY_NICK = 4,
+    PENALTY_JOIN = 4,
+    PENALTY_INVITE = 4,
+    PENALTY_NAMES = 4,
+    PENALTY_OPER = 4,
+    PENALTY_LIST = 6,
+    PENALTY_STATS = 6
+} COMMAND_PENALTY;
+
+/* Partial lines kept between reads (see User::addLeftovers) */
+typedef enum {
+    LEFTOVER_INLINE = 32,           // bytes held in the User itself
+    BUFFER_POOL_MAX_FREE = 1024     // blocks kept for reuse, not freed
+} RECV_BUFFER_CONFIG;
+
+/*
+ * Per element overhead of the standard containers (libstdc++, 64 bit),
+ * used to estimate memory usage in STATS z.
+ */
+typedef enum {
+    MAP_NODE_BYTES = 32,    // std::map / std::set, before the value
+    LIST_NODE_BYTES = 16    // std::list, before the value
+} CONTAINER_OVERHEAD;
+
 typedef enum {
     NO_NUMERIC_REPLY = 0,
     NUMERIC_REPLY
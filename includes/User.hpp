@@ -2,7 +2,10 @@
 # define IRC42_USER_H
 
 #include "Types.hpp"
+#include "Atom.hpp"
+#include "ListFilter.hpp"
 #include <iostream>
+#include <list>
 
 namespace irc {
 
@@ -85,9 +88,12 @@ namespace irc {
 
 class User {
 
-    typedef std::map<std::string, unsigned char> ChannelMaskMap;
+    typedef std::map<Atom, unsigned char> ChannelMaskMap;
 
     public:
+    /* <channel, <ban list generation, banned> > */
+    typedef std::map<Atom, std::pair<unsigned long, bool> > BanCache;
+
     User(int fd, const char* ip_address);
     User(const User &other);
     ~User();
@@ -95,15 +101,16 @@ class User {
     User& operator=(const User &other);
     bool operator==(User const &other) const;
 
-    void setPrefixFromHost(std::string &host);
+    void setPrefixFromHost(const std::string &host);
     /* ATTRIBUTES */
     int fd;
     std::string ip_address;
     std::string real_nick; // caRCe-b042 
-    std::string nick;      // CARCE-B042 (for lookups)
+    Atom nick;             // CARCE-B042 (for lookups)
     std::string name;
     std::string full_name;
     std::string prefix;
+    std::string source;    // ":" + prefix + " ", starts what the user sends
     std::string mask;
     unsigned char server_mode;
     std::string afk_msg;
@@ -111,8 +118,13 @@ class User {
 
     /* Channel Things */
     ChannelMaskMap ch_name_mask_map;
+    BanCache ban_cache;
 
-    char buffer[BUFF_MAX_SIZE];
+    /* Partial line, no CRLF yet : up to LEFTOVER_INLINE bytes stay in
+     * the user, longer ones move to a block of the BufferPool, given
+     * back once the line is complete (resetBuffer) */
+    char leftover_inline[LEFTOVER_INLINE];
+    char *leftover_block;
     int buffer_size;
 
     bool isReadyForRegistration(bool server_password_on);
@@ -121,7 +133,38 @@ class User {
     bool hasLeftovers(void) const;
     void resetBuffer(void);
     void addLeftovers(std::string &leftovers);
-    std::string BufferToString(void) const;
+    const char* leftovers(void) const;
+
+    /* Flood control : complete lines not yet executed, and the
+     * token bucket that pays for them (see FLOOD_CONFIG). A list, not
+     * a deque : an empty one owns no memory, so an idle user doesn't
+     * pay for it and copying a new one is free */
+    std::list<std::string> pending_lines;
+    int flood_tokens;
+    time_t flood_refill;
+    bool read_paused;
+    bool in_run_queue;
+    bool spendFloodTokens(int penalty, time_t now);
+
+    /* Output : lines not written yet (see Server::flushSendQueues) */
+    std::string send_queue;
+    bool in_flush_queue;
+    bool write_blocked;     // socket full, waiting for POLLOUT
+    bool dead;              // SendQ exceeded / write error, being removed
+
+    /* LIST in progress : next channel to check, what to check, and
+     * how many matched so far (see AIrcCommands::continueList) */
+    bool listing;
+    Atom list_next;
+    ListFilter list_filter;
+    unsigned int list_results;
+
+    /* Traffic since the connection was accepted (STATS l) */
+    time_t connected_at;
+    unsigned long lines_in;
+    unsigned long bytes_in;
+    unsigned long lines_out;
+    unsigned long bytes_out;
 
     /* PING PONG things */
     time_t getLastMsgTime(void);
@@ -133,11 +176,12 @@ class User {
     bool isResgistered(void);
     bool isAway(void);
     bool isOperator(void);
-    bool isChannelModerator(std::string name);
-    bool isChannelOperator(std::string name);
-    bool isInChannel(std::string &channel); // nueva, carcebo
-    void addChannelMask(std::string &channel, int bits);
-    void deleteChannelMask(std::string &channel, int bits);
+    bool isChannelModerator(const Atom &name);
+    bool isChannelOperator(const Atom &name);
+    bool isInChannel(const Atom &channel); // nueva, carcebo
+    void leaveChannel(const Atom &channel);
+    void addChannelMask(const Atom &channel, int bits);
+    void deleteChannelMask(const Atom &channel, int bits);
     void addServerMask(int bits);
     void deleteServerMask(int bits);
 
@@ -146,6 +190,8 @@ class User {
     time_t ping_send_time;
     std::string ping_str;
 
+    private:
+    void copyLeftovers(const User &other);
 };
 
 }
@@ -0,0 +1,57 @@
+#ifndef IRC42_WELCOMEBURST_H
+# define IRC42_WELCOMEBURST_H
+
+#include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace irc {
+
+/*
+ * What a user gets once registered : 001 to 005 and the MOTD (or 422).
+ * None of it changes from one user to the next but the nick, and the
+ * prefix in 001, so build() serializes it all once, with holes where
+ * those go, and render() only copies the pieces and fills the holes.
+ * The burst goes to the send queue in one append, and out in one write.
+ *
+ *   burst.loadMotd(MOTD_FILE);
+ *   burst.build(server_prefix, hostname, started_at);
+ *   burst.render(user.send_queue, user.real_nick, user.prefix);
+ *
+ * The server builds it again on rehash, with the MOTD read again.
+ */
+class WelcomeBurst {
+
+    public:
+    WelcomeBurst(void);
+    ~WelcomeBurst();
+
+    int loadMotd(const std::string &path);
+    void build(const std::string &server_prefix, const std::string &hostname,
+               time_t created);
+    void render(std::string &out, const std::string &nick,
+                const std::string &prefix) const;
+    int lines(void) const;
+
+    private:
+    typedef enum {
+        NICK_HOLE = 0,
+        PREFIX_HOLE
+    } HOLE_TYPE;
+    typedef std::pair<size_t, HOLE_TYPE> Hole; // <offset in text, what goes>
+
+    void startLine(const std::string &server_prefix, const char *numeric);
+    void addHole(HOLE_TYPE type);
+    void endLine(void);
+
+    std::vector<std::string> motd;
+    bool has_motd;          // false : no MOTD_FILE, 422 instead
+    std::string text;       // the burst without the holes, CRLF included
+    std::vector<Hole> holes;
+    int line_count;
+};
+
+} // namespace
+
+#endif /* IRC42_WELCOMEBURST_H */
@@ -0,0 +1,103 @@
+#include "AllocProfile.hpp"
+
+#include <cstdlib>
+#include <new>
+
+namespace irc {
+
+/* Plain statics, zero before any constructor runs : other statics
+ * allocate before this file's initializers would */
+static AllocProfile::Counters tag_counters[ALLOC_TAGS];
+static unsigned long total_allocs = 0;
+static ALLOC_TAG current_tag = ALLOC_OTHER;
+
+static const char *tag_names[ALLOC_TAGS] = {
+    "other",
+    "parser",
+    "commands",
+    "users",
+    "channels",
+    "sendq",
+    "log"
+};
+
+bool AllocProfile::enabled(void) {
+#ifdef ALLOC_PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* AllocProfile::name(ALLOC_TAG tag) {
+    return tag_names[tag];
+}
+
+const AllocProfile::Counters& AllocProfile::counters(ALLOC_TAG tag) {
+    return tag_counters[tag];
+}
+
+unsigned long AllocProfile::allocations(void) {
+    return total_allocs;
+}
+
+ALLOC_TAG AllocProfile::enter(ALLOC_TAG tag) {
+    ALLOC_TAG previous = current_tag;
+    current_tag = tag;
+    return previous;
+}
+
+#ifdef ALLOC_PROFILE
+
+/* Used by operator new / delete only */
+static void charge(size_t tag, size_t size) {
+    AllocProfile::Counters &counters = tag_counters[tag];
+    counters.allocs++;
+    counters.bytes += size;
+    counters.live++;
+    counters.live_bytes += size;
+    total_allocs++;
+}
+
+static void discharge(size_t tag, size_t size) {
+    AllocProfile::Counters &counters = tag_counters[tag];
+    counters.live--;
+    counters.live_bytes -= size;
+}
+
+#endif
+
+} // namespace
+
+#ifdef ALLOC_PROFILE
+
+/* Every block starts with what it was charged to. 16 bytes, so what
+ * follows keeps the alignment malloc gives. new[] and the nothrow
+ * forms go through these two (libstdc++). */
+typedef struct AllocHeader {
+    size_t size;
+    size_t tag;
+} AllocHeader;
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+    AllocHeader *header = static_cast<AllocHeader*>(
+        malloc(sizeof(AllocHeader) + size));
+    if (header == NULL) {
+        throw std::bad_alloc();
+    }
+    header->size = size;
+    header->tag = irc::current_tag;
+    irc::charge(header->tag, size);
+    return header + 1;
+}
+
+void operator delete(void *ptr) throw() {
+    if (ptr == NULL) {
+        return ;
+    }
+    AllocHeader *header = static_cast<AllocHeader*>(ptr) - 1;
+    irc::discharge(header->tag, header->size);
+    free(header);
+}
+
+#endif
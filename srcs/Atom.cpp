@@ -0,0 +1,152 @@
+#include "Atom.hpp"
+#include "Tools.hpp"
+#include "Types.hpp"
+
+using std::string;
+
+namespace irc {
+
+/* Function static, so the table exists before any other static that
+ * might hold an Atom is constructed. */
+Atom::InternTable& Atom::table(void) {
+    static InternTable intern_table;
+    return intern_table;
+}
+
+Atom::Atom(void)
+:
+    entry(NULL)
+{}
+
+Atom::Atom(const string &str)
+:
+    entry(NULL)
+{
+    if (str.empty()) {
+        return ;
+    }
+    InternTable &t = table();
+    InternTable::iterator it = t.find(str);
+    if (it == t.end()) {
+        it = t.insert(Entry(str, 0)).first;
+    }
+    entry = &(*it);
+    retain();
+}
+
+Atom::Atom(const Atom &other)
+:
+    entry(other.entry)
+{
+    retain();
+}
+
+Atom::~Atom() {
+    release();
+}
+
+Atom& Atom::operator=(const Atom &other) {
+    if (entry != other.entry) {
+        release();
+        entry = other.entry;
+        retain();
+    }
+    return *this;
+}
+
+/* Does not intern : an unknown string gives an empty Atom */
+Atom Atom::lookup(const string &str) {
+    Atom atom;
+    InternTable &t = table();
+    InternTable::iterator it = t.find(str);
+    if (it != t.end()) {
+        atom.entry = &(*it);
+        atom.retain();
+    }
+    return atom;
+}
+
+size_t Atom::tableSize(void) {
+    return table().size();
+}
+
+/* Estimated, for STATS z */
+size_t Atom::tableBytes(void) {
+    InternTable &t = table();
+    size_t bytes = 0;
+    for (InternTable::iterator it = t.begin(); it != t.end(); it++) {
+        bytes += MAP_NODE_BYTES + sizeof(Entry) + tools::heapBytes(it->first);
+    }
+    return bytes;
+}
+
+void Atom::retain(void) {
+    if (entry != NULL) {
+        entry->second++;
+    }
+}
+
+void Atom::release(void) {
+    if (entry != NULL && --entry->second == 0) {
+        table().erase(entry->first);
+    }
+    entry = NULL;
+}
+
+const string& Atom::str(void) const {
+    static const string empty_str;
+    return entry != NULL ? entry->first : empty_str;
+}
+
+const char* Atom::c_str(void) const {
+    return str().c_str();
+}
+
+size_t Atom::size(void) const {
+    return str().size();
+}
+
+bool Atom::empty(void) const {
+    return entry == NULL;
+}
+
+int Atom::compare(const string &other) const {
+    return str().compare(other);
+}
+
+bool Atom::operator==(const Atom &other) const {
+    return entry == other.entry;
+}
+
+bool Atom::operator!=(const Atom &other) const {
+    return entry != other.entry;
+}
+
+bool Atom::operator<(const Atom &other) const {
+    if (entry == other.entry) {
+        return false;
+    }
+    return str() < other.str();
+}
+
+string operator+(const string &lhs, const Atom &rhs) {
+    return lhs + rhs.str();
+}
+
+string operator+(const char *lhs, const Atom &rhs) {
+    return lhs + rhs.str();
+}
+
+string operator+(const Atom &lhs, const string &rhs) {
+    return lhs.str() + rhs;
+}
+
+string operator+(const Atom &lhs, const char *rhs) {
+    return lhs.str() + rhs;
+}
+
+std::ostream& operator<<(std::ostream &o, const Atom &rhs) {
+    return o << rhs.str();
+}
+
+} // namespace
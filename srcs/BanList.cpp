@@ -0,0 +1,221 @@
+#include "BanList.hpp"
+#include "Tools.hpp"
+#include "libft.h"
+
+#include <algorithm>
+
+using std::string;
+
+namespace irc {
+
+unsigned long BanList::last_gen = 0;
+
+BanList::BanList(void)
+:
+    all_banned(0),
+    gen(++last_gen)
+{}
+
+BanList::~BanList() {
+}
+
+/*
+ * Completes what the user typed to a full nick!user@host mask :
+ *   1.2.3.4, 10.0.0.0/8, ::1   -> *!*@<arg>
+ *   user@host                  -> *!user@host
+ *   nick!user                  -> nick!user@*
+ *   nick                       -> nick!*@*
+ */
+string BanList::normalizeMask(const string &mask) {
+    bool has_excl = mask.find('!') != string::npos;
+    bool has_at = mask.find('@') != string::npos;
+
+    if (has_excl && has_at) {
+        return mask;
+    }
+    if (has_at) {
+        return "*!" + mask;
+    }
+    if (has_excl) {
+        return mask + "@*";
+    }
+    if (!mask.empty()
+        && (ft_isdigit(mask[0])
+            || mask.find(':') != string::npos
+            || mask.find('/') != string::npos))
+    {
+        return "*!*@" + mask;
+    }
+    return mask + "!*@*";
+}
+
+static bool hasGlob(const string &str) {
+    return str.find_first_of("*?") != string::npos;
+}
+
+BanList::MASK_KIND BanList::classify(const string &mask, string &key,
+                                     IpAddr &addr, int &len)
+{
+    size_t excl = mask.find('!');
+    size_t at = mask.find('@', excl);
+    string nick = mask.substr(0, excl);
+    string user = mask.substr(excl + 1, at - excl - 1);
+    string host = mask.substr(at + 1);
+
+    if (nick == "*" && user == "*") {
+        if (host == "*") {
+            return MASK_ALL;
+        }
+        if (!hasGlob(host)) {
+            if (host.find('/') != string::npos
+                && IpAddr::parseCidr(host, addr, len))
+            {
+                return MASK_CIDR;
+            }
+            key = host;
+            return MASK_HOST;
+        }
+    }
+    if (!hasGlob(nick) && user == "*" && host == "*") {
+        key = nick;
+        return MASK_NICK;
+    }
+    key = mask;
+    return MASK_GLOB;
+}
+
+/* Adds or removes the compiled form of an already normalized mask */
+void BanList::compile(const string &mask, bool add) {
+    string key;
+    IpAddr addr;
+    int len = 0;
+    string upper = mask;
+    tools::ToUpperCase(upper);
+
+    switch (classify(upper, key, addr, len)) {
+        case MASK_ALL:
+            add ? all_banned++ : all_banned--;
+            break ;
+        case MASK_NICK:
+            if (add) {
+                nicks[key]++;
+            } else if (--nicks[key] == 0) {
+                nicks.erase(key);
+            }
+            break ;
+        case MASK_HOST:
+            if (add) {
+                hosts[key]++;
+            } else if (--hosts[key] == 0) {
+                hosts.erase(key);
+            }
+            break ;
+        case MASK_CIDR:
+            add ? cidrs.insert(addr, len) : (void)cidrs.remove(addr, len);
+            break ;
+        case MASK_GLOB:
+            if (add) {
+                globs.push_back(key);
+            } else {
+                std::vector<string>::iterator it;
+                it = std::find(globs.begin(), globs.end(), key);
+                if (it != globs.end()) {
+                    globs.erase(it);
+                }
+            }
+            break ;
+    }
+}
+
+void BanList::bump(void) {
+    gen = ++last_gen;
+}
+
+/* mask must be normalized. Returns false if it was already there */
+bool BanList::add(const string &mask, int setter_fd) {
+    if (contains(mask)) {
+        return false;
+    }
+    masks.insert(std::pair<Atom, int>(Atom(mask), setter_fd));
+    compile(mask, true);
+    bump();
+    return true;
+}
+
+bool BanList::remove(const string &mask) {
+    MaskSetterMap::iterator it = masks.find(Atom::lookup(mask));
+    if (it == masks.end()) {
+        return false;
+    }
+    compile(mask, false);
+    masks.erase(it);
+    bump();
+    return true;
+}
+
+bool BanList::contains(const string &mask) const {
+    return masks.count(Atom::lookup(mask));
+}
+
+/*
+ * Cheapest checks first. The upper cased NICK!USER@HOST string is only
+ * built when there are glob masks left to try.
+ */
+bool BanList::matches(const string &nick, const string &user,
+                      const string &host) const
+{
+    if (masks.empty()) {
+        return false;
+    }
+    if (all_banned > 0) {
+        return true;
+    }
+    string upper_nick = nick;
+    tools::ToUpperCase(upper_nick);
+    if (nicks.count(upper_nick)) {
+        return true;
+    }
+    string upper_host = host;
+    tools::ToUpperCase(upper_host);
+    if (hosts.count(upper_host)) {
+        return true;
+    }
+    if (!cidrs.empty()) {
+        IpAddr addr;
+        if (IpAddr::parse(host, addr) && cidrs.contains(addr)) {
+            return true;
+        }
+    }
+    if (globs.empty()) {
+        return false;
+    }
+    string upper_user = user;
+    tools::ToUpperCase(upper_user);
+    string target = upper_nick + "!" + upper_user + "@" + upper_host;
+    for (std::vector<string>::const_iterator it = globs.begin();
+         it != globs.end(); it++)
+    {
+        if (tools::globMatch(*it, target)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BanList::empty(void) const {
+    return masks.empty();
+}
+
+size_t BanList::size(void) const {
+    return masks.size();
+}
+
+unsigned long BanList::generation(void) const {
+    return gen;
+}
+
+const BanList::MaskSetterMap& BanList::entries(void) const {
+    return masks;
+}
+
+} // namespace
@@ -0,0 +1,53 @@
+#include "BufferPool.hpp"
+#include "Types.hpp"
+
+namespace irc {
+
+BufferPool::BufferPool(void)
+:
+    free_blocks(),
+    in_use(0)
+{}
+
+BufferPool::~BufferPool() {
+    for (size_t i = 0; i < free_blocks.size(); i++) {
+        delete[] free_blocks[i];
+    }
+}
+
+/* Function static, like the Atom table : usable from other statics */
+BufferPool& BufferPool::global(void) {
+    static BufferPool pool;
+    return pool;
+}
+
+char* BufferPool::take(void) {
+    char *block;
+    if (free_blocks.empty()) {
+        block = new char[BUFF_MAX_SIZE];
+    } else {
+        block = free_blocks.back();
+        free_blocks.pop_back();
+    }
+    in_use++;
+    return block;
+}
+
+void BufferPool::give(char *block) {
+    in_use--;
+    if (free_blocks.size() < BUFFER_POOL_MAX_FREE) {
+        free_blocks.push_back(block);
+    } else {
+        delete[] block;
+    }
+}
+
+size_t BufferPool::inUse(void) const {
+    return in_use;
+}
+
+size_t BufferPool::pooled(void) const {
+    return free_blocks.size();
+}
+
+} // namespace
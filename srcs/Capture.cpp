@@ -0,0 +1,137 @@
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include "Tools.hpp"
+
+using std::string;
+
+namespace irc {
+
+const char Capture::magic[] = "IRCCAP1\n";
+
+Capture::Capture(void)
+:
+    file(),
+    conn_ids(),
+    next_conn(0),
+    last_us(0),
+    dirty(false)
+{}
+
+Capture::~Capture() {
+    flush();
+}
+
+bool Capture::open(const string &path) {
+    file.open(path.c_str(), std::ios::out | std::ios::binary
+                            | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(magic, sizeof(magic) - 1);
+    last_us = Clock::current().monotonicUs();
+    dirty = true;
+    return true;
+}
+
+bool Capture::isOpen(void) const {
+    return file.is_open();
+}
+
+void Capture::opened(int fd) {
+    if (!file.is_open()) {
+        return ;
+    }
+    conn_ids[fd] = next_conn++;
+    putRecord(OPEN, fd);
+}
+
+void Capture::received(int fd, const char *data, size_t len) {
+    if (!file.is_open() || !conn_ids.count(fd)) {
+        return ;
+    }
+    putRecord(DATA, fd);
+    putVarint(len);
+    file.write(data, len);
+}
+
+void Capture::closed(int fd) {
+    if (!file.is_open() || !conn_ids.count(fd)) {
+        return ;
+    }
+    putRecord(CLOSE, fd);
+    conn_ids.erase(fd);
+}
+
+/* Once per loop iteration : a killed server loses one iteration at most */
+void Capture::flush(void) {
+    if (dirty) {
+        file.flush();
+        dirty = false;
+    }
+}
+
+void Capture::putRecord(RECORD_TYPE type, int fd) {
+    unsigned long now = Clock::current().monotonicUs();
+    file.put((char)type);
+    putVarint(conn_ids[fd]);
+    putVarint(now - last_us);
+    last_us = now;
+    dirty = true;
+}
+
+void Capture::putVarint(unsigned long value) {
+    while (value >= 0x80) {
+        file.put((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    file.put((char)value);
+}
+
+bool Capture::getVarint(std::istream &in, unsigned long &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == EOF) {
+            return false;
+        }
+        value |= (unsigned long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Capture::readHeader(std::istream &in) {
+    char header[sizeof(magic) - 1];
+    in.read(header, sizeof(header));
+    return in.gcount() == (std::streamsize)sizeof(header)
+           && string(header, sizeof(header)) == magic;
+}
+
+/* false at the end of the file, or on a truncated record */
+bool Capture::readRecord(std::istream &in, Record &record) {
+    int type = in.get();
+    if (type == EOF || type > CLOSE) {
+        return false;
+    }
+    record.type = (RECORD_TYPE)type;
+    if (!getVarint(in, record.conn) || !getVarint(in, record.delta_us)) {
+        return false;
+    }
+    record.data.clear();
+    if (record.type != DATA) {
+        return true;
+    }
+    unsigned long len;
+    if (!getVarint(in, len)) {
+        return false;
+    }
+    record.data.resize(len);
+    if (len > 0) {
+        in.read(&record.data[0], len);
+    }
+    return in.gcount() == (std::streamsize)len;
+}
+
+} // namespace
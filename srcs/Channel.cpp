@@ -3,6 +3,8 @@
 #include "Log.hpp"
 #include "User.hpp"
 #include "Tools.hpp"
+#include "Clock.hpp"
+#include "AllocProfile.hpp"
 
 using std::string;
 using std::list;
@@ -10,12 +12,21 @@ using std::list;
 namespace irc {
 
 /* 
- * Al crearse el canal se setea al usuario creador el rol 'o' 
- * el canal al principio no tiene ningún modo. Se setea después 
+ * El canal nace vacío, sin nada en el heap : se copia así al mapa de
+ * canales (IrcDataBase::addNewChannel) y el creador entra después,
+ * con addFounder. Aparte de +t no tiene ningún modo, se setean después
  */
-Channel::Channel(string name, User& user) : name(name), mode(0) {
-    all_banned = false;
-    users.push_back(user.nick);
+Channel::Channel(const Atom &name)
+:
+    name(name),
+    mode(0),
+    topic_set_at(0),
+    created_at(Clock::current().now()),
+    names_cache(),
+    names_cache_valid(true),
+    messages(0),
+    bytes_out(0)
+{
     addMode(CH_TOP);
 }
 
@@ -28,14 +39,32 @@ Channel::~Channel() {
 
 /* CLASS FUNCTIONS */
 
+/**
+ * El creador del canal, su primer miembro, entra con el rol 'o'
+ * (el ch_name_mask_map del usuario lo pone quien crea el canal)
+ */
+void Channel::addFounder(User &user) {
+    users.push_back(user.nick);
+    names_cache.assign(1, '@');
+    names_cache += user.real_nick;
+}
+
 /**
  * Añadir un usuario a un canal:
  * 1. Se comprueba la disponibilidad del canal a nivel de
  *    comando, antes de llamar esta funcion
  * 2. Se añade el usuario a la lista de usuarios
+ * 3. Quien entra no tiene modos todavía : su nick va tal cual al final
+ *    del NAMES cacheado, sin recorrer a los demás
  */
 void Channel::addUser(User &user) {
     users.push_back(user.nick);
+    if (names_cache_valid) {
+        if (!names_cache.empty()) {
+            names_cache += ' ';
+        }
+        names_cache += user.real_nick;
+    }
 }
 
 /*
@@ -51,65 +80,53 @@ void Channel::addUser(User &user) {
  * 
  */
 void Channel::deleteUser(User &user) {
-    NickList::iterator end = users.end();
-    for (NickList::iterator u = users.begin(); u != end; u++) {
-        if (!u->compare(user.nick)) {
-            users.erase(u);
-            break ;
-        }
+    NickList::iterator it = std::find(users.begin(), users.end(), user.nick);
+    if (it != users.end()) {
+        users.erase(it);
+        invalidateNamesCache();
     }
 }
 
 /**
- * Banea a un usuario
+ * Banea una mascara (ya normalizada, ver BanList::normalizeMask).
+ * Devuelve false si ya estaba en la lista.
  */
-void Channel::banUser(string &user, int fd) {
-    if (!user.compare("*!*@*")) {
-        all_banned = true;
-    }
-    black_list.insert(std::pair<string, int>(user, fd));
+bool Channel::banUser(const string &mask, int fd) {
+    AllocScope scope(ALLOC_CHANNELS);
+    return black_list.add(mask, fd);
 }
 
 /**
- * Desbanea a un usuario
+ * Desbanea una mascara
  */
-bool Channel::unbanUser(string &user) {
-    if (black_list.count(user)) {
-        std::map<string, int>::iterator it = black_list.find(user);
-        if (!user.compare("*!*@*")) {
-            all_banned = false;
-        }
-        black_list.erase(it->first);
-        if (black_list.size() == 0) {
-            deleteMode(CH_BAN);
-        }
-        return true;
+bool Channel::unbanUser(const string &mask) {
+    AllocScope scope(ALLOC_CHANNELS);
+    if (!black_list.remove(mask)) {
+        return false;
     }
-    return false;
+    if (black_list.empty()) {
+        deleteMode(CH_BAN);
+    }
+    return true;
 }
 
 /**
- * Comprueba si el usuario está en la lista de baneados
+ * Comprueba si el usuario está en la lista de baneados. El veredicto
+ * se guarda en el usuario junto con la generación de la lista, y solo
+ * se recalcula cuando la lista cambia (o el usuario cambia de nick).
  */
-bool Channel::userInBlackList(string nick, string ip_address) {
-    for (std::map<string, int>::iterator it = black_list.begin();
-         it != black_list.end(); it++)
+bool Channel::userInBlackList(User &user) {
+    User::BanCache::iterator it = user.ban_cache.find(name);
+    if (it != user.ban_cache.end()
+        && it->second.first == black_list.generation())
     {
-        string banned_user = it->first.substr(0, it->first.find("!"));
-        string banned_ip = it->first.substr(it->first.find("@") + 1);
-            // If *!*@* is found in the blackList
-        if ((!banned_ip.compare("*") && !banned_user.compare("*"))
-            // If nick!*@* is found
-            || (!nick.compare(banned_user) && !banned_ip.compare("*"))
-            // If *!*@ip_address is found
-            || (!ip_address.compare(banned_ip) && !banned_user.compare("*"))
-            // If user!*@ip_address is found
-            || (!nick.compare(banned_user) && !ip_address.compare(banned_ip)))
-        {
-            return true;
-        }
+        return it->second.second;
     }
-    return false;
+    bool banned = black_list.matches(user.real_nick, user.name,
+                                     user.ip_address);
+    user.ban_cache[name] = std::make_pair(black_list.generation(), banned);
+    ban_cached.insert(user.fd);
+    return banned;
 }
 
 /**
@@ -159,19 +176,19 @@ bool Channel::isUserOperator(User &user) {
 /**
  * Añade un nuevo usuario a la whitelist 
  */
-void Channel::addToWhitelist(string &nick) {
+void Channel::addToWhitelist(const Atom &nick) {
     white_list.push_back(nick);
 }
 
 /**
  * Devuelve true si el usuario está en la white_list del canal 
  */
-bool Channel::isInvited(string &nick) {
+bool Channel::isInvited(const Atom &nick) {
     return (std::find(white_list.begin(), white_list.end(), nick)
                       != white_list.end());
 }
 
-bool Channel::userIsInChannel(string& nick) {
+bool Channel::userIsInChannel(const Atom &nick) {
     return (std::find(users.begin(), users.end(), nick) != users.end());
 }
 
@@ -191,11 +208,18 @@ string Channel::getModeStr() {
     return mode;
 }
 
-void Channel::updateUserNick(string &old_nick, string &new_nick) {
-    list<string>::iterator it = std::find(users.begin(), users.end(), old_nick);
+void Channel::updateUserNick(const Atom &old_nick, const Atom &new_nick) {
+    NickList::iterator it = std::find(users.begin(), users.end(), old_nick);
     if (it != users.end()) {
         *it = new_nick;
+        invalidateNamesCache();
     }
 }
 
+/* Se reconstruye en el próximo NAMES / JOIN */
+void Channel::invalidateNamesCache(void) {
+    names_cache_valid = false;
+    names_cache.clear();
+}
+
 } // namespace
@@ -0,0 +1,293 @@
+#include "CidrTrie.hpp"
+#include "libft.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+
+using std::string;
+
+namespace irc {
+
+/* bit i of the address, counting from the most significant one */
+static int bitAt(const IpAddr &addr, int i) {
+    return (addr.bytes[i >> 3] >> (7 - (i & 7))) & 0x01;
+}
+
+/* number of leading bits a and b have in common, up to max */
+static int commonBits(const IpAddr &a, const IpAddr &b, int max) {
+    int i = 0;
+    while (i < max && (i & 7) == 0 && i + 8 <= max
+           && a.bytes[i >> 3] == b.bytes[i >> 3])
+    {
+        i += 8;
+    }
+    while (i < max && bitAt(a, i) == bitAt(b, i)) {
+        i++;
+    }
+    return i;
+}
+
+bool IpAddr::parse(const string &str, IpAddr &addr) {
+    ft_memset(addr.bytes, 0, sizeof(addr.bytes));
+    if (inet_pton(AF_INET6, str.c_str(), addr.bytes) == 1) {
+        return true;
+    }
+    if (inet_pton(AF_INET, str.c_str(), addr.bytes + 12) == 1) {
+        addr.bytes[10] = 0xff;
+        addr.bytes[11] = 0xff;
+        return true;
+    }
+    return false;
+}
+
+/* a.b.c.d[/n] or x:y::z[/n]. Without /n, the full address */
+bool IpAddr::parseCidr(const string &str, IpAddr &addr, int &len) {
+    size_t slash = str.find('/');
+    if (!parse(str.substr(0, slash), addr)) {
+        return false;
+    }
+    int max = addr.isV4() ? 32 : 128;
+    len = max;
+    if (slash != string::npos) {
+        string bits = str.substr(slash + 1);
+        if (bits.empty() || bits.size() > 3) {
+            return false;
+        }
+        for (size_t i = 0; i < bits.size(); i++) {
+            if (!ft_isdigit(bits[i])) {
+                return false;
+            }
+        }
+        len = ft_atoi(bits.c_str());
+        if (len > max) {
+            return false;
+        }
+    }
+    if (addr.isV4()) {
+        len += 96;
+    }
+    addr = addr.masked(len);
+    return true;
+}
+
+/* Straight from what accept() filled, no string conversions */
+bool IpAddr::fromSockaddr(const struct sockaddr *sa, IpAddr &addr) {
+    ft_memset(addr.bytes, 0, sizeof(addr.bytes));
+    if (sa->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)sa;
+        ft_memcpy(addr.bytes + 12, &in->sin_addr, 4);
+        addr.bytes[10] = 0xff;
+        addr.bytes[11] = 0xff;
+        return true;
+    }
+    if (sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)sa;
+        ft_memcpy(addr.bytes, &in6->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+/* copy with every bit after len zeroed */
+IpAddr IpAddr::masked(int len) const {
+    IpAddr ret = *this;
+    for (int i = 0; i < 16; i++) {
+        int keep = len - i * 8;
+        if (keep <= 0) {
+            ret.bytes[i] = 0;
+        } else if (keep < 8) {
+            ret.bytes[i] &= (unsigned char)(0xff << (8 - keep));
+        }
+    }
+    return ret;
+}
+
+bool IpAddr::operator<(const IpAddr &other) const {
+    return ft_memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+}
+
+bool IpAddr::isV4(void) const {
+    for (int i = 0; i < 10; i++) {
+        if (bytes[i] != 0) {
+            return false;
+        }
+    }
+    return bytes[10] == 0xff && bytes[11] == 0xff;
+}
+
+CidrTrie::CidrTrie(void)
+:
+    root(NULL),
+    prefixes(0)
+{}
+
+CidrTrie::CidrTrie(const CidrTrie &other)
+:
+    root(copyNodes(other.root)),
+    prefixes(other.prefixes)
+{}
+
+CidrTrie::~CidrTrie() {
+    deleteNodes(root);
+}
+
+CidrTrie& CidrTrie::operator=(const CidrTrie &other) {
+    if (this != &other) {
+        deleteNodes(root);
+        root = copyNodes(other.root);
+        prefixes = other.prefixes;
+    }
+    return *this;
+}
+
+CidrTrie::Node* CidrTrie::newNode(const IpAddr &addr, int len,
+                                  unsigned long refs)
+{
+    Node *node = new Node;
+    node->key = addr.masked(len);
+    node->len = len;
+    node->refs = refs;
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    return node;
+}
+
+CidrTrie::Node* CidrTrie::copyNodes(const Node *node) {
+    if (node == NULL) {
+        return NULL;
+    }
+    Node *copy = newNode(node->key, node->len, node->refs);
+    copy->child[0] = copyNodes(node->child[0]);
+    copy->child[1] = copyNodes(node->child[1]);
+    return copy;
+}
+
+void CidrTrie::deleteNodes(Node *node) {
+    if (node == NULL) {
+        return ;
+    }
+    deleteNodes(node->child[0]);
+    deleteNodes(node->child[1]);
+    delete node;
+}
+
+/* Removes the node at *link if it is not a prefix anymore and
+ * does not branch. */
+void CidrTrie::collapse(Node **link) {
+    Node *node = *link;
+    if (node == NULL || node->refs > 0
+        || (node->child[0] != NULL && node->child[1] != NULL))
+    {
+        return ;
+    }
+    *link = node->child[0] != NULL ? node->child[0] : node->child[1];
+    delete node;
+}
+
+void CidrTrie::insert(const IpAddr &addr, int len) {
+    Node **link = &root;
+    while (*link != NULL) {
+        Node *node = *link;
+        int common = commonBits(node->key, addr,
+                                node->len < len ? node->len : len);
+        /* addr leaves this node's prefix : split at the common part */
+        if (common < node->len) {
+            Node *split = newNode(addr, common, 0);
+            split->child[bitAt(node->key, common)] = node;
+            *link = split;
+            if (common == len) {
+                split->refs = 1;
+            } else {
+                split->child[bitAt(addr, common)] = newNode(addr, len, 1);
+            }
+            prefixes++;
+            return ;
+        }
+        if (node->len == len) {
+            if (node->refs++ == 0) {
+                prefixes++;
+            }
+            return ;
+        }
+        link = &node->child[bitAt(addr, node->len)];
+    }
+    *link = newNode(addr, len, 1);
+    prefixes++;
+}
+
+bool CidrTrie::remove(const IpAddr &addr, int len) {
+    Node **parent_link = NULL;
+    Node **link = &root;
+    while (*link != NULL) {
+        Node *node = *link;
+        if (node->len > len
+            || commonBits(node->key, addr, node->len) < node->len)
+        {
+            return false;
+        }
+        if (node->len == len) {
+            break ;
+        }
+        parent_link = link;
+        link = &node->child[bitAt(addr, node->len)];
+    }
+    if (*link == NULL || (*link)->refs == 0) {
+        return false;
+    }
+    if (--(*link)->refs == 0) {
+        prefixes--;
+        collapse(link);
+        if (parent_link != NULL) {
+            collapse(parent_link);
+        }
+    }
+    return true;
+}
+
+/* true if any stored prefix covers addr */
+bool CidrTrie::contains(const IpAddr &addr) const {
+    const Node *node = root;
+    while (node != NULL) {
+        if (commonBits(node->key, addr, node->len) < node->len) {
+            return false;
+        }
+        if (node->refs > 0) {
+            return true;
+        }
+        if (node->len == 128) {
+            return false;
+        }
+        node = node->child[bitAt(addr, node->len)];
+    }
+    return false;
+}
+
+void CidrTrie::clear(void) {
+    deleteNodes(root);
+    root = NULL;
+    prefixes = 0;
+}
+
+bool CidrTrie::empty(void) const {
+    return prefixes == 0;
+}
+
+size_t CidrTrie::size(void) const {
+    return prefixes;
+}
+
+size_t CidrTrie::countNodes(const Node *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return 1 + countNodes(node->child[0]) + countNodes(node->child[1]);
+}
+
+/* Memory held by the nodes, branching points included (STATS z) */
+size_t CidrTrie::nodeBytes(void) const {
+    return countNodes(root) * sizeof(Node);
+}
+
+} // namespace
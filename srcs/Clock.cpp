@@ -0,0 +1,58 @@
+#include "Clock.hpp"
+#include "Tools.hpp"
+
+namespace irc {
+
+Clock::~Clock() {}
+
+Clock& Clock::system(void) {
+    static SystemClock clock;
+    return clock;
+}
+
+Clock*& Clock::currentPtr(void) {
+    static Clock *clock = &system();
+    return clock;
+}
+
+Clock& Clock::current(void) {
+    return *currentPtr();
+}
+
+void Clock::setCurrent(Clock &clock) {
+    currentPtr() = &clock;
+}
+
+SystemClock::SystemClock(void) {}
+
+SystemClock::~SystemClock() {}
+
+time_t SystemClock::now(void) {
+    return time(NULL);
+}
+
+unsigned long SystemClock::monotonicUs(void) {
+    return tools::monotonicUs();
+}
+
+ManualClock::ManualClock(time_t start)
+:
+    start(start),
+    elapsed_us(0)
+{}
+
+ManualClock::~ManualClock() {}
+
+time_t ManualClock::now(void) {
+    return start + elapsed_us / 1000000;
+}
+
+unsigned long ManualClock::monotonicUs(void) {
+    return elapsed_us;
+}
+
+void ManualClock::advance(unsigned long us) {
+    elapsed_us += us;
+}
+
+} // namespace
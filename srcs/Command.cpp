@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include "Tools.hpp"
+#include "AllocProfile.hpp"
 #include <iostream>
 
 
@@ -30,6 +31,7 @@ Command::~Command()
  */
 int Command::Parse(string &cmd) {
 
+    AllocScope scope(ALLOC_PARSER);
     if (newlines_left(cmd)) {
         return ERR_NEWLINES;
     }
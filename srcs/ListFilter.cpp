@@ -0,0 +1,185 @@
+#include "ListFilter.hpp"
+#include "Channel.hpp"
+#include "Tools.hpp"
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+
+using std::string;
+
+namespace irc {
+
+ListFilter::ListFilter(void)
+:
+    more_than(UNSET),
+    fewer_than(UNSET),
+    created_before(UNSET),
+    created_after(UNSET),
+    topic_before(UNSET),
+    topic_after(UNSET)
+{}
+
+ListFilter::~ListFilter() {}
+
+bool ListFilter::parseNumber(const string &str, long &value) {
+    if (str.empty() || str.size() > 9
+        || str.find_first_not_of("0123456789") != string::npos)
+    {
+        return false;
+    }
+    value = std::atol(str.c_str());
+    return true;
+}
+
+/* Masks are kept upper cased, names are upper cased to match them.
+ * The prefix is the longest literal start of the masks, up to their
+ * first letter : the names are walked in their case sensitive order. */
+void ListFilter::addMask(const string &mask, bool negated) {
+    string folded = mask;
+    tools::ToUpperCase(folded);
+    if (negated) {
+        negated_masks.push_back(folded);
+        return ;
+    }
+    masks.push_back(folded);
+    size_t literal_end = 0;
+    while (literal_end < mask.size() && mask[literal_end] != '*'
+           && mask[literal_end] != '?' && !isalpha(mask[literal_end]))
+    {
+        literal_end++;
+    }
+    string literal = mask.substr(0, literal_end);
+    if (literal.size() > name_prefix.size()) {
+        name_prefix = literal;
+    }
+}
+
+bool ListFilter::parse(const string &conditions) {
+    std::vector<string> tokens;
+    string copy = conditions;
+    tools::split(tokens, copy, ",");
+    if (tokens.empty()) {
+        return false;
+    }
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const string &tok = tokens[i];
+        if (tok.empty()) {
+            return false;
+        }
+        char kind = toupper(tok[0]);
+        if ((kind == 'C' || kind == 'T') && tok.size() > 1
+            && (tok[1] == '>' || tok[1] == '<'))
+        {
+            long minutes;
+            if (!parseNumber(tok.substr(2), minutes)) {
+                return false;
+            }
+            bool older = tok[1] == '>';
+            if (kind == 'C') {
+                (older ? created_before : created_after) = minutes;
+            } else {
+                (older ? topic_before : topic_after) = minutes;
+            }
+        } else if (tok[0] == '>' || tok[0] == '<') {
+            long users;
+            if (!parseNumber(tok.substr(1), users)) {
+                return false;
+            }
+            (tok[0] == '>' ? more_than : fewer_than) = users;
+        } else if (tok[0] == '!' && tok.size() > 1) {
+            addMask(tok.substr(1), true);
+        } else if (tok.find_first_of("*?") != string::npos) {
+            addMask(tok, false);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ListFilter::matches(const Channel &channel, time_t now) const {
+    long users = channel.users.size();
+    if ((more_than != UNSET && users <= more_than)
+        || (fewer_than != UNSET && users >= fewer_than))
+    {
+        return false;
+    }
+    long created = (now - channel.created_at) / 60;
+    if ((created_before != UNSET && created <= created_before)
+        || (created_after != UNSET && created >= created_after))
+    {
+        return false;
+    }
+    if (topic_before != UNSET || topic_after != UNSET) {
+        if (channel.topic_set_at == 0) {
+            return false;
+        }
+        long topic = (now - channel.topic_set_at) / 60;
+        if ((topic_before != UNSET && topic <= topic_before)
+            || (topic_after != UNSET && topic >= topic_after))
+        {
+            return false;
+        }
+    }
+    if (masks.empty() && negated_masks.empty()) {
+        return true;
+    }
+    string name = channel.name.str();
+    tools::ToUpperCase(name);
+    for (size_t i = 0; i < masks.size(); i++) {
+        if (!tools::globMatch(masks[i], name)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < negated_masks.size(); i++) {
+        if (tools::globMatch(negated_masks[i], name)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 0 and 1 members go to bucket 0, then 2-3, 4-7, 8-15 ... */
+int ListFilter::sizeBucket(size_t members) {
+    int bucket = 0;
+    while (members > 1) {
+        members >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* false for LIST with no conditions : every channel matches */
+bool ListFilter::restricts(void) const {
+    return sizeBounded() || created_before != UNSET
+           || created_after != UNSET || topic_before != UNSET
+           || topic_after != UNSET || !masks.empty()
+           || !negated_masks.empty();
+}
+
+bool ListFilter::sizeBounded(void) const {
+    return more_than != UNSET || fewer_than != UNSET;
+}
+
+int ListFilter::firstBucket(void) const {
+    return more_than == UNSET ? 0 : sizeBucket(more_than + 1);
+}
+
+/* -1 : nothing can match (fewer than 0 users) */
+int ListFilter::lastBucket(void) const {
+    if (fewer_than == UNSET) {
+        return INT_MAX;
+    }
+    return fewer_than == 0 ? -1 : sizeBucket(fewer_than - 1);
+}
+
+const string& ListFilter::prefix(void) const {
+    return name_prefix;
+}
+
+bool ListFilter::inNameRange(const string &name) const {
+    return name.compare(0, name_prefix.size(), name_prefix) == 0;
+}
+
+} // namespace
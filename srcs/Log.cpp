@@ -2,11 +2,13 @@
 
 LOG::LOG()
 :
+    scope(irc::ALLOC_LOG),
     opened(false)
 {}
 
 LOG::LOG(typelog type)
 :
+    scope(irc::ALLOC_LOG),
     opened(false)
 {
     // Calls LOG operator<< (important for opened = true)
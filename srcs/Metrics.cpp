@@ -0,0 +1,187 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+using std::string;
+
+namespace irc {
+
+Metrics::Histogram::Histogram(void)
+:
+    bounds(),
+    counts(1, 0),
+    sum(0),
+    count(0),
+    max(0)
+{}
+
+Metrics::Histogram::Histogram(unsigned long first_bound, int nb_octaves,
+                              int sub_buckets)
+:
+    bounds(1, first_bound),
+    counts(),
+    sum(0),
+    count(0),
+    max(0)
+{
+    for (int o = 1; o < nb_octaves; o++) {
+        unsigned long low = first_bound << (o - 1);
+        unsigned long width = low / sub_buckets;
+        for (int b = 1; b <= sub_buckets; b++) {
+            unsigned long bound = (b == sub_buckets) ? low * 2
+                                                     : low + width * b;
+            if (bound > bounds.back()) {
+                bounds.push_back(bound);
+            }
+        }
+    }
+    counts.assign(bounds.size() + 1, 0);
+}
+
+void Metrics::Histogram::observe(unsigned long value) {
+    size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value)
+                    - bounds.begin();
+    counts[bucket]++;
+    sum += value;
+    count++;
+    if (value > max) {
+        max = value;
+    }
+}
+
+/* Upper bound of the bucket holding the q-th value (0 < q <= 1), as
+ * precise as the buckets are. Never more than the biggest value seen. */
+unsigned long Metrics::Histogram::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(q * count);
+    if (rank < q * count || rank == 0) {
+        rank++;
+    }
+    unsigned long seen = 0;
+    for (size_t b = 0; b < bounds.size(); b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return bounds[b] < max ? bounds[b] : max;
+        }
+    }
+    return max;
+}
+
+/* Function static, like the Atom table : usable from other statics */
+Metrics& Metrics::global(void) {
+    static Metrics registry;
+    return registry;
+}
+
+Metrics::Family& Metrics::family(const string &name, const string &help,
+                                 METRIC_TYPE type)
+{
+    FamilyMap::iterator it = families.find(name);
+    if (it == families.end()) {
+        it = families.insert(std::make_pair(name, Family())).first;
+        it->second.type = type;
+        it->second.help = help;
+    }
+    return it->second;
+}
+
+Metrics::Counter& Metrics::counter(const string &name, const string &help,
+                                   const string &labels)
+{
+    return family(name, help, COUNTER).counters[labels];
+}
+
+Metrics::Gauge& Metrics::gauge(const string &name, const string &help,
+                               const string &labels)
+{
+    return family(name, help, GAUGE).gauges[labels];
+}
+
+Metrics::Histogram& Metrics::histogram(const string &name, const string &help,
+                                       unsigned long first_bound,
+                                       int nb_octaves, int sub_buckets,
+                                       const string &labels)
+{
+    Family &f = family(name, help, HISTOGRAM);
+    std::map<string, Histogram>::iterator it = f.histograms.find(labels);
+    if (it == f.histograms.end()) {
+        it = f.histograms.insert(std::make_pair(labels,
+                                 Histogram(first_bound, nb_octaves,
+                                           sub_buckets))).first;
+    }
+    return it->second;
+}
+
+/* key="value", with \ " and newlines escaped as the format wants */
+string Metrics::label(const string &key, const string &value) {
+    string ret = key + "=\"";
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '\\' || value[i] == '"') {
+            ret += '\\';
+            ret += value[i];
+        } else if (value[i] == '\n') {
+            ret += "\\n";
+        } else {
+            ret += value[i];
+        }
+    }
+    return ret + "\"";
+}
+
+static string braces(const string &labels) {
+    return labels.empty() ? "" : "{" + labels + "}";
+}
+
+static string withLe(const string &labels, const string &le) {
+    return "{" + labels + (labels.empty() ? "" : ",") + "le=\"" + le + "\"}";
+}
+
+/* Prometheus text exposition format, version 0.0.4 */
+string Metrics::render(void) const {
+    static const char *type_names[] = {"counter", "gauge", "histogram"};
+    std::ostringstream out;
+
+    for (FamilyMap::const_iterator it = families.begin();
+         it != families.end(); it++)
+    {
+        const string &name = it->first;
+        const Family &f = it->second;
+        out << "# HELP " << name << " " << f.help << "\n"
+            << "# TYPE " << name << " " << type_names[f.type] << "\n";
+        for (std::map<string, Counter>::const_iterator c = f.counters.begin();
+             c != f.counters.end(); c++)
+        {
+            out << name << braces(c->first) << " " << c->second.value << "\n";
+        }
+        for (std::map<string, Gauge>::const_iterator g = f.gauges.begin();
+             g != f.gauges.end(); g++)
+        {
+            out << name << braces(g->first) << " " << g->second.value << "\n";
+        }
+        for (std::map<string, Histogram>::const_iterator h =
+             f.histograms.begin(); h != f.histograms.end(); h++)
+        {
+            const Histogram &hist = h->second;
+            unsigned long cumulative = 0;
+            for (size_t b = 0; b < hist.bounds.size(); b++) {
+                std::ostringstream le;
+                le << hist.bounds[b];
+                cumulative += hist.counts[b];
+                out << name << "_bucket" << withLe(h->first, le.str())
+                    << " " << cumulative << "\n";
+            }
+            out << name << "_bucket" << withLe(h->first, "+Inf")
+                << " " << hist.count << "\n"
+                << name << "_sum" << braces(h->first)
+                << " " << hist.sum << "\n"
+                << name << "_count" << braces(h->first)
+                << " " << hist.count << "\n";
+        }
+    }
+    return out.str();
+}
+
+} // namespace
@@ -6,6 +6,7 @@
 #include "NumericReplies.hpp"
 #include "Log.hpp"
 #include "Channel.hpp"
+#include "Clock.hpp"
 
 #include "libft.h"
 
@@ -19,34 +20,62 @@ namespace irc {
 AIrcCommands::AIrcCommands(void)
 :
     FdManager(),
-    IrcDataBase()
+    IrcDataBase(),
+    numeric_fd(-1),
+    numeric_start(0)
 {}
 
 AIrcCommands::AIrcCommands(string &password)
 :
     FdManager(),
     IrcDataBase(),
-    password(password)
+    password(password),
+    numeric_fd(-1),
+    numeric_start(0)
 {}
 
 AIrcCommands::AIrcCommands(string &hostname, string &port)
 :
     FdManager(hostname, port),
-    IrcDataBase()
+    IrcDataBase(),
+    numeric_fd(-1),
+    numeric_start(0)
 {}
 
 AIrcCommands::AIrcCommands(string &hostname, string &port, string &password)
 :
     FdManager(hostname, port),
     IrcDataBase(),
-    password(password)
+    password(password),
+    numeric_fd(-1),
+    numeric_start(0)
+{}
+
+AIrcCommands::AIrcCommands(Transport &transport, string &hostname,
+                           string &port)
+:
+    FdManager(transport, hostname, port),
+    IrcDataBase(),
+    numeric_fd(-1),
+    numeric_start(0)
+{}
+
+AIrcCommands::AIrcCommands(Transport &transport, string &hostname,
+                           string &port, string &password)
+:
+    FdManager(transport, hostname, port),
+    IrcDataBase(),
+    password(password),
+    numeric_fd(-1),
+    numeric_start(0)
 {}
 
 AIrcCommands::AIrcCommands(const AIrcCommands& other)
 :
     FdManager(other),
     IrcDataBase(other),
-    password(other.password)
+    password(other.password),
+    opers(other.opers)
 {}
 
 AIrcCommands::~AIrcCommands()
@@ -96,23 +125,22 @@ void AIrcCommands::NICK(Command &cmd, int fd) {
     /* case nickname change */
     if (user.isResgistered()) {
         // Notify channels of nickname change
-        for (map<string, unsigned char>::iterator
+        string &reply = startMessage(user, "NICK");
+        reply += ':';
+        reply += real_nick;
+        for (map<Atom, unsigned char>::iterator
              it = user.ch_name_mask_map.begin();
              it != user.ch_name_mask_map.end(); it++)
         {
-            string reply = ":" + user.prefix + " "
-                            + cmd.Name() + " :"
-                            + real_nick;
-            string ch_name = it->first;
-            Channel &channel = getChannelFromName(ch_name);
+            Channel &channel = getChannelFromName(it->first);
             sendMessageToChannel(channel, reply, user.nick);
         }
         return updateUserNick(fd, nick, real_nick);
     }
     /* case the nickname is the first recieved from this user */
-    user.nick = nick;
+    user.nick = Atom(nick);
     user.real_nick = real_nick;
-    addNickFdPair(nick, fd);
+    addNickFdPair(user.nick, fd);
     /* case NICK is recieved before valid USER comand */
     return maybeRegisterUser(user);
 }
@@ -251,7 +279,7 @@ void AIrcCommands::JOIN(Command &cmd, int fd) {
     if (size < 2) {
         return sendNeedMoreParams(user.real_nick, cmd.Name(), fd);
     }
-    string ch_name = cmd.args[1];
+    const string &ch_name = cmd.args[1];
     if (!tools::starts_with_mask(ch_name)) {
         return sendBadChannelMask(user.real_nick,ch_name, fd);
     }
@@ -263,8 +291,7 @@ void AIrcCommands::JOIN(Command &cmd, int fd) {
         return ;
     }
     if (channel.banModeOn()
-        && (channel.userInBlackList(user.real_nick, user.ip_address)
-            || channel.all_banned)
+        && channel.userInBlackList(user)
         && !channel.isUserOperator(user))
     {
         string reply = (ERR_BANNEDFROMCHAN
@@ -323,17 +350,17 @@ void AIrcCommands::PART(Command &cmd, int fd) {
     if (!channelExists(cmd.args[1])) {
         return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
     }
-    Channel &channel = channel_map.find(cmd.args[1])->second;
+    Channel &channel = getChannelFromName(cmd.args[1]);
     if (!channel.userIsInChannel(user.nick)) {
-        return sendNotOnChannel(user.real_nick, channel.name, fd);
+        return sendNotOnChannel(user.real_nick, channel.name.str(), fd);
     }
-    channel.deleteUser(user);
-    user.ch_name_mask_map.erase(channel.name);
+    deleteChannelMember(channel, user);
+    user.leaveChannel(channel.name);
     if (size == 3) {
-        return sendPartMessage(cmd.args[2], fd, user, channel);
+        sendPartMessage(cmd.args[2], fd, user, channel);
+    } else {
+        sendPartMessage(string(), fd, user, channel);
     }
-    string no_message = "";
-    sendPartMessage(no_message, fd, user, channel);
     maybeRemoveChannel(channel);
 }
 
@@ -369,9 +396,9 @@ void AIrcCommands::TOPIC(Command &cmd, int fd) {
     if (!channelExists(cmd.args[1])) {
         return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
     }
-    Channel &channel = channel_map.find(cmd.args[1])->second;
+    Channel &channel = getChannelFromName(cmd.args[1]);
     if (!channel.userIsInChannel(user.nick)) {
-        return sendNotOnChannel(user.real_nick, channel.name, fd);
+        return sendNotOnChannel(user.real_nick, channel.name.str(), fd);
     }
     if (!channel.topicModeOn()) {
         return sendNoChannelModes(cmd.Name(), fd);
@@ -391,26 +418,28 @@ void AIrcCommands::TOPIC(Command &cmd, int fd) {
         return DataToUser(fd, reply, NUMERIC_REPLY);
     }
     if (!channel.isUserOperator(user)) {
-        return sendChannelOperatorNeeded(user.real_nick, channel.name, fd);
+        return sendChannelOperatorNeeded(user.real_nick, channel.name.str(), fd);
     }
     if (size == 3) {
         channel.topic = (cmd.args[2][0] == ':')
                         ? cmd.args[2].substr(1)
                         : cmd.args[2];
-        string reply(user.prefix + " "
-                     + cmd.Name()+ " "
-                     + channel.name + " :"
-                     + channel.topic);
+        channel.topic_set_at = Clock::current().now();
+        string &reply = startMessage(user, "TOPIC");
+        reply += channel.name.str();
+        reply += " :";
+        reply += channel.topic;
         return DataToUser(fd, reply, NO_NUMERIC_REPLY);
     }
     for (int i = 2; i < size; i++) {
         channel.topic += cmd.args[i];
         channel.topic += i < size - 1 ? " " : "";
     }
-    string reply(user.prefix + " "
-                 + cmd.Name()+ " "
-                 + channel.name + " :"
-                 + channel.topic);
+    channel.topic_set_at = Clock::current().now();
+    string &reply = startMessage(user, "TOPIC");
+    reply += channel.name.str();
+    reply += " :";
+    reply += channel.topic;
     DataToUser(fd, reply, NO_NUMERIC_REPLY);
 }
 
@@ -440,16 +469,16 @@ void AIrcCommands::KICK(Command &cmd, int fd) {
     if (!channelExists(cmd.args[1])) {
         return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
     }
-    Channel &channel = channel_map.find(cmd.args[1])->second;
+    Channel &channel = getChannelFromName(cmd.args[1]);
     if (!channel.userIsInChannel(user.nick)) {
-        return sendNotOnChannel(user.real_nick, channel.name, fd);
+        return sendNotOnChannel(user.real_nick, channel.name.str(), fd);
     }
     if (!channel.isUserOperator(user)) {
-        return sendChannelOperatorNeeded(user.real_nick, channel.name, fd);
+        return sendChannelOperatorNeeded(user.real_nick, channel.name.str(), fd);
     }
     string nick = cmd.args[2];
     tools::ToUpperCase(nick);
-    if (!channel.userIsInChannel(nick)) {
+    if (!channel.userIsInChannel(Atom::lookup(nick))) {
         string reply = ERR_USERNOTINCHANNEL
                        + user.real_nick + " "
                        + cmd.args[2] + " "
@@ -459,8 +488,8 @@ void AIrcCommands::KICK(Command &cmd, int fd) {
     }
     User& user_to_kick = getUserFromNick(nick);
     sendKickMessage(fd, user, channel, user_to_kick.real_nick);
-    channel.deleteUser(user_to_kick);
-    user_to_kick.ch_name_mask_map.erase(channel.name);
+    deleteChannelMember(channel, user_to_kick);
+    user_to_kick.leaveChannel(channel.name);
     maybeRemoveChannel(channel);
 }
 
@@ -487,19 +516,19 @@ void AIrcCommands::INVITE(Command &cmd, int fd) {
     if (!channelExists(cmd.args[2])) {
         return sendNoSuchChannel(user.real_nick, cmd.args[2], fd);
     }
-    Channel &channel = channel_map.find(cmd.args[2])->second;
+    Channel &channel = getChannelFromName(cmd.args[2]);
     if (!channel.userIsInChannel(user.nick)) {
-        return sendNotOnChannel(user.real_nick, channel.name, fd);
+        return sendNotOnChannel(user.real_nick, channel.name.str(), fd);
     }
     if (!channel.isUserOperator(user)) {
-        return sendChannelOperatorNeeded(user.real_nick, channel.name, fd);
+        return sendChannelOperatorNeeded(user.real_nick, channel.name.str(), fd);
     }
     string nick = cmd.args[1];
     tools::ToUpperCase(nick);
-    if (!nick_fd_map.count(nick)) {
+    if (!nickExists(nick)) {
         return sendNoSuchNick(fd, user.real_nick, cmd.args[1]);
     }
-    if (channel.userIsInChannel(nick)) {
+    if (channel.userIsInChannel(Atom::lookup(nick))) {
         string reply = ERR_USERONCHANNEL
                        + user.real_nick + " "
                        + cmd.args[1] + " "
@@ -507,10 +536,11 @@ void AIrcCommands::INVITE(Command &cmd, int fd) {
                        + STR_USERONCHANNEL;
         return DataToUser(fd, reply, NUMERIC_REPLY);
     }
-    channel.addToWhitelist(nick);
-    string invite_msg = ":" + user.prefix + " INVITE "
-                         + cmd.args[1] + " :"
-                         + channel.name;
+    channel.addToWhitelist(Atom(nick));
+    string &invite_msg = startMessage(user, "INVITE");
+    invite_msg += cmd.args[1];
+    invite_msg += " :";
+    invite_msg += channel.name.str();
     DataToUser(getUserFromNick(nick).fd, invite_msg, NO_NUMERIC_REPLY);
     string invite_rpl = RPL_INVITING
                         + user.real_nick + " "
@@ -543,15 +573,15 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
     if (!channelExists(cmd.args[1])) {
         return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
     }
-    Channel &channel = channel_map.find(cmd.args[1])->second;
+    Channel &channel = getChannelFromName(cmd.args[1]);
     if (!channel.userIsInChannel(user.nick)) {
-        return sendNotOnChannel(user.real_nick, channel.name, fd);
+        return sendNotOnChannel(user.real_nick, channel.name.str(), fd);
     }
     if (size == 2) {
         return sendChannelModes(fd, user.real_nick, channel);
     }
     if (!channel.isUserOperator(user)) {
-        return sendChannelOperatorNeeded(user.real_nick, channel.name, fd);
+        return sendChannelOperatorNeeded(user.real_nick, channel.name.str(), fd);
     }
     string mode = cmd.args[2];
     if (tools::anyRepeatedChar(mode)
@@ -567,7 +597,7 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
     checkModeToAddOrDelete(cmd, channel, user, 'm', CH_MOD);
     if (tools::charIsInString(mode, 'k')) {
         if (size < 4) {
-            return sendParamNeeded(user.real_nick, channel.name, " k *",
+            return sendParamNeeded(user.real_nick, channel.name.str(), " k *",
                                     "key mode. Syntax <key>", fd);
         }
         if (tools::charIsInString(mode, '-')
@@ -584,15 +614,15 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
     }
     if (tools::charIsInString(mode, 'o')) {
         if (size < 4) {
-            return sendParamNeeded(user.real_nick, channel.name, " o *",
+            return sendParamNeeded(user.real_nick, channel.name.str(), " o *",
                                     "op mode. Syntax: <nick>", fd);
         }
         string nick = cmd.args[3];
         tools::ToUpperCase(nick);
-        if (!nick_fd_map.count(nick)) {
+        if (!nickExists(nick)) {
             return sendNoSuchNick(fd, user.real_nick, cmd.args[3]);
         }
-        if (channel.userIsInChannel(nick)) {
+        if (channel.userIsInChannel(Atom::lookup(nick))) {
             checkOpMode(cmd, nick, user, channel, fd);
         }
     }
@@ -602,28 +632,18 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
                 return sendBlackListReply(fd, user, channel);
             }
             if (size == 4) {
-                string ban_nick = ft_isdigit(cmd.args[3][0])
-                                  ? "*"
-                                  : cmd.args[3];
-                string ip = (ft_isdigit(cmd.args[3][0])
-                             || cmd.args[3].find('@') != string::npos)
-                             ? cmd.args[3]
-                             : "*";
+                string ban_mask = BanList::normalizeMask(cmd.args[3]);
                 if (!channel.banModeOn()) {
                     channel.addMode(CH_BAN);
                 }
-                // check if already banned
-                if (!channel.userInBlackList(ban_nick, ip)) {
-                    string ban_mask = (ban_nick.find("@") == string::npos)
-                                       ? ban_nick + "!*@" + ip
-                                       : ban_nick;
-                    channel.banUser(ban_mask, user.fd);
-                    string mode_rpl = ":" + user.prefix
-                                      + " MODE "
-                                      + cmd.args[1] + " +b "
-                                      + cmd.args[3];
-                    return sendMessageToChannel(channel, mode_rpl,
-                                                user.real_nick);
+                // false if already banned
+                if (channel.banUser(ban_mask, user.fd)) {
+                    string &mode_rpl = startMessage(user, "MODE");
+                    mode_rpl += cmd.args[1];
+                    mode_rpl += " +b ";
+                    mode_rpl += cmd.args[3];
+                    /* empty sender : the op also gets the echo */
+                    return sendMessageToChannel(channel, mode_rpl, Atom());
                 }
             }
         }
@@ -631,7 +651,7 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
             && size == 4)
         {
             string user_to_unban = cmd.args[3];
-            if (!channel.unbanUser(user_to_unban)) {
+            if (!channel.unbanUser(BanList::normalizeMask(user_to_unban))) {
                 string ban_rpl = ERR_NOSUCHBAN
                                  + user.real_nick + " "
                                  + channel.name
@@ -639,19 +659,16 @@ void AIrcCommands::MODE(Command &cmd, int fd) {
                                  + user_to_unban;
                 return DataToUser(fd, ban_rpl, NUMERIC_REPLY);
             }
-            if (channel.black_list.empty()) {
-                channel.deleteMode(CH_BAN);
-            }
-            string mode_rpl = ":" + user.prefix
-                              + " MODE "
-                              + cmd.args[1] + " -b "
-                              + user_to_unban;
-            return sendMessageToChannel(channel, mode_rpl, user.real_nick);
+            string &mode_rpl = startMessage(user, "MODE");
+            mode_rpl += cmd.args[1];
+            mode_rpl += " -b ";
+            mode_rpl += user_to_unban;
+            return sendMessageToChannel(channel, mode_rpl, Atom());
         }
     }
     if (tools::charIsInString(mode, 'v')) {
         if (size < 4) {
-            return sendParamNeeded(user.real_nick, channel.name, " v *",
+            return sendParamNeeded(user.real_nick, channel.name.str(), " v *",
                                    "voice mode. Syntax: <nick>", fd);
         }
         string nick = cmd.args[3];
@@ -708,7 +725,7 @@ void AIrcCommands::NAMES(Command &cmd, int fd) {
         if (!channelExists(cmd.args[1])) {
             return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
         }
-        Channel &channel = channel_map.find(cmd.args[1])->second;
+        Channel &channel = getChannelFromName(cmd.args[1]);
         return sendNamesReply(fd, user, channel);
     }
     string names_reply = RPL_ENDOFNAMES
@@ -719,8 +736,9 @@ void AIrcCommands::NAMES(Command &cmd, int fd) {
 
 /**
  * Command: LIST
- * Parameters: [<channel>]
- * Lists channel size & modes
+ * Parameters: [<channel> | <conditions>]
+ * Lists channel size & modes. Instead of a channel, conditions on the
+ * user count, creation and topic time, and name masks (see ListFilter)
  * */
 void AIrcCommands::LIST(Command &cmd, int fd) {
 
@@ -731,14 +749,18 @@ void AIrcCommands::LIST(Command &cmd, int fd) {
         string nick = nickExists(user.nick) ? user.real_nick : "*";
         return sendNotRegistered(nick, cmd.Name(), fd);
     }
+    ListFilter filter;
     if (size == 1) {
-        sendListReply(fd, user, "");
+        sendListReply(fd, user, "", filter);
     }
     if (size == 2) {
         if (!channelExists(cmd.args[1])) {
-            return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
+            if (!filter.parse(cmd.args[1])) {
+                return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
+            }
+            return sendListReply(fd, user, "", filter);
         }
-        sendListReply(fd, user, cmd.args[1]);
+        sendListReply(fd, user, cmd.args[1], filter);
     }
 }
 
@@ -760,22 +782,21 @@ void AIrcCommands::PRIVMSG(Command &cmd, int fd) {
         return sendNeedMoreParams(user.real_nick, cmd.Name(), fd);
     }
     string name = cmd.args[1];
-    string message = cmd.args[2][0] == ':'
-                     ? cmd.args[2].substr(1)
-                     : cmd.args[2];
+    /* the text is appended from args[2] itself, past the ':' */
+    size_t text = cmd.args[2][0] == ':' ? 1 : 0;
     if (!tools::starts_with_mask(name) && size == 3) {
         tools::ToUpperCase(name);
-        if (!nick_fd_map.count(name)) {
+        if (!nickExists(name)) {
             return sendNoSuchNick(fd, user.real_nick, cmd.args[1]);
         }
         User &receiver = getUserFromNick(name);
         if (!receiver.isResgistered()) {
             return sendNoSuchNick(fd, user.real_nick, cmd.args[1]);
         }
-        string reply = ":" + user.prefix
-                        + " PRIVMSG "
-                        + cmd.args[1] + " :"
-                        + message;
+        string &reply = startMessage(user, "PRIVMSG");
+        reply += cmd.args[1];
+        reply += " :";
+        reply.append(cmd.args[2], text, string::npos);
         return DataToUser(receiver.fd, reply, NO_NUMERIC_REPLY);
     }
     if (tools::starts_with_mask(name)
@@ -784,7 +805,7 @@ void AIrcCommands::PRIVMSG(Command &cmd, int fd) {
         if (!channelExists(cmd.args[1])) {
             return sendNoSuchChannel(user.real_nick, cmd.args[1], fd);
         }
-        Channel &channel = channel_map.find(name)->second;
+        Channel &channel = getChannelFromName(name);
         if (!channel.userIsInChannel(user.nick)) {
             string reply = ERR_CANNOTSENDTOCHAN
                            + user.real_nick + " "
@@ -794,8 +815,7 @@ void AIrcCommands::PRIVMSG(Command &cmd, int fd) {
             return DataToUser(fd, reply, NUMERIC_REPLY);
         }
         if (channel.banModeOn()
-            && (channel.userInBlackList(user.real_nick, user.ip_address)
-                || channel.all_banned)
+            && channel.userInBlackList(user)
             && !channel.isUserOperator(user))
         {
             string reply = ERR_CANNOTSENDTOCHAN
@@ -806,8 +826,8 @@ void AIrcCommands::PRIVMSG(Command &cmd, int fd) {
             return DataToUser(fd, reply, NUMERIC_REPLY);
         }
         if (channel.moderatedModeOn()
-            && !user.isChannelOperator(name)
-            && !user.isChannelModerator(name))
+            && !user.isChannelOperator(channel.name)
+            && !user.isChannelModerator(channel.name))
         {
             string reply = ERR_CANNOTSENDTOCHAN
                            + user.real_nick + " "
@@ -816,10 +836,10 @@ void AIrcCommands::PRIVMSG(Command &cmd, int fd) {
                            + "the +m (moderated) mode is set";
             return DataToUser(fd, reply, NUMERIC_REPLY);
         }
-        string reply = ":" + user.prefix
-                        + " PRIVMSG "
-                        + channel.name + " :"
-                        + message;
+        string &reply = startMessage(user, "PRIVMSG");
+        reply += channel.name.str();
+        reply += " :";
+        reply.append(cmd.args[2], text, string::npos);
         sendMessageToChannel(channel, reply, user.nick);
     }
 }
@@ -849,5 +869,68 @@ void AIrcCommands::WHOIS(Command &cmd, int fd) {
     sendWhoisReply(cmd, fd, user, nick);
 }
 
+/**
+ * Command: OPER
+ * Parameters: <name> <password>
+ */
+void AIrcCommands::OPER(Command &cmd, int fd) {
+
+    User &user = getUserFromFd(fd);
+    int size = cmd.args.size();
+
+    if (!user.isResgistered()) {
+        string nick = nickExists(user.nick) ? user.real_nick : "*";
+        return sendNotRegistered(nick, cmd.Name(), fd);
+    }
+    if (size < 3) {
+        return sendNeedMoreParams(user.real_nick, cmd.Name(), fd);
+    }
+    OperMap::iterator it = opers.find(cmd.args[1]);
+    if (it == opers.end() || it->second != cmd.args[2]) {
+        LOG(WARNING) << "Failed OPER as [" << cmd.args[1] << "] from "
+                     << user;
+        return sendPasswordMismatch(user.real_nick, fd);
+    }
+    user.addServerMask(OP);
+    LOG(INFO) << "User " << user << " is now operator " << it->first;
+    string reply = RPL_YOUREOPER
+                   + user.real_nick
+                   + STR_YOUREOPER;
+    DataToUser(fd, reply, NUMERIC_REPLY);
+}
+
+/**
+ * Command: STATS
+ * Parameters: <query>
+ * Operators only. Queries (see Server::sendStatsReport) :
+ * m commands, u uptime / loop lag, l connections, z memory,
+ * t top channels by traffic.
+ */
+void AIrcCommands::STATS(Command &cmd, int fd) {
+
+    User &user = getUserFromFd(fd);
+    int size = cmd.args.size();
+
+    if (!user.isResgistered()) {
+        string nick = nickExists(user.nick) ? user.real_nick : "*";
+        return sendNotRegistered(nick, cmd.Name(), fd);
+    }
+    if (size < 2 || cmd.args[1].empty()) {
+        return sendNeedMoreParams(user.real_nick, cmd.Name(), fd);
+    }
+    if (!user.isOperator()) {
+        string reply = ERR_NOPRIVILEGES
+                       + user.real_nick
+                       + STR_NOPRIVILEGES;
+        return DataToUser(fd, reply, NUMERIC_REPLY);
+    }
+    sendStatsReport(user, cmd.args[1][0], fd);
+    string end_rpl = RPL_ENDOFSTATS
+                     + user.real_nick + " "
+                     + cmd.args[1][0]
+                     + STR_ENDOFSTATS;
+    DataToUser(fd, end_rpl, NUMERIC_REPLY);
+}
+
 
 } // namespace irc
@@ -0,0 +1,164 @@
+#include "Server/Server.hpp"
+#include "Channel.hpp"
+#include "User.hpp"
+#include "Log.hpp"
+#include "AllocProfile.hpp"
+
+#include <unistd.h>
+#include <sstream>
+
+using std::string;
+
+/*
+ * Admin port : a loopback only listener served by the same poll loop as
+ * the IRC clients. It speaks just enough HTTP/1.0 for a Prometheus
+ * scraper (or curl) :
+ *
+ *   GET /metrics  -> 200, Metrics::global().render()
+ *   anything else -> 404
+ *
+ * One request per connection, the server closes once the response is
+ * sent. Requests bigger than ADMIN_MAX_REQUEST are dropped.
+ */
+
+typedef enum {
+    ADMIN_MAX_REQUEST = 4096
+} ADMIN_CONFIG;
+
+namespace irc {
+
+static Metrics::Gauge &clients = Metrics::global().gauge(
+    "ircserv_clients", "Connected clients, registered or not");
+static Metrics::Gauge &channels = Metrics::global().gauge(
+    "ircserv_channels", "Existing channels");
+static Metrics::Gauge &atoms = Metrics::global().gauge(
+    "ircserv_atoms", "Interned nicks, channel names and masks");
+static Metrics::Gauge &run_queue_len = Metrics::global().gauge(
+    "ircserv_run_queue_length", "Users waiting for their turn");
+static Metrics::Gauge &sendq_bytes = Metrics::global().gauge(
+    "ircserv_sendq_bytes", "Bytes queued for clients, not written yet");
+static Metrics::Gauge &sources_tracked = Metrics::global().gauge(
+    "ircserv_sources_tracked", "Source addresses with connection accounting");
+
+void Server::acceptAdmin(void) {
+    int fd = acceptAdminConnection();
+    if (fd != -1) {
+        admin_conns[fd] = AdminConn();
+    }
+}
+
+void Server::closeAdmin(int fd) {
+    admin_conns.erase(fd);
+    closeConnection(fd);
+}
+
+void Server::serveAdmin(int fd_idx) {
+    int fd = getFdFromIndex(fd_idx);
+    AdminConn &conn = admin_conns[fd];
+
+    if (hasDataToRead(fd_idx)) {
+        char buff[BUFF_MAX_SIZE];
+        ssize_t len = transport->recv(fd, buff, sizeof(buff));
+        if (len <= 0) {
+            return closeAdmin(fd);
+        }
+        conn.request.append(buff, len);
+        if (conn.request.size() > ADMIN_MAX_REQUEST) {
+            return closeAdmin(fd);
+        }
+        /* headers are not needed, only to know the request is over */
+        if (conn.request.find("\r\n\r\n") == string::npos
+            && conn.request.find("\n\n") == string::npos)
+        {
+            return ;
+        }
+        conn.response = adminResponse(conn.request);
+        setPollEvents(fd, POLLOUT);
+        return ;
+    }
+    if (hasRoomToWrite(fd_idx)) {
+        ssize_t sent = transport->send(fd, conn.response.c_str(),
+                                       conn.response.size());
+        if (sent <= 0) {
+            return closeAdmin(fd);
+        }
+        conn.response.erase(0, sent);
+        if (conn.response.empty()) {
+            closeAdmin(fd);
+        }
+        return ;
+    }
+    if (fds[fd_idx].revents & (POLLERR | POLLHUP)) {
+        closeAdmin(fd);
+    }
+}
+
+string Server::adminResponse(const string &request) {
+    string line = request.substr(0, request.find_first_of("\r\n"));
+    string status = "404 Not Found";
+    string content_type = "text/plain";
+    string body = "not found\n";
+
+    if (line.compare(0, 13, "GET /metrics ") == 0
+        || line == "GET /metrics")
+    {
+        updateGauges();
+        status = "200 OK";
+        content_type = "text/plain; version=0.0.4";
+        body = Metrics::global().render();
+    } else {
+        LOG(WARNING) << "admin port : bad request [" << line << "]";
+    }
+    std::ostringstream out;
+    out << "HTTP/1.0 " << status << "\r\n"
+        << "Content-Type: " << content_type << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n"
+        << "\r\n"
+        << body;
+    return out.str();
+}
+
+/* ALLOC_PROFILE builds : the counters live in AllocProfile, copied at
+ * scrape time. Registered only then, other builds don't show them. */
+static void updateAllocMetrics(void) {
+    Metrics &metrics = Metrics::global();
+    for (int i = 0; i < ALLOC_TAGS; i++) {
+        ALLOC_TAG tag = static_cast<ALLOC_TAG>(i);
+        const AllocProfile::Counters &counters = AllocProfile::counters(tag);
+        string label = Metrics::label("subsystem", AllocProfile::name(tag));
+        metrics.counter("ircserv_allocations_total",
+                        "Allocations, by subsystem", label).value
+            = counters.allocs;
+        metrics.counter("ircserv_allocated_bytes_total",
+                        "Bytes allocated, by subsystem", label).value
+            = counters.bytes;
+        metrics.gauge("ircserv_live_allocations",
+                      "Allocations not freed yet, by subsystem that made them",
+                      label).set(counters.live);
+        metrics.gauge("ircserv_live_allocated_bytes",
+                      "Bytes not freed yet, by subsystem that allocated them",
+                      label).set(counters.live_bytes);
+    }
+}
+
+/* Gauges that are just the size of something are read at scrape time */
+void Server::updateGauges(void) {
+    clients.set(fd_user_map.size());
+    channels.set(channel_map.size());
+    atoms.set(Atom::tableSize());
+    run_queue_len.set(run_queue.size());
+    sources_tracked.set(sources.size());
+    long queued = 0;
+    for (FdUserMap::iterator it = fd_user_map.begin();
+         it != fd_user_map.end(); it++)
+    {
+        queued += it->second.send_queue.size();
+    }
+    sendq_bytes.set(queued);
+    if (AllocProfile::enabled()) {
+        updateAllocMetrics();
+    }
+}
+
+} // namespace
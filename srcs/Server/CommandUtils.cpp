@@ -4,22 +4,30 @@
 #include "User.hpp"
 #include "Command.hpp"
 #include "Tools.hpp"
+#include "Metrics.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 using std::string;
 
 namespace irc {
 
+static Metrics::Counter &disconnects = Metrics::global().counter(
+    "ircserv_disconnects_total", "Users removed from the server, any reason");
+
 void AIrcCommands::createNewChannel(const Command &cmd, int size,
                                     User &user, int fd)
 {
-    Channel channel(cmd.args[1], user);
+    Channel &channel = addNewChannel(Atom(cmd.args[1]), user);
     user.ch_name_mask_map.insert(
-            std::pair<string, unsigned char>(channel.name, 0x80));
+            std::pair<Atom, unsigned char>(channel.name, 0x80));
     if (size >= 3) {
         channel.key = cmd.args[2];
         channel.addMode(CH_PAS);
     }
-    addNewChannel(channel);
     sendJoinReply(fd, user, channel, false);
 }
 
@@ -27,45 +35,54 @@ void AIrcCommands::sendWhoisReply(const Command &cmd, int fd,
                                   User &user, string &nick)
 {
     User &whois = getUserFromNick(nick);
-    string info_rpl = RPL_WHOISUSER
-                           + user.real_nick + " "
-                           + whois.real_nick + " "
-                           + whois.name + " "
-                           + whois.ip_address
-                           + STR_WHOISUSER
-                           + whois.full_name;
-    DataToUser(fd, info_rpl, NUMERIC_REPLY);
+    string &info_rpl = startNumeric(fd, RPL_WHOISUSER, user.real_nick);
+    info_rpl += ' ';
+    info_rpl += whois.real_nick;
+    info_rpl += ' ';
+    info_rpl += whois.name;
+    info_rpl += ' ';
+    info_rpl += whois.ip_address;
+    info_rpl += STR_WHOISUSER;
+    info_rpl += whois.full_name;
+    endNumeric();
     if (!whois.ch_name_mask_map.empty()) {
-        string channel_rpl = constructWhoisChannelRpl(whois, user.real_nick);
-        DataToUser(fd, channel_rpl, NUMERIC_REPLY);
+        string &head = out;
+        head.assign(user.real_nick);
+        head += ' ';
+        head += whois.real_nick;
+        head += " :";
+        sendSplitReply(fd, RPL_WHOISCHANNELS, head,
+                       constructWhoisChannels(whois));
     }
-    string mid_rpl = RPL_WHOISSERVER
-                     + user.real_nick + " "
-                     + whois.real_nick + " "
-                     + hostname
-                     + " :WhatsApp 2";
-    DataToUser(fd, mid_rpl, NUMERIC_REPLY);
-    string end_rpl = RPL_ENDOFWHOIS
-                     + user.real_nick + " "
-                     + cmd.args[1]
-                     + STR_ENDOFWHOIS;
-    DataToUser(fd, end_rpl, NUMERIC_REPLY);
+    string &mid_rpl = startNumeric(fd, RPL_WHOISSERVER, user.real_nick);
+    mid_rpl += ' ';
+    mid_rpl += whois.real_nick;
+    mid_rpl += ' ';
+    mid_rpl += hostname;
+    mid_rpl += " :WhatsApp 2";
+    endNumeric();
+    string &end_rpl = startNumeric(fd, RPL_ENDOFWHOIS, user.real_nick);
+    end_rpl += ' ';
+    end_rpl += cmd.args[1];
+    end_rpl += STR_ENDOFWHOIS;
+    endNumeric();
 }
 
 void AIrcCommands::joinExistingChannel(int fd, User &user,
                                        Channel &channel)
 {
-    channel.addUser(user);
+    addChannelMember(channel, user);
     user.ch_name_mask_map.insert(
-        std::pair<string, unsigned char>(channel.name, 0x00));
+        std::pair<Atom, unsigned char>(channel.name, 0x00));
     if (channel.topicModeOn()
         && !channel.topic.empty())
     {
-        string reply = RPL_TOPIC
-                       + user.nick + " "
-                       + channel.name + " :"
-                       + channel.topic;
-        DataToUser(fd, reply, NUMERIC_REPLY);
+        string &reply = startNumeric(fd, RPL_TOPIC, user.nick.str());
+        reply += ' ';
+        reply += channel.name.str();
+        reply += " :";
+        reply += channel.topic;
+        endNumeric();
     }
     sendJoinReply(fd, user, channel, true);
 }
@@ -74,22 +91,28 @@ void AIrcCommands::sendBlackListReply(int fd, const User &user,
                                       Channel &channel)
 {
     if (!channel.black_list.empty()) {
-        for (std::map<string, int>::iterator it = channel.black_list.begin();
-             it != channel.black_list.end(); it++)
+        const BanList::MaskSetterMap &bans = channel.black_list.entries();
+        for (BanList::MaskSetterMap::const_iterator it = bans.begin();
+             it != bans.end(); it++)
         {
-            string blacklist_rpl = RPL_BANLIST
-                                   + user.real_nick + " "
-                                   + channel.name + " "
-                                   + it->first + " "
-                                   + getUserFromFd(it->second).real_nick;
-            DataToUser(fd, blacklist_rpl, NUMERIC_REPLY);
+            const string &setter = getUserFromFd(it->second).real_nick;
+            string &blacklist_rpl = startNumeric(fd, RPL_BANLIST,
+                                                 user.real_nick);
+            blacklist_rpl += ' ';
+            blacklist_rpl += channel.name.str();
+            blacklist_rpl += ' ';
+            blacklist_rpl += it->first.str();
+            blacklist_rpl += ' ';
+            blacklist_rpl += setter;
+            endNumeric();
         }
     }
-    string blacklist_end_rpl = RPL_ENDOFBANLIST
-                               + user.real_nick + " "
-                               + channel.name
-                               + STR_ENDOFBANLIST;
-    return DataToUser(fd, blacklist_end_rpl, NUMERIC_REPLY);
+    string &blacklist_end_rpl = startNumeric(fd, RPL_ENDOFBANLIST,
+                                             user.real_nick);
+    blacklist_end_rpl += ' ';
+    blacklist_end_rpl += channel.name.str();
+    blacklist_end_rpl += STR_ENDOFBANLIST;
+    endNumeric();
 }
 
 string AIrcCommands::checkAndGetVoiceRpl(const Command &cmd, const User &user,
@@ -99,16 +122,18 @@ string AIrcCommands::checkAndGetVoiceRpl(const Command &cmd, const User &user,
     string mode_rpl;
     if (tools::charIsInString(mode, '+')) {
         other.addChannelMask(channel.name, CH_MOD);
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
+        channel.invalidateNamesCache();
+        mode_rpl = user.source
+                    + "MODE "
                     + cmd.args[1]
                     + " +v :"
                     + cmd.args[3];
     }
     if (tools::charIsInString(mode, '-')) {
         other.deleteChannelMask(channel.name, CH_MOD);
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
+        channel.invalidateNamesCache();
+        mode_rpl = user.source
+                    + "MODE "
                     + cmd.args[1]
                     + " -v :"
                     + cmd.args[3];
@@ -119,26 +144,24 @@ string AIrcCommands::checkAndGetVoiceRpl(const Command &cmd, const User &user,
 void AIrcCommands::checkModeToAddOrDelete(const Command &cmd, Channel &channel,
                                           User &user, char m, int mode)
 {
-    string mode_rpl;
-
     if (!tools::charIsInString(cmd.args[2], m)) {
         return ;
     }
+    char sign;
     if (tools::charIsInString(cmd.args[2], '+')) {
         channel.addMode(mode);
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
-                    + cmd.args[1]
-                    + " :+"
-                    + m;
+        sign = '+';
     } else if (tools::charIsInString(cmd.args[2], '-')) {
         channel.deleteMode(mode);
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
-                    + cmd.args[1]
-                    + " :-"
-                    + m;
+        sign = '-';
+    } else {
+        return ;
     }
+    string &mode_rpl = startMessage(user, "MODE");
+    mode_rpl += cmd.args[1];
+    mode_rpl += " :";
+    mode_rpl += sign;
+    mode_rpl += m;
     sendMessageToChannel(channel, mode_rpl, user.nick);
     return DataToUser(user.fd, mode_rpl, NO_NUMERIC_REPLY);
 }
@@ -146,58 +169,57 @@ void AIrcCommands::checkModeToAddOrDelete(const Command &cmd, Channel &channel,
 void AIrcCommands::checkKeyMode(const irc::Command &cmd, irc::Channel &channel,
                                 User &user)
 {
-    string mode_rpl;
     string key = cmd.args[3][0] == ':'
                  ? cmd.args[3].substr(1)
                  : cmd.args[3];
+    const char *change;
     if (tools::charIsInString(cmd.args[2], '+')) {
         if (!channel.key.empty()) {
             return ;
         }
         channel.addMode(CH_PAS);
         channel.key = key;
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
-                    + channel.name
-                    + " +k :"
-                    + key;
+        change = " +k :";
     } else if (tools::charIsInString(cmd.args[2],'-')) {
         if (channel.key.empty()) {
             return ;
         }
         channel.deleteMode(CH_PAS);
         channel.key = "";
-        mode_rpl = ":" + user.prefix
-                    + " MODE "
-                    + channel.name
-                    + " -k :"
-                    + key;
+        change = " -k :";
+    } else {
+        return ;
     }
+    string &mode_rpl = startMessage(user, "MODE");
+    mode_rpl += channel.name.str();
+    mode_rpl += change;
+    mode_rpl += key;
     sendMessageToChannel(channel, mode_rpl, user.nick);
     return DataToUser(user.fd, mode_rpl, NO_NUMERIC_REPLY);
 }
 
-void AIrcCommands::checkOpMode(const irc::Command &cmd, string nick,
+void AIrcCommands::checkOpMode(const irc::Command &cmd, const string &nick,
                                User &user, irc::Channel &channel,
                                int fd)
 {
     User &other = getUserFromNick(nick);
     string op_rpl;
     if (tools::charIsInString(cmd.args[2], '+')) {
-        if (!nick.compare(user.nick)) {
+        if (!user.nick.compare(nick)) {
             return ;
         }
         other.addChannelMask(channel.name, OP);
+        channel.invalidateNamesCache();
         op_rpl = " +o :";
     } else if (tools::charIsInString(cmd.args[2],'-')) {
         other.deleteChannelMask(channel.name, OP);
+        channel.invalidateNamesCache();
         op_rpl = " -o :";
     }
-    string mode_rpl = ":" + user.prefix
-                       + " MODE "
-                       + cmd.args[1]
-                       + op_rpl
-                       + cmd.args[3];
+    string &mode_rpl = startMessage(user, "MODE");
+    mode_rpl += cmd.args[1];
+    mode_rpl += op_rpl;
+    mode_rpl += cmd.args[3];
     DataToUser(fd, mode_rpl, NO_NUMERIC_REPLY);
     if (other.fd != fd) {
         DataToUser(other.fd, mode_rpl, NO_NUMERIC_REPLY);
@@ -208,15 +230,14 @@ void AIrcCommands::sendQuitToAllChannels(int fd, string &msg) {
 
     User &user = getUserFromFd(fd);
 
-    for (std::map<string, unsigned char>::iterator
+    string &quit_msg = startMessage(user, "QUIT");
+    quit_msg += ':';
+    quit_msg += msg; //Client Closed connection";
+    for (std::map<Atom, unsigned char>::iterator
                  it = user.ch_name_mask_map.begin();
          it != user.ch_name_mask_map.end(); it++)
     {
-        string ch_name = it->first;
-        Channel &channel = getChannelFromName(ch_name);
-        string quit_msg = ":" + user.prefix
-                          + " QUIT :"
-                          + msg; //Client Closed connection";
+        Channel &channel = getChannelFromName(it->first);
         sendMessageToChannel(channel, quit_msg, user.nick);
     }
 }
@@ -240,12 +261,54 @@ void AIrcCommands::sendClosingLink(int fd, string &reason) {
 }
 
 void AIrcCommands::removeUserFromServer(int fd, string &reason) {
+    disconnects.inc();
+    /* the fd may be reused before listLoop comes to it, and a LIST of
+     * the new user would then be queued twice */
+    if (getUserFromFd(fd).listing) {
+        list_queue.erase(std::remove(list_queue.begin(), list_queue.end(),
+                                     fd), list_queue.end());
+    }
     sendQuitToAllChannels(fd, reason);
     removeUserFromChannels(fd);
     sendClosingLink(fd, reason);
+    flushSendQueue(fd);
     removeUser(fd);
     return closeConnection(fd);
 }
 
+/*
+ * Operator file : "<name> <password>" per line, '#' comments.
+ * Like Z-lines, the table is only replaced if the file could be read.
+ * Returns the number of operators loaded, -1 if the file can't be opened.
+ */
+int AIrcCommands::loadOpers(const string &path) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        return -1;
+    }
+    OperMap table;
+    string line;
+    int line_nb = 0;
+    while (std::getline(file, line)) {
+        line_nb++;
+        if (line.empty() || line[0] == '#') {
+            continue ;
+        }
+        std::istringstream fields(line);
+        string name;
+        string pass;
+        string extra;
+        if (!(fields >> name >> pass) || (fields >> extra)) {
+            LOG(WARNING) << path << ":" << line_nb
+                         << " expected <name> <password>";
+            continue ;
+        }
+        table[name] = pass;
+    }
+    opers = table;
+    LOG(INFO) << "Loaded " << opers.size() << " operators from " << path;
+    return opers.size();
+}
+
 }
 
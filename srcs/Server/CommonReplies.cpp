@@ -3,117 +3,114 @@
 #include "Channel.hpp"
 #include "User.hpp"
 #include "libft.h"
-#include "Exceptions.hpp"
+#include "Metrics.hpp"
+#include "Clock.hpp"
+#include "Tools.hpp"
 
 using std::string;
 
 namespace irc {
 
+static Metrics::Histogram &fanout = Metrics::global().histogram(
+    "ircserv_channel_fanout", "Recipients of each message sent to a channel",
+    1, 16);
+
 void AIrcCommands::sendNeedMoreParams(string &nick, string& cmd_name, int fd) {
-    string reply = ERR_NEEDMOREPARAMS
-                   + nick + " "
-                   + cmd_name
-                   + STR_NEEDMOREPARAMS;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_NEEDMOREPARAMS, nick);
+    reply += ' ';
+    reply += cmd_name;
+    reply += STR_NEEDMOREPARAMS;
+    endNumeric();
 }
 
-void AIrcCommands::sendParamNeeded(string &nick, string &ch_name,
-                                   string mode, string mode_msg, int fd)
+void AIrcCommands::sendParamNeeded(string &nick, const string &ch_name,
+                                   const char *mode, const char *mode_msg,
+                                   int fd)
 {
-    string reply = ERR_KEYNEEDED
-                   + nick + " "
-                   + ch_name    
-                   + mode
-                   + STR_KEYNEEDED
-                   + mode_msg;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_KEYNEEDED, nick);
+    reply += ' ';
+    reply += ch_name;
+    reply += mode;
+    reply += STR_KEYNEEDED;
+    reply += mode_msg;
+    endNumeric();
 }
 
 void AIrcCommands::sendNotRegistered(string &nick, string &cmd_name, int fd) {
-    string reply = ERR_NOTREGISTERED
-                    + nick + " "
-                    + cmd_name
-                    + STR_NOTREGISTERED;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_NOTREGISTERED, nick);
+    reply += ' ';
+    reply += cmd_name;
+    reply += STR_NOTREGISTERED;
+    endNumeric();
 }
 
-void AIrcCommands::sendNoSuchChannel(string &nick, string &ch_name, int fd) {
-    string reply = ERR_NOSUCHCHANNEL
-                   + nick + " "
-                   + ch_name
-                   + STR_NOSUCHCHANNEL;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+void AIrcCommands::sendNoSuchChannel(string &nick, const string &ch_name, int fd) {
+    string &reply = startNumeric(fd, ERR_NOSUCHCHANNEL, nick);
+    reply += ' ';
+    reply += ch_name;
+    reply += STR_NOSUCHCHANNEL;
+    endNumeric();
 }
 
-void AIrcCommands::sendNotOnChannel(string &nick, string &ch_name, int fd) {
-    string reply = ERR_NOTONCHANNEL
-                   + nick + " "
-                   + ch_name
-                   + STR_NOTONCHANNEL;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+void AIrcCommands::sendNotOnChannel(string &nick, const string &ch_name, int fd) {
+    string &reply = startNumeric(fd, ERR_NOTONCHANNEL, nick);
+    reply += ' ';
+    reply += ch_name;
+    reply += STR_NOTONCHANNEL;
+    endNumeric();
 }
 
-void AIrcCommands::sendBadChannelMask(string &nick, string &ch_name, int fd) {
-    string reply = ERR_BADCHANMASK
-                   + nick + " "
-                   + ch_name
-                   + STR_BADCHANMASK;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+void AIrcCommands::sendBadChannelMask(string &nick, const string &ch_name, int fd) {
+    string &reply = startNumeric(fd, ERR_BADCHANMASK, nick);
+    reply += ' ';
+    reply += ch_name;
+    reply += STR_BADCHANMASK;
+    endNumeric();
 }
 
 void AIrcCommands::sendNoChannelModes(string &cmd_name, int fd) {
-    string reply = ERR_NOCHANMODES
-                   + cmd_name
-                   + STR_NOCHANMODES;
-    DataToUser(fd, reply, NUMERIC_REPLY);
-}
-
-void AIrcCommands::sendChannelOperatorNeeded(string &nick, string &ch_name, int fd) {
-    string reply = ERR_CHANOPRIVSNEEDED
-                   + nick + " "
-                   + ch_name
-                   + STR_CHANOPRIVSNEEDED;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_NOCHANMODES, cmd_name);
+    reply += STR_NOCHANMODES;
+    endNumeric();
 }
 
-void AIrcCommands::sendWelcome(string& nick, string &prefix, int fd) {
-    string welcome_msg = RPL_WELCOME
-                         + nick
-                         + RPL_WELCOME_STR_1
-                         + prefix;
-    DataToUser(fd, welcome_msg, NUMERIC_REPLY);
+void AIrcCommands::sendChannelOperatorNeeded(string &nick, const string &ch_name, int fd) {
+    string &reply = startNumeric(fd, ERR_CHANOPRIVSNEEDED, nick);
+    reply += ' ';
+    reply += ch_name;
+    reply += STR_CHANOPRIVSNEEDED;
+    endNumeric();
 }
 
 void AIrcCommands::sendAlreadyRegistered(string &nick, int fd) {
-    string reply = ERR_ALREADYREGISTERED
-                   + nick
-                   + STR_ALREADYREGISTERED;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_ALREADYREGISTERED, nick);
+    reply += STR_ALREADYREGISTERED;
+    endNumeric();
 }
 
 void AIrcCommands::sendPasswordMismatch(string &nick, int fd) {
-    string reply = ERR_PASSWDMISMATCH
-                   + nick
-                   + STR_PASSWDMISMATCH;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_PASSWDMISMATCH, nick);
+    reply += STR_PASSWDMISMATCH;
+    endNumeric();
 }
 
-void AIrcCommands::sendNoSuchNick(int fd, string nick,
-                                  string notFoundNick)
+void AIrcCommands::sendNoSuchNick(int fd, const string &nick,
+                                  const string &notFoundNick)
 {
-    string reply = ERR_NOSUCHNICK
-                   + nick + " "
-                   + notFoundNick + " "
-                   + STR_NOSUCHNICK;
-    DataToUser(fd, reply, NUMERIC_REPLY);
+    string &reply = startNumeric(fd, ERR_NOSUCHNICK, nick);
+    reply += ' ';
+    reply += notFoundNick;
+    reply += ' ';
+    reply += STR_NOSUCHNICK;
+    endNumeric();
 }
 
 void AIrcCommands::sendJoinReply(int fd, User &user, Channel &channel,
                                  bool send_all)
 {
-    string join_rpl = ":" + user.prefix
-                       + " JOIN :"
-                       + channel.name;
+    string &join_rpl = startMessage(user, "JOIN");
+    join_rpl += ':';
+    join_rpl += channel.name.str();
     if (send_all) {
         sendMessageToChannel(channel, join_rpl, user.nick);
     }
@@ -123,55 +120,180 @@ void AIrcCommands::sendJoinReply(int fd, User &user, Channel &channel,
 
 void AIrcCommands::sendNamesReply(int fd, User &user, Channel &channel) {
     if (!channel.topic.empty()) {
-        string top_rpl = RPL_TOPIC
-                         + user.real_nick + " "
-                         + channel.name + " :"
-                         + channel.topic;
-        DataToUser(fd, top_rpl, NUMERIC_REPLY);
+        string &top_rpl = startNumeric(fd, RPL_TOPIC, user.real_nick);
+        top_rpl += ' ';
+        top_rpl += channel.name.str();
+        top_rpl += " :";
+        top_rpl += channel.topic;
+        endNumeric();
     }
-    string namesReply = constructNamesReply(user.real_nick, channel);
-    DataToUser(fd, namesReply, NUMERIC_REPLY);
-    namesReply = RPL_ENDOFNAMES
-                 + user.real_nick + " "
-                 + channel.name
-                 + STR_ENDOFNAMES;
-    DataToUser(fd, namesReply, NUMERIC_REPLY);
+    string &names_head = out;
+    names_head.assign(user.real_nick);
+    names_head += " = ";
+    names_head += channel.name.str();
+    names_head += " :";
+    sendSplitReply(fd, RPL_NAMREPLY, names_head, getChannelNames(channel));
+    string &names_end = startNumeric(fd, RPL_ENDOFNAMES, user.real_nick);
+    names_end += ' ';
+    names_end += channel.name.str();
+    names_end += STR_ENDOFNAMES;
+    endNumeric();
 }
 
-void AIrcCommands::sendListReply(int fd, User &user, string ch_name) {
-    string start_rpl = RPL_LISTSTART
-                       + user.real_nick
-                       + STR_LISTSTART;
-    DataToUser(fd, start_rpl, NUMERIC_REPLY);
+/*
+ * LIST of every channel, or of those matching filter, is not written in
+ * one go : continueList sends a batch, and the server's loop resumes it
+ * (Server::listLoop) until the last channel. A LIST over 100k channels
+ * never holds the loop, nor more than a batch worth of the reply in
+ * memory.
+ */
+void AIrcCommands::sendListReply(int fd, User &user, const string &ch_name,
+                                 const ListFilter &filter)
+{
+    string &start_rpl = startNumeric(fd, RPL_LISTSTART, user.real_nick);
+    start_rpl += STR_LISTSTART;
+    endNumeric();
     if (ch_name.compare("")) {
-        Channel &channel = channel_map.find(ch_name)->second;
-        string reply = constructListReply(user.real_nick, channel);
-        DataToUser(fd, reply, NUMERIC_REPLY);
+        sendListLine(fd, user.real_nick, getChannelFromName(ch_name));
     } else if (channel_map.size() > 0) {
-        for (std::map<string, Channel>::iterator it = channel_map.begin();
-             it != channel_map.end(); it++)
+        bool queued = user.listing;
+        user.listing = true;
+        user.list_next = Atom(filter.prefix());
+        user.list_filter = filter;
+        user.list_results = 0;
+        if (!queued && continueList(fd, user)) {
+            list_queue.push_back(fd);
+        }
+        return ;
+    }
+    string &end_reply = startNumeric(fd, RPL_LISTEND, user.real_nick);
+    end_reply += STR_LISTEND;
+    endNumeric();
+}
+
+/*
+ * Up to LIST_LINES_PER_TURN lines of the user's LIST, from list_next
+ * on, while less than LIST_SENDQ_LOW bytes wait to be written, and no
+ * more than LIST_SCAN_PER_TURN channels checked against its filter.
+ * Channels created or gone meanwhile are listed, or not, depending on
+ * where they fall : the cursor is a name, not an iterator. A filtered
+ * LIST stops at LIST_MAX_RESULTS lines. Returns true while there is
+ * more to send.
+ */
+bool AIrcCommands::continueList(int fd, User &user) {
+    const ListFilter &filter = user.list_filter;
+    time_t now = Clock::current().now();
+    int sent = 0;
+    Channel *channel = nextListChannel(user.list_next, false, filter);
+    for (int scanned = 0; channel != NULL && !user.dead; scanned++) {
+        if (sent == LIST_LINES_PER_TURN || scanned == LIST_SCAN_PER_TURN
+            || user.send_queue.size() > LIST_SENDQ_LOW)
         {
-            string reply = constructListReply(user.real_nick, it->second);
-            DataToUser(fd, reply, NUMERIC_REPLY);
+            user.list_next = channel->name;
+            return true;
         }
+        if (filter.matches(*channel, now)) {
+            if (filter.restricts()
+                && user.list_results == LIST_MAX_RESULTS)
+            {
+                string &reply = startNumeric(fd, ERR_TOOMANYMATCHES,
+                                             user.real_nick);
+                reply += " LIST";
+                reply += STR_TOOMANYMATCHES;
+                endNumeric();
+                break ;
+            }
+            sendListLine(fd, user.real_nick, *channel);
+            user.list_results++;
+            sent++;
+        }
+        channel = nextListChannel(channel->name, true, filter);
     }
-    string end_reply = RPL_LISTEND
-                       + user.real_nick
-                       + STR_LISTEND;
-    DataToUser(fd, end_reply, NUMERIC_REPLY);
+    user.listing = false;
+    user.list_next = Atom();
+    string &end_reply = startNumeric(fd, RPL_LISTEND, user.real_nick);
+    end_reply += STR_LISTEND;
+    endNumeric();
+    return false;
+}
+
+/*
+ * The first channel the filter can match at (after == false) or after
+ * from, in name order. Filters on the member count only look in the
+ * buckets of size_buckets they allow, the others walk channel_map ;
+ * both stop past the names starting with the filter's prefix.
+ */
+Channel* AIrcCommands::nextListChannel(const Atom &from, bool after,
+                                       const ListFilter &filter)
+{
+    const Atom *next = NULL;
+    if (!filter.sizeBounded()) {
+        ChannelMap::iterator it = after ? channel_map.upper_bound(from)
+                                        : channel_map.lower_bound(from);
+        if (it != channel_map.end()) {
+            next = &it->first;
+        }
+    } else {
+        int last = filter.lastBucket();
+        for (int b = filter.firstBucket();
+             b <= last && b < (int)size_buckets.size(); b++)
+        {
+            std::set<Atom> &bucket = size_buckets[b];
+            std::set<Atom>::iterator it = after ? bucket.upper_bound(from)
+                                                : bucket.lower_bound(from);
+            if (it != bucket.end() && (next == NULL || *it < *next)) {
+                next = &*it;
+            }
+        }
+    }
+    if (next == NULL || !filter.inNameRange(next->str())) {
+        return NULL;
+    }
+    return &getChannelFromName(*next);
+}
+
+/*
+ * The numeric and head followed by as many of the space separated items
+ * as fit in a line of BUFF_MAX_SIZE bytes, the server prefix and CRLF
+ * included, and again with the rest. Items are never cut (one longer
+ * than a line goes alone).
+ */
+void AIrcCommands::sendSplitReply(int fd, const char *numeric,
+                                  const string &head, const string &items)
+{
+    size_t room = BUFF_MAX_SIZE - server_prefix.size() - 2
+                  - ft_strlen(numeric) - head.size();
+    size_t start = 0;
+    do {
+        size_t end = items.size();
+        if (end - start > room) {
+            end = items.rfind(' ', start + room);
+            if (end == string::npos || end <= start) {
+                end = items.find(' ', start);
+                end = end == string::npos ? items.size() : end;
+            }
+        }
+        string &reply = startNumeric(fd, numeric, head);
+        reply.append(items, start, end - start);
+        endNumeric();
+        start = end + 1;
+    } while (start < items.size());
 }
 
-void AIrcCommands::sendPartMessage(string &extra_msg, int fd, User &user,
-                                   Channel &channel)
+void AIrcCommands::sendPartMessage(const string &extra_msg, int fd,
+                                   User &user, Channel &channel)
 {
-    bool msg = extra_msg.compare("");
-    string part_message = msg 
-                          ? " :\"" + extra_msg.substr(1) + "\""
-                          : "";
-    string part_rpl = ":" + user.prefix
-                      + " PART " + (msg ? "" : ":")
-                      + channel.name
-                      + part_message;
+    bool msg = !extra_msg.empty();
+    string &part_rpl = startMessage(user, "PART");
+    if (msg) {
+        part_rpl += channel.name.str();
+        part_rpl += " :\"";
+        part_rpl.append(extra_msg, 1, string::npos);
+        part_rpl += '"';
+    } else {
+        part_rpl += ':';
+        part_rpl += channel.name.str();
+    }
     sendMessageToChannel(channel, part_rpl, user.nick);
     return (DataToUser(fd, part_rpl, NO_NUMERIC_REPLY));
 }
@@ -179,87 +301,146 @@ void AIrcCommands::sendPartMessage(string &extra_msg, int fd, User &user,
 void AIrcCommands::sendKickMessage(int fd, User &user, Channel &channel,
                                    string &kicked)
 {
-    string kick_rpl = ":" + user.prefix
-                      + " KICK "
-                      + channel.name + " "
-                      + kicked + " :"
-                      + kicked;
+    string &kick_rpl = startMessage(user, "KICK");
+    kick_rpl += channel.name.str();
+    kick_rpl += ' ';
+    kick_rpl += kicked;
+    kick_rpl += " :";
+    kick_rpl += kicked;
     sendMessageToChannel(channel, kick_rpl, user.nick);
     return (DataToUser(fd, kick_rpl, NO_NUMERIC_REPLY));
 }
 
-void AIrcCommands::sendChannelModes(int fd, string nick, Channel &channel) {
-    string mode = channel.getModeStr();
-    string mode_rpl = RPL_CHANNELMODEIS
-                      + nick + " "
-                      + channel.name + " :+"
-                      + mode + "nt";
-    DataToUser(fd, mode_rpl, NUMERIC_REPLY);
+void AIrcCommands::sendChannelModes(int fd, const string &nick,
+                                    Channel &channel)
+{
+    string &mode_rpl = startNumeric(fd, RPL_CHANNELMODEIS, nick);
+    mode_rpl += ' ';
+    mode_rpl += channel.name.str();
+    mode_rpl += " :+";
+    mode_rpl += channel.getModeStr();
+    mode_rpl += "nt";
+    endNumeric();
 }
 
 // PRIVATE METHODS
+
+/*
+ * Starts out with ":nick!user@host COMMAND ", copied from the user's
+ * cached source. The caller appends the parameters and sends it : out
+ * keeps its buffer between messages, so the line is built with no
+ * temporaries and, once it has grown, no allocation.
+ */
+string& AIrcCommands::startMessage(const User &user, const char *command) {
+    out.assign(user.source);
+    out.append(command);
+    out += ' ';
+    return out;
+}
+
+/*
+ * Numeric replies are written where they go, at the end of fd's output :
+ *
+ *   string &reply = startNumeric(fd, ERR_NOSUCHNICK, nick);
+ *   reply += ' ';
+ *   reply += target;
+ *   reply += STR_NOSUCHNICK;
+ *   endNumeric();
+ *
+ * ":server NNN target" comes from the server prefix and the numeric's
+ * literal, the caller appends the parameters, endNumeric adds CRLF and
+ * queues the line : nothing is built aside and copied. Nothing else
+ * may be sent to fd in between.
+ */
+string& AIrcCommands::startNumeric(int fd, const char *numeric,
+                                   const string &target)
+{
+    string &line = outputOf(fd);
+    numeric_fd = fd;
+    numeric_start = line.size();
+    line += server_prefix;
+    line += numeric;
+    line += target;
+    return line;
+}
+
+void AIrcCommands::endNumeric(void) {
+    outputOf(numeric_fd) += CRLF;
+    lineQueued(numeric_fd, numeric_start, 1);
+}
+
 void AIrcCommands::sendMessageToChannel(Channel &channel, string &message,
-                                        string &nick)
+                                        const Atom &nick)
 {
-    for (std::list<string>::iterator it = channel.users.begin();
+    unsigned long receivers = 0;
+    for (std::list<Atom>::iterator it = channel.users.begin();
          it != channel.users.end(); it++)
     {
         if (!nickExists(*it)) {
             continue;
         }
         User &receiver = getUserFromNick(*it);
-        if (receiver.nick.compare(nick)) {
+        if (receiver.nick != nick) {
             DataToUser(receiver.fd, message, NO_NUMERIC_REPLY);
+            receivers++;
         }
     }
+    fanout.observe(receivers);
+    channel.messages++;
+    channel.bytes_out += receivers * (message.size() + 2); // + CRLF
 }
 
-string AIrcCommands::constructNamesReply(string nick, Channel &channel) {
-    unsigned long i = 0;
-    string reply = RPL_NAMREPLY
-                   + nick + " = "
-                   + channel.name + " " + ":";
-    for (std::list<string>::iterator it = channel.users.begin();
-         it != channel.users.end(); it++)
-    {
-        if (!nickExists(*it)) {
-            continue;
+/* The member list comes from the channel's cache, walked (one nick and
+ * one mask lookup per member) only after something invalidated it */
+const string& AIrcCommands::getChannelNames(Channel &channel) {
+    if (!channel.names_cache_valid) {
+        string &names = channel.names_cache;
+        for (std::list<Atom>::iterator it = channel.users.begin();
+             it != channel.users.end(); it++)
+        {
+            NickFdMap::iterator member = nick_fd_map.find(*it);
+            if (member == nick_fd_map.end()) {
+                continue;
+            }
+            User &user = getUserFromFd(member->second);
+            if (!names.empty()) {
+                names += ' ';
+            }
+            if (user.isChannelOperator(channel.name)) {
+                names += '@';
+            } else if (user.isChannelModerator(channel.name)) {
+                names += '+';
+            }
+            names += user.real_nick;
         }
-        User &user = getUserFromNick(*it);
-        string at = user.isChannelModerator(channel.name) ? "+" : "";
-        at = user.isChannelOperator(channel.name) ? "@" : at;
-        reply += at;
-        reply += user.real_nick;
-        reply += (++i < channel.users.size()) ? " " : "";
+        channel.names_cache_valid = true;
     }
-    return reply;
+    return channel.names_cache;
 }
 
-string AIrcCommands::constructListReply(string nick, Channel &channel) {
-    string mode = channel.getModeStr();
-    char* channel_size = ft_itoa((int)channel.users.size());
-    if (!channel_size) {
-        throw irc::exc::MallocError();
+void AIrcCommands::sendListLine(int fd, const string &nick,
+                                Channel &channel)
+{
+    string &reply = startNumeric(fd, RPL_LIST, nick);
+    reply += ' ';
+    reply += channel.name.str();
+    reply += ' ';
+    tools::appendNumber(reply, channel.users.size());
+    reply += " :[+";
+    reply += channel.getModeStr();
+    reply += "nt]";
+    if (channel.topicModeOn()) {
+        reply += ' ';
+        reply += channel.topic;
     }
-    string reply = RPL_LIST
-                   + nick + " "
-                   + channel.name + " "
-                   + string(channel_size) + " :[+"
-                   + mode + "nt]";
-    reply += channel.topicModeOn()
-              ? (" " + channel.topic)
-              : "";
-    free(channel_size);
-    return reply;
+    endNumeric();
 }
 
-string AIrcCommands::constructWhoisChannelRpl(User &user, string &nick) {
-    string rpl = RPL_WHOISCHANNELS
-                 + nick + " "
-                 + user.real_nick + " :";
+string AIrcCommands::constructWhoisChannels(User &user) {
+    string rpl;
     unsigned long i = 0;
     unsigned long size = user.ch_name_mask_map.size();
-    for (std::map<string, unsigned char> ::iterator
+    for (std::map<Atom, unsigned char> ::iterator
          it = user.ch_name_mask_map.begin();
          i < size; i++)
     {
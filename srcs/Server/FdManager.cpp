@@ -1,6 +1,8 @@
 #include "Server/FdManager.hpp"
 #include "Exceptions.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
+#include "Clock.hpp"
 #include "libft.h"
 
 #include <sys/types.h>
@@ -9,77 +11,139 @@
 
 #include <poll.h>
 #include <arpa/inet.h>
-#include <fcntl.h>
 
 #include <unistd.h>
 #include <string.h>
 
 #include <iostream>
+#include <fstream>
 #include <cerrno>
+#include <cstdlib>
 
 using std::string;
 
 typedef enum {
-    LISTENER_BACKLOG = 20,
-    MAX_FDS = 255,
-    POLL_TIMEOUT_MS = 1000
+    MAX_FDS = 255,              // default, see setMaxFds
+    POLL_TIMEOUT_MS = 1000,
+    /* defaults, see loadSourceLimits */
+    MAX_CONNS_PER_SOURCE = 8,   // concurrent connections per IP / v6 /64
+    CONNECT_BURST = 4,          // connect token bucket size
+    CONNECT_REFILL_S = 3,       // one token every CONNECT_REFILL_S seconds
+    SOURCES_TRACKED_PER_FD = 4
 } FD_MANAGER_CONFIG;
 
+/* Precomputed, so a flood of refused connections costs no formatting */
+static const char too_many_conns[] =
+    "ERROR :Closing link: [Too many connections from your host]" CRLF;
+static const char throttled[] =
+    "ERROR :Closing link: [Connecting too fast, throttled]" CRLF;
+
+static irc::Metrics::Counter &accepted = irc::Metrics::global().counter(
+    "ircserv_connections_accepted_total", "Client connections accepted");
+static irc::Metrics::Counter &rejected_zline = irc::Metrics::global().counter(
+    "ircserv_connections_rejected_total", "Client connections refused",
+    irc::Metrics::label("reason", "zline"));
+static irc::Metrics::Counter &rejected_source = irc::Metrics::global().counter(
+    "ircserv_connections_rejected_total", "Client connections refused",
+    irc::Metrics::label("reason", "source_limit"));
+static irc::Metrics::Counter &rejected_full = irc::Metrics::global().counter(
+    "ircserv_connections_rejected_total", "Client connections refused",
+    irc::Metrics::label("reason", "server_full"));
+
 namespace irc {
 
+/* This machine's name, port 6667 */
 FdManager::FdManager(void)
 :
     last_dynalloc_ip_address(0),
-    fds_size(0)
+    transport(&Transport::kernel()),
+    fds_size(0),
+    max_fds(MAX_FDS),
+    max_conns_per_source(MAX_CONNS_PER_SOURCE),
+    connect_burst(CONNECT_BURST),
+    connect_refill_s(CONNECT_REFILL_S),
+    listener(-1),
+    admin_listener(-1)
 {
     ft_memset(last_connection.ip_address, 0, sizeof(last_connection.ip_address));
     last_connection.new_fd = 0;
-    if (setUpAddress() == -1
-        || setUpListener() == -1)
-    {
+    char hostname[96];
+    if (gethostname(hostname, sizeof(hostname)) != 0) {
+        LOG(ERROR) << "gethostname error";
+        throw irc::exc::ServerSetUpError();
+    }
+    if (setUpListener(hostname, "6667") == -1) {
         throw irc::exc::ServerSetUpError();
     }
+    setUpAdminListener();
 }
 
 FdManager::FdManager(string &hostname, string &port)
 :
     last_dynalloc_ip_address(0),
-    fds_size(0)
+    transport(&Transport::kernel()),
+    fds_size(0),
+    max_fds(MAX_FDS),
+    max_conns_per_source(MAX_CONNS_PER_SOURCE),
+    connect_burst(CONNECT_BURST),
+    connect_refill_s(CONNECT_REFILL_S),
+    listener(-1),
+    admin_listener(-1)
 {
     ft_memset(last_connection.ip_address, 0, sizeof(last_connection.ip_address));
     last_connection.new_fd = 0;
-    if (setUpAddress(hostname, port) == -1
-        || setUpListener() == -1)
-    {
+    if (setUpListener(hostname, port) == -1) {
+        throw irc::exc::ServerSetUpError();
+    }
+    setUpAdminListener();
+}
+
+FdManager::FdManager(Transport &transport, string &hostname, string &port)
+:
+    last_dynalloc_ip_address(0),
+    transport(&transport),
+    fds_size(0),
+    max_fds(MAX_FDS),
+    max_conns_per_source(MAX_CONNS_PER_SOURCE),
+    connect_burst(CONNECT_BURST),
+    connect_refill_s(CONNECT_REFILL_S),
+    listener(-1),
+    admin_listener(-1)
+{
+    ft_memset(last_connection.ip_address, 0, sizeof(last_connection.ip_address));
+    last_connection.new_fd = 0;
+    if (setUpListener(hostname, port) == -1) {
         throw irc::exc::ServerSetUpError();
     }
+    setUpAdminListener();
 }
 
 FdManager::FdManager(const FdManager& other)
 :
     last_dynalloc_ip_address(other.last_dynalloc_ip_address),
+    zlines(other.zlines),
+    sources(other.sources),
+    fd_source(other.fd_source),
+    transport(other.transport),
+    fds(other.fds),
     fds_size(other.fds_size),
-    servinfo(other.servinfo),
-    listener(other.listener)
+    max_fds(other.max_fds),
+    max_conns_per_source(other.max_conns_per_source),
+    connect_burst(other.connect_burst),
+    connect_refill_s(other.connect_refill_s),
+    listener(other.listener),
+    admin_listener(other.admin_listener)
 {
     ft_memset(last_connection.ip_address, 0, sizeof(last_connection.ip_address));
     last_connection.new_fd = 0;
-    for (int fd_idx=0; fd_idx < fds_size; fd_idx++) {
-        fds[fd_idx].events = other.fds[fd_idx].events;
-        fds[fd_idx].revents = other.fds[fd_idx].revents;
-        fds[fd_idx].fd = other.fds[fd_idx].fd;
-    }
 }
 
 FdManager::~FdManager(void) {
-    if (servinfo != NULL) {
-        freeaddrinfo(servinfo);
-    }
     for (int fd_idx = 0; fd_idx < fds_size; fd_idx++) {
         if (skipFd(fd_idx)) {
             continue;
         }
-        if (close(fds[fd_idx].fd) == -1) {
+        if (transport->close(fds[fd_idx].fd) == -1) {
             throw irc::exc::FatalError("close -1");
         }
     }
@@ -88,161 +152,64 @@ FdManager::~FdManager(void) {
     }
 }
 
-static int get_addrinfo_from_params(const char* hostname,
-                                    const char *port,
-                                    struct addrinfo *hints,
-                                    struct addrinfo **servinfo)
-{
-    int ret = -1;
-
-    if ((ret = getaddrinfo(hostname, port, hints, servinfo)) != 0) {
-        string error("getaddrinfo error :");
-        LOG(ERROR) << error.append(gai_strerror(ret));
-        return -1;
-    }
-    /* Filter out IPv6 cases (makes me dizzy) */
-    if ((*servinfo)->ai_family == AF_INET6) {
-        LOG(ERROR) << "unsupported IP address length";
-        return -1;
-    }
-    return 0;
-}
-
 /*
- * sets all entries in internal struct addrinfo. This includes
- * hostname, the list of addresses to be used, the IRC port,
- * the transport protocol and the IP protocol.
- * Since this function is
- * essential to the server functionality, shuts down the 
- * program in case of failure.
- * 
- * returns 0 on success, 1 otherwise. 
+ * Listens on host:port (see Transport::listen). hostname gets the
+ * address it bound, the server's name in replies.
+ * returns the listener on success, -1 otherwise.
  */
-int FdManager::setUpAddress(void) {
-    struct addrinfo hints;
-    struct addrinfo *servinfo = NULL;
-    char hostname[96];
-    size_t hostname_len = 96;
-    const char* port = "6667";
-
-    ft_memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET; // Ipv4
-    hints.ai_socktype = SOCK_STREAM; // TCP
-
-    if (gethostname(&hostname[0], hostname_len) != 0) {
-        LOG(ERROR) << "gethostname error";
+int FdManager::setUpListener(const string &host, const string &port) {
+    listener = transport->listen(host, port, hostname);
+    if (listener == -1) {
+        LOG(ERROR) << "could not bind socket to " << host << ":" << port;
         return -1;
     }
-    if (get_addrinfo_from_params(hostname, port, &hints, &servinfo) == -1) {
-        if (servinfo != NULL) {
-            freeaddrinfo(servinfo);
-            return -1;
-        }
-    }
-    if (servinfo == NULL)
-        return -1;
-    /* This struct addrinfo may not be the one that binds, but
-     * thats one more step from here. */
-    this->servinfo = servinfo;
-    return 0;
-}
-
-/*
- * Here ip works as the hostname. It is already null terminated
- * when calling string c_str method.
- */
-int FdManager::setUpAddress(string &hostname, string &port) {
-    struct addrinfo hints;
-    struct addrinfo *servinfo = NULL;
-
-    ft_memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET; // Ipv4
-    hints.ai_socktype = SOCK_STREAM; // TCP
-    if (get_addrinfo_from_params(hostname.c_str(), port.c_str(), &hints,
-                                 &servinfo) == -1)
-    {
-        if (servinfo != NULL) {
-            freeaddrinfo(servinfo);
-            return -1;
-        }
-    }
-    if (servinfo == NULL)
-        return -1;
-    /* This struct addrinfo may not be the one that binds, but
-     * thats one more step from here. */
-    this->servinfo = servinfo;
-    return 0;
+    server_prefix = ":" + hostname;
+    LOG(INFO) << "Server mounted succesfully on " << hostname << ":" << port;
+    return listener;
 }
 
 /*
- * tries to bind a socket to one of the provided addresses in
- * the struct addrinfo list provided by servinfo and then, it 
- * starts listen()ing to it.
- * return 0 on success, -1 otherwise.
+ * Loopback only listener for the metrics endpoint. Not being able to
+ * bind it is not a reason to stop the IRC server : it just goes
+ * without metrics.
  */
-int FdManager::setUpListener(void) {
-
-    int socketfd = -1;
-    /* loop through addresses until bind works */
-    for (struct addrinfo *p = servinfo; p != NULL; p = p->ai_next) {
-        /* open a socket given servinfo */
-        if ((socketfd = socket(p->ai_family,
-                               p->ai_socktype,
-                               p->ai_protocol)) == -1)
-        {
-            socketfd = -1;
-            continue;
-        }
-        int yes = 1;
-	    if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR,
-                   &yes, sizeof(yes)) == -1)
-        {
-            freeaddrinfo(servinfo);
-            LOG(ERROR) << "setsockopt raised -1";
-            return -1;
-        }
-        /* assign port to socket */
-        if (bind(socketfd, p->ai_addr, p->ai_addrlen) == -1) {
-            if (close(socketfd) == -1) {
-                freeaddrinfo(servinfo);
-                return -1;
-            }
-            socketfd = -1;
-            continue;
-        }
-        /* if it gets to this point everything should be fine */
-        servinfo = p;
-        break;
-    }
+int FdManager::setUpAdminListener(void) {
+    string bound;
+    int socketfd = transport->listen(ADMIN_HOST, ADMIN_PORT, bound);
     if (socketfd == -1) {
-        LOG(ERROR) << "could not bind socket to any address";
-        freeaddrinfo(servinfo);
-        return -1;
-    }
-    if (listen(socketfd, LISTENER_BACKLOG) == -1) {
-        LOG(ERROR) << "listen raised -1";
-        freeaddrinfo(servinfo);
+        LOG(WARNING) << "could not listen on " ADMIN_HOST ":" ADMIN_PORT
+                     << ", no metrics endpoint";
         return -1;
     }
-    struct sockaddr_in *sockaddrin = (struct sockaddr_in *)
-                                      (servinfo->ai_addr);
-    hostname = inet_ntoa(sockaddrin->sin_addr);
-    /* debug, might not need it in the end */
-    LOG(INFO) << "Server mounted succesfully on " << hostname << ":6667";
-    listener = socketfd;
+    LOG(INFO) << "Metrics on http://" ADMIN_HOST ":" ADMIN_PORT "/metrics";
+    admin_listener = socketfd;
     return socketfd;
 }
 
 void FdManager::setUpPoll(void) {
-    fds[0].fd = listener;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
-    fds_size++;
+    addPollFd(listener, POLLIN);
+    if (admin_listener != -1) {
+        addPollFd(admin_listener, POLLIN);
+    }
+}
+
+/* Connections (listeners included) polled at most, the rest are
+ * refused. The kernel's own limit (ulimit -n) still applies. */
+void FdManager::setMaxFds(int max) {
+    max_fds = max;
 }
 
-void FdManager::Poll(void) {
-    /* -1 = wait until some event happens */
-    if (poll(fds, fds_size, POLL_TIMEOUT_MS) == -1) {
+/* timeout_ms = 0 when the server still has work queued : just
+ * collect what is ready and go back to it. */
+void FdManager::Poll(int timeout_ms) {
+    if (transport->poll(&fds[0], fds_size, timeout_ms) == -1) {
+        /* a signal (SIGHUP rehash) is not an error : no events */
+        if (errno == EINTR) {
+            for (int fd_idx = 0; fd_idx < fds_size; fd_idx++) {
+                fds[fd_idx].revents = 0;
+            }
+            return ;
+        }
         throw irc::exc::FatalError("poll -1");
     }
 }
@@ -251,6 +218,10 @@ bool FdManager::hasDataToRead(int entry) {
     return (fds[entry].revents & POLLIN) ? true : false;
 }
 
+bool FdManager::hasRoomToWrite(int entry) {
+    return (fds[entry].revents & POLLOUT) ? true : false;
+}
+
 bool FdManager::skipFd(int fd_idx) {
     return (fds[fd_idx].fd == -1);
 }
@@ -264,67 +235,139 @@ int FdManager::getFdFromIndex(int fd_idx) {
  */
 int FdManager::acceptConnection(void) {
     struct sockaddr_storage client;
-    socklen_t addrlen = sizeof(struct sockaddr_storage);
-    int fd_new = -1;
-    /* get new fd from accepted connection */
-    if ((fd_new = accept(fds[0].fd, (struct sockaddr *)&client,
-                         &addrlen)) == -1)
-    {
+    /* get new fd from accepted connection, already non blocking */
+    int fd_new = transport->accept(fds[0].fd, &client);
+    if (fd_new == -1) {
+        /* the client gave up before we got to it */
+        if (errno == EAGAIN || errno == EWOULDBLOCK
+            || errno == ECONNABORTED)
+        {
+            return -1;
+        }
         throw irc::exc::FatalError("accept -1");
     }
-    /* set to non blocking fd */
-    if (fcntl(fd_new, F_SETFL, O_NONBLOCK) == -1) {
-        throw irc::exc::FatalError("fctnl -1");
+    /* banned ranges cost one trie walk, and no User is ever built */
+    IpAddr addr;
+    if (!zlines.empty()
+        && IpAddr::fromSockaddr((struct sockaddr *)&client, addr)
+        && zlines.contains(addr))
+    {
+        static const char zlined[] = "ERROR :Closing link: [Z-lined]" CRLF;
+        LOG(INFO) << "rejected Z-lined connection";
+        rejected_zline.inc();
+        rejectConnection(fd_new, zlined, sizeof(zlined) - 1);
+        return -1;
     }
-    int fd_new_idx = -1;
-    for (int i=0; i < fds_size; i++) {
-        /* If there's a -1 somewhere, add new user there. */
-        if (fds[i].fd == -1) {
-            fd_new_idx = i;
-            break;
+    bool has_source = IpAddr::fromSockaddr((struct sockaddr *)&client, addr);
+    IpAddr source = addr.isV4() ? addr : addr.masked(64);
+    if (has_source) {
+        const char *error_line = admitSource(source, Clock::current().now());
+        if (error_line != NULL) {
+            rejected_source.inc();
+            rejectConnection(fd_new, error_line, ft_strlen(error_line));
+            return -1;
         }
     }
-    /* If all entries are occupied, increase number of fd's */
-    if (fd_new_idx == -1) {
-        /* case server is at full users */
-        if (fds_size == MAX_FDS) {
-            if (close(fd_new) == -1) {
-                throw irc::exc::FatalError("close -1");
-            }
-            return -1;
+    /* case server is at full users */
+    if (addPollFd(fd_new, POLLIN) == -1) {
+        rejected_full.inc();
+        if (transport->close(fd_new) == -1) {
+            throw irc::exc::FatalError("close -1");
         }
-        /* else just increment the size, and add at new last position */
-        fds_size++;
-        fd_new_idx = fds_size - 1;
+        return -1;
     }
-    /* set up fd for poll */
-    fds[fd_new_idx].fd = fd_new;
-    fds[fd_new_idx].events = POLLIN;
-    fds[fd_new_idx].revents = 0;
+    if (has_source) {
+        sources[source].connections++;
+        fd_source[fd_new] = source;
+    }
+    accepted.inc();
 
     /* debug information */
-    char ip_address[20];
+    char ip_address[INET6_ADDRSTRLEN];
+    const char *ntop = NULL;
     if (client.ss_family == AF_INET)  {
         struct sockaddr_in *ptr = (struct sockaddr_in *)&client;
-        inet_ntop(AF_INET, &(ptr->sin_addr), ip_address, sizeof(ip_address));
+        ntop = inet_ntop(AF_INET, &(ptr->sin_addr), ip_address,
+                         sizeof(ip_address));
     } else {
         struct sockaddr_in6 *ptr = (struct sockaddr_in6 *)&client;
-        inet_ntop(AF_INET6, &(ptr->sin6_addr), ip_address, sizeof(ip_address));
+        ntop = inet_ntop(AF_INET6, &(ptr->sin6_addr), ip_address,
+                         sizeof(ip_address));
+    }
+    if (ntop == NULL) {
+        ip_address[0] = '\0';
     }
     LOG(INFO) << "connected to " << ip_address;
 
-    // para guardar la ip para futuros baneitos 
+    /* the text form is what Z-lines and channel bans match users on
+     * later (Server::rehash, Channel::userInBlackList) : copied whole,
+     * terminator included, over whatever the previous accept left */
     last_connection.new_fd = fd_new;
-    memcpy(last_connection.ip_address, ip_address, ft_strlen(ip_address));
+    ft_strlcpy(last_connection.ip_address, ip_address,
+               sizeof(last_connection.ip_address));
+
+    return fd_new;
+}
+
+/*
+ * Puts fd in the first free poll entry. Returns its index, or -1 if
+ * there is none left (max_fds).
+ */
+int FdManager::addPollFd(int fd, short events) {
+    int fd_idx = -1;
+    for (int i=0; i < fds_size; i++) {
+        /* If there's a -1 somewhere, add new fd there. */
+        if (fds[i].fd == -1) {
+            fd_idx = i;
+            break;
+        }
+    }
+    /* If all entries are occupied, increase number of fd's */
+    if (fd_idx == -1) {
+        if (fds_size == max_fds) {
+            return -1;
+        }
+        if (fds_size == (int)fds.size()) {
+            fds.push_back(pollfd());
+        }
+        fds_size++;
+        fd_idx = fds_size - 1;
+    }
+    fds[fd_idx].fd = fd;
+    fds[fd_idx].events = events;
+    fds[fd_idx].revents = 0;
+    return fd_idx;
+}
 
+void FdManager::setPollEvents(int fd, short events) {
+    for (int fd_idx = 0; fd_idx < fds_size; fd_idx++) {
+        if (fds[fd_idx].fd == fd) {
+            fds[fd_idx].events = events;
+            break ;
+        }
+    }
+}
+
+/* Admin connections are not users : no limits, no Z-lines (loopback) */
+int FdManager::acceptAdminConnection(void) {
+    struct sockaddr_storage addr;
+    int fd_new = transport->accept(admin_listener, &addr);
+    if (fd_new == -1) {
+        return -1;
+    }
+    if (addPollFd(fd_new, POLLIN) == -1) {
+        transport->close(fd_new);
+        return -1;
+    }
     return fd_new;
 }
 
 void FdManager::closeConnection(int fd) {
 
+    releaseSource(fd);
     for (int fd_idx = 0; fd_idx < fds_size; fd_idx++) {
         if (fds[fd_idx].fd == fd) {
-            if (close(fds[fd_idx].fd) == -1) {
+            if (transport->close(fds[fd_idx].fd) == -1) {
                 throw irc::exc::FatalError("close -1");
             }
             fds[fd_idx].fd = -1;
@@ -333,19 +376,178 @@ void FdManager::closeConnection(int fd) {
     }
 }
 
-/* Some socket errors, specially on send() should not terminate
- * the program. */
-int FdManager::getSocketError(int fd) {
+/* The unread bytes stay in the kernel buffer : the client's own
+ * send() is what ends up blocking. */
+void FdManager::pauseReading(int fd) {
+    for (int fd_idx = 1; fd_idx < fds_size; fd_idx++) {
+        if (fds[fd_idx].fd == fd) {
+            fds[fd_idx].events &= ~POLLIN;
+            fds[fd_idx].revents &= ~POLLIN;
+            break ;
+        }
+    }
+}
 
-    int err_code;
-    socklen_t len = sizeof(err_code);
+void FdManager::resumeReading(int fd) {
+    for (int fd_idx = 1; fd_idx < fds_size; fd_idx++) {
+        if (fds[fd_idx].fd == fd) {
+            fds[fd_idx].events |= POLLIN;
+            break ;
+        }
+    }
+}
 
-    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err_code, &len) == 0) {
-        err_code = errno;
-    } else {
-        errno = err_code; // problem getting error code
+void FdManager::watchWrite(int fd, bool on) {
+    for (int fd_idx = 1; fd_idx < fds_size; fd_idx++) {
+        if (fds[fd_idx].fd == fd) {
+            if (on) {
+                fds[fd_idx].events |= POLLOUT;
+            } else {
+                fds[fd_idx].events &= ~POLLOUT;
+            }
+            break ;
+        }
+    }
+}
+
+/* Best effort : one non blocking send of a precomputed line, then close.
+ * Used for connections refused before they get a User. */
+void FdManager::rejectConnection(int fd, const char *error_line, size_t len) {
+    transport->send(fd, error_line, len);
+    if (transport->close(fd) == -1) {
+        throw irc::exc::FatalError("close -1");
+    }
+}
+
+/*
+ * Z-line file : one IPv4/IPv6 address or CIDR range per line.
+ * Empty lines and lines starting with '#' are ignored.
+ * The table is only replaced if the file could be read, so a bad
+ * rehash never drops the bans already in place.
+ * Returns the number of ranges loaded, -1 if the file can't be opened.
+ */
+int FdManager::loadZLines(const string &path) {
+    std::ifstream file(path.c_str());
+    if (!file.is_open()) {
+        return -1;
+    }
+    CidrTrie table;
+    string line;
+    int line_nb = 0;
+    while (std::getline(file, line)) {
+        line_nb++;
+        size_t end = line.find_last_not_of(" \t\r");
+        line = (end == string::npos) ? "" : line.substr(0, end + 1);
+        if (line.empty() || line[0] == '#') {
+            continue ;
+        }
+        IpAddr addr;
+        int len;
+        if (!IpAddr::parseCidr(line, addr, len)) {
+            LOG(WARNING) << path << ":" << line_nb
+                         << " invalid range [" << line << "]";
+            continue ;
+        }
+        table.insert(addr, len);
     }
-    return err_code;
+    zlines = table;
+    LOG(INFO) << "Loaded " << zlines.size() << " Z-lines from " << path;
+    return zlines.size();
+}
+
+bool FdManager::isZLined(const string &ip_address) const {
+    IpAddr addr;
+    return !zlines.empty()
+           && IpAddr::parse(ip_address, addr)
+           && zlines.contains(addr);
+}
+
+/*
+ * Returns NULL if a new connection from source is allowed, and consumes
+ * one connect token. Otherwise returns the ERROR line to send back.
+ */
+/* A positive number from the environment, value otherwise */
+static int envLimit(const char *name, int value) {
+    const char *env = getenv(name);
+    if (env != NULL && ft_atoi(env) > 0) {
+        return ft_atoi(env);
+    }
+    return value;
+}
+
+void FdManager::loadSourceLimits(void) {
+    max_conns_per_source = envLimit("IRCSERV_MAX_CONNS_PER_SOURCE",
+                                    MAX_CONNS_PER_SOURCE);
+    connect_burst = envLimit("IRCSERV_CONNECT_BURST", CONNECT_BURST);
+    connect_refill_s = envLimit("IRCSERV_CONNECT_REFILL_S", CONNECT_REFILL_S);
+    LOG(INFO) << "Per source limits : " << max_conns_per_source
+              << " connections, bursts of " << connect_burst
+              << " then one every " << connect_refill_s << "s";
+}
+
+const char* FdManager::admitSource(const IpAddr &source, time_t now) {
+    SourceMap::iterator it = sources.find(source);
+    if (it == sources.end()) {
+        if (sources.size() >= (size_t)max_fds * SOURCES_TRACKED_PER_FD) {
+            pruneSources(now);
+        }
+        SourceInfo info = {0, connect_burst, now};
+        it = sources.insert(std::make_pair(source, info)).first;
+    }
+    SourceInfo &info = it->second;
+    int refill = (now - info.last_refill) / connect_refill_s;
+    if (refill > 0) {
+        info.tokens += refill;
+        info.last_refill += refill * connect_refill_s;
+    }
+    if (info.tokens >= connect_burst) {
+        info.tokens = connect_burst;
+        info.last_refill = now;
+    }
+    if (info.connections >= max_conns_per_source) {
+        LOG(INFO) << "rejected connection : too many from source";
+        return too_many_conns;
+    }
+    if (info.tokens == 0) {
+        LOG(INFO) << "rejected connection : source throttled";
+        return throttled;
+    }
+    info.tokens--;
+    return NULL;
+}
+
+void FdManager::releaseSource(int fd) {
+    FdSourceMap::iterator it = fd_source.find(fd);
+    if (it == fd_source.end()) {
+        return ;
+    }
+    SourceMap::iterator src = sources.find(it->second);
+    if (src != sources.end()) {
+        src->second.connections--;
+    }
+    fd_source.erase(it);
+}
+
+/* Forgets idle sources whose bucket would be full again by now */
+void FdManager::pruneSources(time_t now) {
+    SourceMap::iterator it = sources.begin();
+    while (it != sources.end()) {
+        const SourceInfo &info = it->second;
+        int missing = connect_burst - info.tokens;
+        if (info.connections == 0
+            && now - info.last_refill >= missing * connect_refill_s)
+        {
+            sources.erase(it++);
+        } else {
+            it++;
+        }
+    }
+}
+
+/* Some socket errors, specially on send() should not terminate
+ * the program. */
+int FdManager::getSocketError(int fd) {
+    return transport->socketError(fd);
 }
 
 bool FdManager::socketErrorIsNotFatal(int fd) {
@@ -2,6 +2,9 @@
 #include "User.hpp"
 #include "Log.hpp"
 #include "Channel.hpp"
+#include "ListFilter.hpp"
+#include "AllocProfile.hpp"
+#include "Tools.hpp"
 #include "libft.h"
 
 using std::string;
@@ -18,22 +21,28 @@ IrcDataBase::IrcDataBase(const IrcDataBase& other)
 :
     channel_map(other.channel_map),
     nick_fd_map(other.nick_fd_map),
-    fd_user_map(other.fd_user_map)
+    fd_user_map(other.fd_user_map),
+    size_buckets(other.size_buckets),
+    channel_folds(other.channel_folds)
 {}
 
 void IrcDataBase::addNewUser(int new_fd, const char *ip_address) {
+    AllocScope scope(ALLOC_USERS);
     /* case server is full of users */
     if (new_fd == -1
         || ip_address == NULL) {
         return ;
     }
-    User user(new_fd, ip_address);
-    addFdUserPair(new_fd, user);
+    /* No emplace in C++98 : the map copies a user that owns nothing on
+     * the heap yet, the address is set once it is in place */
+    User &user = fd_user_map.insert(
+        FdUserMap::value_type(new_fd, User(new_fd, ""))).first->second;
+    user.ip_address = ip_address;
 }
 
 
 void IrcDataBase::removeUser(int fd) {
-    
+    AllocScope scope(ALLOC_USERS);
     User &user = getUserFromFd(fd);
     LOG(INFO) << "User " << user << " removed";
     /* If the user had a nick registered, erase it */
@@ -47,50 +56,135 @@ void IrcDataBase::removeUser(int fd) {
 void IrcDataBase::updateUserNick(int fd, string &new_nick,
                                  string &new_real_nick)
 {
+    AllocScope scope(ALLOC_USERS);
     User& user = getUserFromFd(fd);
+    Atom nick(new_nick);
     removeNickFdPair(user.nick);
-    addNickFdPair(new_nick, fd);
-    updateUserInChannels(user, new_nick);
-    user.nick = new_nick;
+    addNickFdPair(nick, fd);
+    updateUserInChannels(user, nick);
+    user.nick = nick;
     user.real_nick = new_real_nick;
-}
-
-void IrcDataBase::addFdUserPair(int fd, User& user) {
-    fd_user_map.insert(std::pair<int, User>(fd, user));
+    /* the prefix (and source) carry the nick too */
+    if (!user.prefix.empty()) {
+        user.setPrefixFromHost(user.prefix.substr(user.prefix.find('@') + 1));
+    }
+    /* ban verdicts depend on the nick */
+    user.ban_cache.clear();
 }
 
 void IrcDataBase::removeFdUserPair(int fd) {
     fd_user_map.erase(fd);
 }
 
-void IrcDataBase::addNickFdPair(string &nick, int fd) {
-    nick_fd_map.insert(std::pair<string, int>(nick, fd));
+void IrcDataBase::addNickFdPair(const Atom &nick, int fd) {
+    nick_fd_map.insert(std::pair<Atom, int>(nick, fd));
 }
 
-void IrcDataBase::removeNickFdPair(string &nick) {
+void IrcDataBase::removeNickFdPair(const Atom &nick) {
     nick_fd_map.erase(nick);
 }
 
-void IrcDataBase::addNewChannel(Channel& new_channel) {
-    channel_map.insert(std::pair<string, Channel>(new_channel.name, new_channel));
+/* Same as addNewUser : an empty channel is copied in, and its creator
+ * joins it where it lives */
+Channel& IrcDataBase::addNewChannel(const Atom &name, User &creator) {
+    AllocScope scope(ALLOC_CHANNELS);
+    Channel &channel = channel_map.insert(
+        ChannelMap::value_type(name, Channel(name))).first->second;
+    channel.addFounder(creator);
+    string folded = name.str();
+    tools::ToUpperCase(folded);
+    channel_folds.insert(FoldedNameMap::value_type(folded, name));
+    indexChannel(name, channel.users.size());
+    return channel;
 }
 
 void IrcDataBase::maybeRemoveChannel(Channel& channel) {
+    AllocScope scope(ALLOC_CHANNELS);
     if (channel.users.empty()) {
+        unindexChannel(channel.name, 0);
+        string folded = channel.name.str();
+        tools::ToUpperCase(folded);
+        channel_folds.erase(folded);
+        /* the fd may be someone else's by now : at worst, their
+         * verdict is computed again */
+        for (std::set<int>::iterator it = channel.ban_cached.begin();
+             it != channel.ban_cached.end(); it++)
+        {
+            if (fdExists(*it)) {
+                getUserFromFd(*it).ban_cache.erase(channel.name);
+            }
+        }
         channel_map.erase(channel_map.find(channel.name));
     }
 }
 
+/* Joins and parts go through these two, so size_buckets stays right */
+void IrcDataBase::addChannelMember(Channel &channel, User &user) {
+    AllocScope scope(ALLOC_CHANNELS);
+    size_t before = channel.users.size();
+    channel.addUser(user);
+    moveChannel(channel.name, before, channel.users.size());
+}
+
+void IrcDataBase::deleteChannelMember(Channel &channel, User &user) {
+    AllocScope scope(ALLOC_CHANNELS);
+    size_t before = channel.users.size();
+    channel.deleteUser(user);
+    moveChannel(channel.name, before, channel.users.size());
+}
+
+void IrcDataBase::indexChannel(const Atom &name, size_t members) {
+    size_t bucket = ListFilter::sizeBucket(members);
+    if (size_buckets.size() <= bucket) {
+        size_buckets.resize(bucket + 1);
+    }
+    size_buckets[bucket].insert(name);
+}
+
+void IrcDataBase::unindexChannel(const Atom &name, size_t members) {
+    size_t bucket = ListFilter::sizeBucket(members);
+    if (bucket < size_buckets.size()) {
+        size_buckets[bucket].erase(name);
+    }
+}
+
+/* Only crossing a power of two changes the bucket */
+void IrcDataBase::moveChannel(const Atom &name, size_t before, size_t after) {
+    if (ListFilter::sizeBucket(before) != ListFilter::sizeBucket(after)) {
+        unindexChannel(name, before);
+        indexChannel(name, after);
+    }
+}
+
 bool IrcDataBase::fdExists(int fd) {
     return fd_user_map.count(fd);
 }
 
-bool IrcDataBase::nickExists(string &nick) {
+/* Lookups by string never intern : unknown names give an empty Atom,
+ * which is never a key. */
+bool IrcDataBase::nickExists(const string &nick) {
+    return nick_fd_map.count(Atom::lookup(nick));
+}
+
+bool IrcDataBase::nickExists(const Atom &nick) {
     return nick_fd_map.count(nick);
 }
 
-bool IrcDataBase::channelExists(string &channel_name) {
-    return channel_map.count(channel_name);
+/* Channel names are ascii case insensitive : the name as created is
+ * tried first, it is what clients send nearly always */
+Atom IrcDataBase::channelAtom(const string &channel_name) {
+    Atom name = Atom::lookup(channel_name);
+    if (channel_map.count(name)) {
+        return name;
+    }
+    string folded = channel_name;
+    tools::ToUpperCase(folded);
+    FoldedNameMap::iterator it = channel_folds.find(folded);
+    return it == channel_folds.end() ? Atom() : it->second;
+}
+
+bool IrcDataBase::channelExists(const string &channel_name) {
+    return !channelAtom(channel_name).empty();
 }
 
 /* See 
@@ -124,29 +218,37 @@ User& IrcDataBase::getUserFromFd(int fd) {
     return it->second;
 }
 
-int IrcDataBase::getFdFromNick(string& nickname) {
+int IrcDataBase::getFdFromNick(const Atom& nickname) {
     NickFdMap::iterator it = nick_fd_map.find(nickname);
     return it->second;
 }
 
-User& IrcDataBase::getUserFromNick(string& nickname) {
+User& IrcDataBase::getUserFromNick(const string& nickname) {
+    return getUserFromNick(Atom::lookup(nickname));
+}
+
+User& IrcDataBase::getUserFromNick(const Atom& nickname) {
     int fd = getFdFromNick(nickname);
     FdUserMap::iterator it = fd_user_map.find(fd);
     return it->second;
 }
 
-Channel& IrcDataBase::getChannelFromName(string& name) {
+Channel& IrcDataBase::getChannelFromName(const string& name) {
+    return getChannelFromName(channelAtom(name));
+}
+
+Channel& IrcDataBase::getChannelFromName(const Atom& name) {
     ChannelMap::iterator it = channel_map.find(name);
     return it->second;
 }
 
-void IrcDataBase::updateUserInChannels(irc::User &user, string new_nick) {
-    for (std::map<string, unsigned char>::iterator
+void IrcDataBase::updateUserInChannels(irc::User &user, const Atom &new_nick) {
+    AllocScope scope(ALLOC_CHANNELS);
+    for (std::map<Atom, unsigned char>::iterator
             it = user.ch_name_mask_map.begin();
             it != user.ch_name_mask_map.end(); it++)
     {
-        string ch_name = it->first;
-        Channel &channel = getChannelFromName(ch_name);
+        Channel &channel = getChannelFromName(it->first);
         channel.updateUserNick(user.nick, new_nick);
     }
 }
@@ -168,16 +270,16 @@ void IrcDataBase::debugNickFdMap(void) {
 }
 
 void IrcDataBase::removeUserFromChannels(int fd) {
+    AllocScope scope(ALLOC_CHANNELS);
     
     User &user = getUserFromFd(fd);
 
-    for (std::map<string, unsigned char>::iterator
+    for (std::map<Atom, unsigned char>::iterator
                  it = user.ch_name_mask_map.begin();
          it != user.ch_name_mask_map.end(); it++)
     {
-        string ch_name = it->first;
-        Channel &channel = getChannelFromName(ch_name);
-        channel.deleteUser(user);
+        Channel &channel = getChannelFromName(it->first);
+        deleteChannelMember(channel, user);
         maybeRemoveChannel(channel);
     }
 }
@@ -0,0 +1,230 @@
+#include "Server/MemoryTransport.hpp"
+#include "libft.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cerrno>
+
+using std::string;
+
+typedef enum {
+    FIRST_FD = 3    // after stdin, stdout and stderr, as in a process
+} MEMORY_TRANSPORT_CONFIG;
+
+namespace irc {
+
+MemoryTransport::MemoryTransport(size_t capacity)
+:
+    capacity(capacity),
+    next_fd(FIRST_FD)
+{}
+
+MemoryTransport::~MemoryTransport() {}
+
+int MemoryTransport::newFd(ENDPOINT_TYPE type) {
+    int fd;
+    if (!free_fds.empty()) {
+        fd = *free_fds.begin();
+        free_fds.erase(free_fds.begin());
+    } else {
+        fd = next_fd++;
+    }
+    Endpoint &end = endpoints[fd];
+    end.type = type;
+    end.peer = -1;
+    return fd;
+}
+
+MemoryTransport::Endpoint* MemoryTransport::find(int fd) {
+    EndpointMap::iterator it = endpoints.find(fd);
+    return it == endpoints.end() ? NULL : &it->second;
+}
+
+const MemoryTransport::Endpoint* MemoryTransport::find(int fd) const {
+    EndpointMap::const_iterator it = endpoints.find(fd);
+    return it == endpoints.end() ? NULL : &it->second;
+}
+
+int MemoryTransport::listen(const string &host, const string &port,
+                            string &bound)
+{
+    string key = host + ":" + port;
+    if (listeners.count(key)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    int fd = newFd(LISTENER);
+    endpoints[fd].listen_key = key;
+    listeners[key] = fd;
+    bound = host;
+    return fd;
+}
+
+int MemoryTransport::connect(const string &host, const string &port,
+                             const string &source)
+{
+    std::map<string, int>::iterator it = listeners.find(host + ":" + port);
+    if (it == listeners.end()) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+    int listener = it->second;
+    int client = newFd(STREAM);
+    int server = newFd(STREAM);
+    endpoints[client].peer = server;
+    endpoints[client].address = host;
+    endpoints[server].peer = client;
+    endpoints[server].address = source;
+    endpoints[listener].backlog.push_back(server);
+    return client;
+}
+
+bool MemoryTransport::fillAddress(const string &address,
+                                  struct sockaddr_storage *addr)
+{
+    ft_memset(addr, 0, sizeof(*addr));
+    struct sockaddr_in *v4 = (struct sockaddr_in *)addr;
+    if (inet_pton(AF_INET, address.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        return true;
+    }
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)addr;
+    if (inet_pton(AF_INET6, address.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+int MemoryTransport::accept(int listener, struct sockaddr_storage *addr) {
+    Endpoint *end = find(listener);
+    if (end == NULL || end->type != LISTENER) {
+        errno = EBADF;
+        return -1;
+    }
+    if (end->backlog.empty()) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int fd = end->backlog.front();
+    end->backlog.pop_front();
+    if (!fillAddress(endpoints[fd].address, addr)) {
+        addr->ss_family = AF_UNSPEC;
+    }
+    return fd;
+}
+
+ssize_t MemoryTransport::recv(int fd, char *buff, size_t len) {
+    Endpoint *end = find(fd);
+    if (end == NULL || end->type != STREAM) {
+        errno = EBADF;
+        return -1;
+    }
+    if (end->in.empty()) {
+        if (end->peer == -1) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = end->in.size() < len ? end->in.size() : len;
+    end->in.copy(buff, n);
+    end->in.erase(0, n);
+    return n;
+}
+
+ssize_t MemoryTransport::send(int fd, const char *buff, size_t len) {
+    Endpoint *end = find(fd);
+    if (end == NULL || end->type != STREAM) {
+        errno = EBADF;
+        return -1;
+    }
+    if (end->peer == -1) {
+        errno = EPIPE;
+        return -1;
+    }
+    string &queue = endpoints[end->peer].in;
+    size_t room = capacity - queue.size();
+    if (room == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t n = len < room ? len : room;
+    queue.append(buff, n);
+    return n;
+}
+
+/* Never waits : nothing can become ready while this thread is here */
+int MemoryTransport::poll(struct pollfd *fds, nfds_t nfds, int) {
+    int ready = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        fds[i].revents = 0;
+        if (fds[i].fd < 0) {
+            continue;
+        }
+        const Endpoint *end = find(fds[i].fd);
+        if (end == NULL) {
+            fds[i].revents = POLLNVAL;
+        } else if (end->type == LISTENER) {
+            if (!end->backlog.empty()) {
+                fds[i].revents = POLLIN;
+            }
+        } else if (end->peer == -1) {
+            fds[i].revents = POLLIN | POLLHUP;
+        } else {
+            if (!end->in.empty()) {
+                fds[i].revents |= POLLIN;
+            }
+            if (find(end->peer)->in.size() < capacity) {
+                fds[i].revents |= POLLOUT;
+            }
+        }
+        fds[i].revents &= fds[i].events | POLLHUP | POLLNVAL;
+        if (fds[i].revents) {
+            ready++;
+        }
+    }
+    return ready;
+}
+
+/* The peer reads what is left, then end of file. Connections still in
+ * a listener's backlog are closed with it. */
+int MemoryTransport::close(int fd) {
+    Endpoint *end = find(fd);
+    if (end == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (end->type == LISTENER) {
+        std::deque<int> backlog = end->backlog;
+        listeners.erase(end->listen_key);
+        for (size_t i = 0; i < backlog.size(); i++) {
+            close(backlog[i]);
+        }
+    } else if (end->peer != -1) {
+        endpoints[end->peer].peer = -1;
+    }
+    endpoints.erase(fd);
+    free_fds.insert(fd);
+    return 0;
+}
+
+int MemoryTransport::socketError(int fd) {
+    const Endpoint *end = find(fd);
+    if (end != NULL && end->type == STREAM && end->peer == -1) {
+        return ECONNRESET;
+    }
+    return errno;
+}
+
+size_t MemoryTransport::pending(int fd) const {
+    const Endpoint *end = find(fd);
+    return end == NULL ? 0 : end->in.size();
+}
+
+size_t MemoryTransport::openFds(void) const {
+    return endpoints.size();
+}
+
+} // namespace
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <stdlib.h>
 
 #include "Server/Server.hpp"
 #include "User.hpp"
@@ -14,6 +16,7 @@
 #include "Log.hpp"
 #include "libft.h"
 #include "Types.hpp"
+#include "AllocProfile.hpp"
 
 using std::string;
 using std::vector;
@@ -38,6 +41,58 @@ using std::vector;
 
 namespace irc {
 
+/* Set from the signal handlers run() installs, consumed by runOnce
+ * and run */
+static volatile sig_atomic_t rehash_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void onSighup(int) {
+    rehash_requested = 1;
+}
+
+static void onStopSignal(int) {
+    stop_requested = 1;
+}
+
+static Metrics::Counter &bytes_received = Metrics::global().counter(
+    "ircserv_received_bytes_total", "Bytes read from clients");
+static Metrics::Counter &bytes_sent = Metrics::global().counter(
+    "ircserv_sent_bytes_total", "Bytes written to clients");
+static Metrics::Counter &messages_sent = Metrics::global().counter(
+    "ircserv_sent_messages_total", "Lines written to clients");
+static Metrics::Counter &recv_errors = Metrics::global().counter(
+    "ircserv_socket_errors_total", "Failed socket calls",
+    Metrics::label("op", "recv"));
+static Metrics::Counter &send_errors = Metrics::global().counter(
+    "ircserv_socket_errors_total", "Failed socket calls",
+    Metrics::label("op", "send"));
+static Metrics::Counter &unknown_commands = Metrics::global().counter(
+    "ircserv_unknown_commands_total", "Lines with no matching command");
+static Metrics::Counter &flood_throttled = Metrics::global().counter(
+    "ircserv_flood_throttled_total", "Times a user ran out of flood budget");
+static Metrics::Counter &flood_disconnects = Metrics::global().counter(
+    "ircserv_flood_disconnects_total", "Users removed for Excess Flood");
+static Metrics::Counter &sendq_exceeded = Metrics::global().counter(
+    "ircserv_sendq_exceeded_total", "Users removed for SendQ exceeded");
+static Metrics::Histogram &loop_lag = Metrics::global().histogram(
+    "ircserv_loop_lag_microseconds",
+    "Time from poll() returning to the next poll() call", 1, 24, 2);
+static Metrics::Counter &loop_stalls = Metrics::global().counter(
+    "ircserv_loop_stalls_total", "Loop iterations over the stall threshold");
+
+/* STATS u reads them too, through these */
+Metrics::Histogram& Server::loopLag(void) {
+    return loop_lag;
+}
+
+Metrics::Counter& Server::loopStalls(void) {
+    return loop_stalls;
+}
+
+static const char *phase_names[] = {
+    "accept", "read/parse", "dispatch", "ping", "flush"
+};
+
 Server::Server(void)
 :
     AIrcCommands()
@@ -66,11 +121,36 @@ Server::Server(string &hostname, string &port, string &password)
     init();
 }
 
+Server::Server(Transport &transport, string &hostname, string &port)
+:
+    AIrcCommands(transport, hostname, port)
+{
+    init();
+}
+
+Server::Server(Transport &transport, string &hostname, string &port,
+               string &password)
+:
+    AIrcCommands(transport, hostname, port, password)
+{
+    init();
+}
+
 Server::Server(const Server& other)
 :
     AIrcCommands(other),
+    flush_queue(other.flush_queue),
+    doomed(other.doomed),
+    started(other.started),
+    stopping(other.stopping),
+    loop_stall_us(other.loop_stall_us),
     cmd_map(other.cmd_map),
-    srv_buff_size(other.srv_buff_size)
+    srv_buff_size(other.srv_buff_size),
+    slow_command_us(other.slow_command_us),
+    run_queue(other.run_queue),
+    poll_start(other.poll_start),
+    admin_conns(other.admin_conns),
+    started_at(other.started_at)
 {
     ft_memset(srv_buff, '\0', BUFF_MAX_SIZE);
     if (other.srv_buff_size > 0) {
@@ -84,52 +164,256 @@ Server::~Server(void) {
 void Server::init(void) {
     ft_memset(srv_buff, '\0', BUFF_MAX_SIZE);
     srv_buff_size = 0;
+    poll_start = 0;
+    started_at = Clock::current().now();
+    started = false;
+    stopping = false;
+    slow_command_us = SLOW_COMMAND_US;
+    const char *slow_env = getenv("IRCSERV_SLOW_COMMAND_US");
+    if (slow_env != NULL && ft_atoi(slow_env) > 0) {
+        slow_command_us = ft_atoi(slow_env);
+    }
+    loop_stall_us = LOOP_STALL_US;
+    const char *stall_env = getenv("IRCSERV_LOOP_STALL_US");
+    if (stall_env != NULL && ft_atoi(stall_env) > 0) {
+        loop_stall_us = ft_atoi(stall_env);
+    }
+    loadSourceLimits();
+    const char *capture_env = getenv("IRCSERV_CAPTURE");
+    if (capture_env != NULL && !capture.open(capture_env)) {
+        LOG(WARNING) << "Can't open capture file " << capture_env;
+    }
     loadCommandMap();
-    mainLoop();
+    rehash();
 }
 
+/*
+ * Penalties are flood control tokens (FLOOD_CONFIG) : PRIVMSG at 2 with
+ * a bucket of 32 refilled at 2 per second is a burst of 16 messages,
+ * then one per second. Commands that make the server do a lot of work
+ * (whole channel lists, nick changes broadcast everywhere) cost more.
+ */
 void Server::loadCommandMap(void) {
-    cmd_map.insert(std::pair<string, CommandFnx>(string("NICK"), &AIrcCommands::NICK));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("USER"), &AIrcCommands::USER));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("PING"), &AIrcCommands::PING));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("PONG"), &AIrcCommands::PONG));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("JOIN"), &AIrcCommands::JOIN));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("PART"), &AIrcCommands::PART));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("KICK"), &AIrcCommands::KICK));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("TOPIC"), &AIrcCommands::TOPIC));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("INVITE"), &AIrcCommands::INVITE));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("MODE"), &AIrcCommands::MODE));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("PASS"), &AIrcCommands::PASS));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("QUIT"), &AIrcCommands::QUIT));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("NAMES"), &AIrcCommands::NAMES));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("LIST"), &AIrcCommands::LIST));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("PRIVMSG"), &AIrcCommands::PRIVMSG));
-    cmd_map.insert(std::pair<string, CommandFnx>(string("WHOIS"), &AIrcCommands::WHOIS));
-}
-
-// this might have to manage signals at some point ?? 
-int Server::mainLoop(void) {
+    loadCommand("NICK", &AIrcCommands::NICK, PENALTY_NICK);
+    loadCommand("USER", &AIrcCommands::USER, PENALTY_USER);
+    loadCommand("PING", &AIrcCommands::PING, PENALTY_PING);
+    loadCommand("PONG", &AIrcCommands::PONG, PENALTY_PONG);
+    loadCommand("JOIN", &AIrcCommands::JOIN, PENALTY_JOIN);
+    loadCommand("PART", &AIrcCommands::PART, PENALTY_PART);
+    loadCommand("KICK", &AIrcCommands::KICK, PENALTY_KICK);
+    loadCommand("TOPIC", &AIrcCommands::TOPIC, PENALTY_TOPIC);
+    loadCommand("INVITE", &AIrcCommands::INVITE, PENALTY_INVITE);
+    loadCommand("MODE", &AIrcCommands::MODE, PENALTY_MODE);
+    loadCommand("PASS", &AIrcCommands::PASS, PENALTY_PASS);
+    loadCommand("QUIT", &AIrcCommands::QUIT, PENALTY_QUIT);
+    loadCommand("NAMES", &AIrcCommands::NAMES, PENALTY_NAMES);
+    loadCommand("LIST", &AIrcCommands::LIST, PENALTY_LIST);
+    loadCommand("PRIVMSG", &AIrcCommands::PRIVMSG, PENALTY_PRIVMSG);
+    loadCommand("WHOIS", &AIrcCommands::WHOIS, PENALTY_WHOIS);
+    loadCommand("OPER", &AIrcCommands::OPER, PENALTY_OPER);
+    loadCommand("STATS", &AIrcCommands::STATS, PENALTY_STATS);
+}
+
+void Server::loadCommand(const char *name, CommandFnx fnx, int penalty) {
+    string label = Metrics::label("command", name);
+    CommandInfo info = {
+        fnx,
+        penalty,
+        &Metrics::global().counter("ircserv_commands_total",
+                                   "Commands run, by name", label),
+        &Metrics::global().counter("ircserv_command_received_bytes_total",
+                                   "Bytes of the lines that ran each command",
+                                   label),
+        /* 1us to ~8s, two buckets per power of two */
+        &Metrics::global().histogram("ircserv_command_duration_microseconds",
+                                     "Time spent in each command handler",
+                                     1, 24, 2, label),
+        /* only counted in ALLOC_PROFILE builds, not shown otherwise */
+        AllocProfile::enabled()
+        ? &Metrics::global().counter("ircserv_command_allocations_total",
+                                     "Allocations made while running each"
+                                     " command, nested ones included",
+                                     label)
+        : NULL
+    };
+    cmd_map.insert(std::pair<string, CommandInfo>(string(name), info));
+}
 
+/*
+ * Embedding : the constructors only set the server up (listener, config
+ * files). Whoever owns it then either calls run(), which is what main
+ * does, or start() once and runOnce() as often as it likes, e.g. from
+ * its own loop or a test, and stop() whenever it wants out.
+ */
+void Server::start(void) {
+    if (started) {
+        return ;
+    }
     setUpPoll();
-    while (42) {
-        Poll();
-        for (int fd_idx = 0; fd_idx < fds_size; fd_idx++) {
-            if (skipFd(fd_idx)
-                || !hasDataToRead(fd_idx))
-            {
-                continue;
-            }
-            /* listener is always at first entry */
-            if (fd_idx == 0) {
-                int new_fd = acceptConnection();
-                const char* ip_address = getSocketAddress(new_fd);
-                addNewUser(new_fd, ip_address);
-                continue;
+    started = true;
+    stopping = false;
+}
+
+/* Until stop(), SIGINT or SIGTERM. What is queued is written before
+ * returning. SIGHUP reloads the configuration (see rehash). */
+void Server::run(void) {
+    signal(SIGHUP, onSighup);
+    signal(SIGINT, onStopSignal);
+    signal(SIGTERM, onStopSignal);
+    start();
+    while (!stopping && !stop_requested) {
+        runOnce(POLL_TIMEOUT_MS);
+    }
+    LOG(INFO) << "Server stopping";
+    flushSendQueues();
+    capture.flush();
+    stopping = true;
+}
+
+/* Only asks : run() returns after the current iteration */
+void Server::stop(void) {
+    stopping = true;
+}
+
+bool Server::isRunning(void) const {
+    return started && !stopping;
+}
+
+/* Process wide (see Clock.hpp). Not owned, it has to outlive the
+ * server. */
+void Server::setClock(Clock &clock) {
+    Clock::setCurrent(clock);
+    started_at = clock.now();
+    welcome.build(server_prefix, hostname, started_at);
+}
+
+/*
+ * One iteration. It first reads from every ready socket, starting one
+ * slot further every time so low slots are not always served first.
+ * Reading only queues lines : running them is runQueue's job, in turns,
+ * so a client that pipelines hundreds of lines can't delay everyone
+ * after it. Replies are queued too, and written in the flush phase.
+ * Poll waits up to timeout_ms, not at all while there is queued work.
+ * Every iteration is timed, by phase (see checkLoopLag).
+ */
+void Server::runOnce(int timeout_ms) {
+
+    start();
+    bool busy = !run_queue.empty() || !flush_queue.empty()
+                || !doomed.empty() || listCanProgress();
+    Poll(busy ? 0 : timeout_ms);
+    unsigned long iteration_start = Clock::current().monotonicUs();
+    unsigned long phases[PHASE_COUNT] = {0, 0, 0, 0, 0};
+    unsigned long t;
+    if (rehash_requested) {
+        rehash_requested = 0;
+        rehash();
+    }
+    int polled = fds_size;
+    poll_start = (poll_start + 1) % polled;
+    for (int i = 0; i < polled; i++) {
+        int fd_idx = (poll_start + i) % polled;
+        if (skipFd(fd_idx)) {
+            continue;
+        }
+        int fd = getFdFromIndex(fd_idx);
+        t = Clock::current().monotonicUs();
+        /* admin connections also wait for POLLOUT */
+        if (admin_conns.count(fd)) {
+            serveAdmin(fd_idx);
+            phases[PHASE_READ] += Clock::current().monotonicUs() - t;
+            continue;
+        }
+        /* room again in a full socket : back to the flush queue */
+        if (fd_idx != 0 && hasRoomToWrite(fd_idx) && fdExists(fd)) {
+            queueFlush(fd, true);
+        }
+        if (!hasDataToRead(fd_idx)) {
+            continue;
+        }
+        /* listener is always at first entry */
+        if (fd_idx == 0) {
+            int new_fd = acceptConnection();
+            const char* ip_address = getSocketAddress(new_fd);
+            addNewUser(new_fd, ip_address);
+            if (new_fd != -1) {
+                capture.opened(new_fd);
             }
-            int fd = getFdFromIndex(fd_idx);
-            DataFromUser(fd);
+            phases[PHASE_ACCEPT] += Clock::current().monotonicUs() - t;
+            continue;
+        }
+        if (fd == admin_listener) {
+            acceptAdmin();
+            phases[PHASE_ACCEPT] += Clock::current().monotonicUs() - t;
+            continue;
+        }
+        DataFromUser(fd);
+        phases[PHASE_READ] += Clock::current().monotonicUs() - t;
+    }
+    t = Clock::current().monotonicUs();
+    runQueue();
+    floodLoop();
+    listLoop();
+    phases[PHASE_DISPATCH] = Clock::current().monotonicUs() - t;
+    t = Clock::current().monotonicUs();
+    pingLoop();
+    phases[PHASE_PING] = Clock::current().monotonicUs() - t;
+    t = Clock::current().monotonicUs();
+    flushSendQueues();
+    capture.flush();
+    phases[PHASE_FLUSH] = Clock::current().monotonicUs() - t;
+    checkLoopLag(iteration_start, phases);
+}
+
+/*
+ * The loop has a single thread : an iteration over loop_stall_us delayed
+ * every client. Those are logged with where the time went.
+ */
+void Server::checkLoopLag(unsigned long start, const unsigned long *phases) {
+    unsigned long lag = Clock::current().monotonicUs() - start;
+    loop_lag.observe(lag);
+    if (lag < loop_stall_us) {
+        return ;
+    }
+    loop_stalls.inc();
+    unsigned long other = lag;
+    LOG warn(WARNING);
+    warn << "Loop stall " << lag << "us :";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        warn << " " << phase_names[p] << " " << phases[p] << "us,";
+        other -= (phases[p] < other) ? phases[p] : other;
+    }
+    warn << " other " << other << "us";
+}
+
+/*
+ * (Re)loads the server configuration files. Z-lines also apply to
+ * users already connected : they are removed right away.
+ * Users already opered keep their status.
+ */
+void Server::rehash(void) {
+    if (loadOpers(OPER_FILE) == -1) {
+        LOG(INFO) << "No operator file " OPER_FILE;
+    }
+    if (welcome.loadMotd(MOTD_FILE) == -1) {
+        LOG(INFO) << "No MOTD file " MOTD_FILE;
+    }
+    welcome.build(server_prefix, hostname, started_at);
+    if (loadZLines(ZLINE_FILE) == -1) {
+        LOG(INFO) << "No Z-line file " ZLINE_FILE;
+        return ;
+    }
+    vector<int> banned;
+    for (FdUserMap::iterator it = fd_user_map.begin();
+         it != fd_user_map.end(); it++)
+    {
+        if (isZLined(it->second.ip_address)) {
+            banned.push_back(it->first);
         }
-        pingLoop();
+    }
+    for (size_t i = 0; i < banned.size(); i++) {
+        string reason = "Z-lined";
+        removeUserFromServer(banned[i], reason);
     }
 }
 
@@ -150,16 +434,20 @@ void Server::pingLoop(void) {
             continue;
         }
         int fd = getFdFromIndex(fd_idx);
+        /* admin port sockets */
+        if (!fdExists(fd)) {
+            continue;
+        }
         User &user = getUserFromFd(fd);
         if (user.isOnPongHold()) {
-            time_t since_ping = time(NULL) - user.getPingTime();
+            time_t since_ping = Clock::current().now() - user.getPingTime();
             if (since_ping >= PING_TIMEOUT_S) {
                 string reason = "Ping timeout: " PING_TIMEOUT_S_STR " seconds";
                 removeUserFromServer(fd, reason);
             }
             continue ;
         }
-        time_t since_last_msg = time(NULL) - user.getLastMsgTime();
+        time_t since_last_msg = Clock::current().now() - user.getLastMsgTime();
         if (since_last_msg >= PING_TIMEOUT_S) {
             sendPingToUser(fd);
         }
@@ -176,10 +464,17 @@ void Server::sendPingToUser(int fd) {
     user.updatePingStatus(random);
 }
 
+/* Peer gone or server side close (QUIT, ping timeout, kills) alike */
+void Server::closeConnection(int fd) {
+    capture.closed(fd);
+    FdManager::closeConnection(fd);
+}
+
 void Server::DataFromUser(int fd) {
 
-    srv_buff_size = recv(fd, srv_buff, sizeof(srv_buff), 0);
+    srv_buff_size = transport->recv(fd, srv_buff, sizeof(srv_buff));
     if (srv_buff_size == -1) {
+        recv_errors.inc();
         if (socketErrorIsNotFatal(fd)) {
             LOG(WARNING) << "DataFromUser closing fd " << fd
                          << " from user " << getUserFromFd(fd)
@@ -193,16 +488,20 @@ void Server::DataFromUser(int fd) {
         string reason = "Client closed connection";
         return removeUserFromServer(fd, reason);
     }
+    bytes_received.inc(srv_buff_size);
+    capture.received(fd, srv_buff, srv_buff_size);
     /* Update when a user sends a command ! */
     User& user = getUserFromFd(fd);
+    user.bytes_in += srv_buff_size;
     if (!user.isOnPongHold()) {
-        user.last_received = time(NULL);
+        user.last_received = Clock::current().now();
     }
 
     LOG(INFO) << "DataFromUser user " << user
               << ", bytes " << srv_buff_size
               << " content [" << srv_buff << "]";
 
+    AllocScope scope(ALLOC_PARSER);
     string cmd_string = processLeftovers(fd);
     /* cmd_string can be empty here in case there have been buffering 
      * problems with the user */
@@ -212,46 +511,153 @@ void Server::DataFromUser(int fd) {
 }
 
 /* 
- * sends [:<hostname> <msg>CRLF] to user with fd asociated.
- * 
- * Why send() function is controlled as follows : 
- * https://stackoverflow.com/questions/33053507/econnreset-in-send-linux-c
- * This way b_sent = 0 does not have to be controlled, because ECONNRESET
- * will be returned by send in case we try to send to a closed connection
- * twice.
+ * queues [:<hostname> <msg>CRLF] for the user with fd asociated. Nothing
+ * is written here : flushSendQueues does it once per loop iteration, so
+ * a client that does not read can't block the server, and a failed
+ * write never removes a user in the middle of a command.
+ * Past SENDQ_MAX bytes waiting, the user is removed (SendQ exceeded).
  */
-void Server::DataToUser(int fd, string msg, int type) {
+void Server::DataToUser(int fd, const string &msg, int type) {
 
+    AllocScope scope(ALLOC_SENDQ);
+    string &queue = getUserFromFd(fd).send_queue;
+    size_t start = queue.size();
     if (type == NUMERIC_REPLY) {
-        msg.insert(0, ":" + hostname);
+        queue += server_prefix;
     }
-    msg.insert(msg.size(), CRLF);
-    
+    queue += msg;
+    queue += CRLF;
+    lineQueued(fd, start, 1);
+}
+
+string& Server::outputOf(int fd) {
+    return getUserFromFd(fd).send_queue;
+}
+
+/* The lines were appended to the send queue already : they are taken
+ * back if the user is on its way out or went past SENDQ_MAX with them */
+void Server::lineQueued(int fd, size_t start, int lines) {
+
     User& user = getUserFromFd(fd);
 
     LOG(INFO) << "DataToUser user " << user
-              << ", bytes " << msg.size()
-              << ", content [" << msg << "]"; 
+              << ", bytes " << user.send_queue.size() - start
+              << ", content [" << user.send_queue.c_str() + start << "]";
 
-    int b_sent = 0;
-    int total_b_sent = 0;
+    if (user.dead) {
+        user.send_queue.resize(start);
+        return ;
+    }
+    if (user.send_queue.size() > SENDQ_MAX) {
+        user.send_queue.resize(start);
+        sendq_exceeded.inc();
+        return killUser(fd, "SendQ exceeded");
+    }
+    user.lines_out += lines;
+    messages_sent.inc(lines);
+    queueFlush(fd);
+}
+
+/* A blocked user is only worth trying again once poll says writable */
+void Server::queueFlush(int fd, bool writable) {
+    AllocScope scope(ALLOC_SENDQ);
+    User &user = getUserFromFd(fd);
+    if (!user.in_flush_queue && (!user.write_blocked || writable)) {
+        user.in_flush_queue = true;
+        flush_queue.push_back(fd);
+    }
+}
 
-    do {
-        b_sent = send(fd, &msg[b_sent], msg.size() - total_b_sent, 0);
+/*
+ * Writes as much of the user's send queue as the socket takes. A full
+ * socket leaves the rest for when poll reports POLLOUT.
+ * Why send() errors are controlled as follows : 
+ * https://stackoverflow.com/questions/33053507/econnreset-in-send-linux-c
+ * Returns false if the connection is broken.
+ */
+bool Server::writeSendQueue(User &user) {
+    size_t total_b_sent = 0;
+    while (total_b_sent < user.send_queue.size()) {
+        ssize_t b_sent = transport->send(user.fd,
+                                         user.send_queue.data() + total_b_sent,
+                                         user.send_queue.size() - total_b_sent);
         if (b_sent == -1) {
-            if (socketErrorIsNotFatal(fd)) {
-                LOG(WARNING) << "DataToUser closing fd " << fd
-                             << " from user " << user
-                             << " non fatal error";
-                string reason = "Internal server error";
-                return removeUserFromServer(fd, reason);
+            if (errno == EINTR) {
+                continue ;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break ;
+            }
+            send_errors.inc();
+            if (errno == ECONNRESET || errno == EPIPE) {
+                user.send_queue.clear();
+                return false;
             }
             throw irc::exc::FatalError("send = -1");
         }
-        /* add bytes sent to total */
         total_b_sent += b_sent;
-    /* keep looping until full message is sent */
-    } while (total_b_sent != (int)msg.size());
+    }
+    bytes_sent.inc(total_b_sent);
+    user.bytes_out += total_b_sent;
+    user.send_queue.erase(0, total_b_sent);
+    bool blocked = !user.send_queue.empty();
+    if (blocked != user.write_blocked) {
+        user.write_blocked = blocked;
+        watchWrite(user.fd, blocked);
+    }
+    return true;
+}
+
+/* Last chance for what is queued (ERROR :Closing link ...), right
+ * before the connection is closed */
+void Server::flushSendQueue(int fd) {
+    User &user = getUserFromFd(fd);
+    if (!user.dead) {
+        writeSendQueue(user);
+    }
+}
+
+/*
+ * Flush phase : removes the users killed during this iteration, then
+ * writes every queue that got something new. Users removed here queue
+ * QUITs for others, those are written in the same pass.
+ */
+void Server::flushSendQueues(void) {
+    std::map<int, string> to_remove;
+    to_remove.swap(doomed);
+    for (std::map<int, string>::iterator it = to_remove.begin();
+         it != to_remove.end(); it++)
+    {
+        /* the fd might belong to someone else by now */
+        if (fdExists(it->first) && getUserFromFd(it->first).dead) {
+            removeUserFromServer(it->first, it->second);
+        }
+    }
+    for (size_t i = 0; i < flush_queue.size(); i++) {
+        int fd = flush_queue[i];
+        if (!fdExists(fd)) {
+            continue ;
+        }
+        User &user = getUserFromFd(fd);
+        user.in_flush_queue = false;
+        if (!user.dead && !writeSendQueue(user)) {
+            killUser(fd, "Write error");
+        }
+    }
+    flush_queue.clear();
+}
+
+/* Removal is left to the flush phase : callers may still be iterating
+ * over this user's channels. Nothing else is sent to it. */
+void Server::killUser(int fd, const string &reason) {
+    User &user = getUserFromFd(fd);
+    if (user.dead) {
+        return ;
+    }
+    LOG(WARNING) << "Removing user " << user << " : " << reason;
+    user.dead = true;
+    user.send_queue.clear();
+    doomed[fd] = reason;
 }
 
 /* 
@@ -262,7 +668,8 @@ void Server::DataToUser(int fd, string msg, int type) {
  * 512 * 2 bytes, que se corresponde con el caso en que un usuario envía
  * un primer comando incompleto (sin CRLF). En el caso en que un comando
  * sumado a los leftovers exceda los 512 bytes, se enviará ERR_INPUTTOOLONG 
- * y el comando será vaciado.
+ * y el comando será descartado (parseCommandBuffer, linea a linea : el resto
+ * de lineas del buffer se ejecutan).
  * Cuando un comando más sus leftovers superan los 512 bytes y la string total
  * no contenga CRLF, se vaciará el comando y no se enviará nada.
  */
@@ -277,24 +684,21 @@ string Server::processLeftovers(int fd) {
     if (tools::endsWith(cmd_string, CRLF)) {
         /* add leftovers at start of buffer recieved */
         if (user.hasLeftovers()) {
-            cmd_string.insert(0, user.BufferToString());
+            cmd_string.insert(0, user.leftovers(), user.buffer_size);
             user.resetBuffer();
         }
-        /* total buffer is too big */
-        if (cmd_string.length() > BUFF_MAX_SIZE) {
-            string reply(ERR_INPUTTOOLONG+user.nick+STR_INPUTTOOLONG);
-            LOG(WARNING) << "Buffer from User [" << user.nick << "] too long";
-            DataToUser(fd, reply, NUMERIC_REPLY);
-            return "";
-        }
-    // cmd_string stays as it is.
+    // cmd_string stays as it is, line lengths are checked when queued
     } else {
+        /* leftovers go first, so lines keep their order */
+        if (user.hasLeftovers()) {
+            cmd_string.insert(0, user.leftovers(), user.buffer_size);
+            user.resetBuffer();
+        }
         size_t pos = tools::findLastCRLF(cmd_string);
         // no CRLF found
         if (pos == string::npos) {
             // ill-formated long comand
-            if (cmd_string.length() + user.buffer_size > BUFF_MAX_SIZE) {
-                user.resetBuffer();
+            if (cmd_string.length() > BUFF_MAX_SIZE) {
                 LOG(WARNING) << "Ill formatted buffer from user " << user;
                 return "";
             }
@@ -303,9 +707,13 @@ string Server::processLeftovers(int fd) {
             return "";
         }
         /* if CRLF is somewhere, construct comand until last CRLF
-         * and save leftovers */
-        string leftovers = cmd_string.substr(pos);
-        user.addLeftovers(leftovers);
+         * and save leftovers, unless they can't be a valid line */
+        string leftovers = cmd_string.substr(pos + 2);
+        if (leftovers.length() > BUFF_MAX_SIZE) {
+            LOG(WARNING) << "Ill formatted buffer from user " << user;
+        } else {
+            user.addLeftovers(leftovers);
+        }
         cmd_string = cmd_string.substr(0, pos);
     }
     return cmd_string;
@@ -313,16 +721,10 @@ string Server::processLeftovers(int fd) {
 
 /*
  * Recieves full buffer from user, wether it contains or not leftovers,
- * then splits it in CRLF. Each different command is then processed 
- * matching the first word (or second in case user prefix is first)
- * with a command name, sequentially. 
+ * then splits it in CRLF. Each line is queued on the user, and the
+ * user waits for its turn in the run queue (see runQueue).
  * - Empty commands are ignored (CMD1 CRLFCRLFCRLF CMD2) will call 
  * CMD1 and CMD2, without raising an error.
- * - Commands name DO NOT have to be in upper case letters, this is
- * done internally. joIN &channel is the same as JOIN &channel.
- * - If a command name does not match any on the command map, an
- * error is raised. This is a prior check to user registration.
- *
  */
 void Server::parseCommandBuffer(string &cmd_content, int fd) {
     
@@ -332,21 +734,202 @@ void Server::parseCommandBuffer(string &cmd_content, int fd) {
     tools::split(cmd_vector, cmd_content, CRLF);
     int cmd_vector_size = cmd_vector.size();
     for (int i = 0; i < cmd_vector_size; i++) {
+        /* a line, leftovers included, is too big */
+        if (cmd_vector[i].size() + 2 > BUFF_MAX_SIZE) {
+            string reply(ERR_INPUTTOOLONG+user.nick+STR_INPUTTOOLONG);
+            LOG(WARNING) << "Line from User [" << user.nick << "] too long";
+            DataToUser(fd, reply, NUMERIC_REPLY);
+            continue ;
+        }
+        user.pending_lines.push_back(cmd_vector[i]);
+        user.lines_in++;
+    }
+    scheduleUser(fd);
+}
+
+/*
+ * Executes up to max_lines of the user's queued lines, in order, matching
+ * the first word (or second in case user prefix is first) with a command
+ * name.
+ * - Commands name DO NOT have to be in upper case letters, this is
+ * done internally. joIN &channel is the same as JOIN &channel.
+ * - If a command name does not match any on the command map, an
+ * error is raised. This is a prior check to user registration.
+ * - Each command pays its penalty first. When the user can't afford
+ * the next one, it stays queued until floodLoop finds the bucket
+ * refilled.
+ * While lines are left, the socket is not polled for input : a user
+ * never has more than one read worth of lines queued.
+ */
+Server::WORK_STATUS Server::processPendingLines(int fd, int max_lines) {
+
+    User& user = getUserFromFd(fd);
+    time_t now = Clock::current().now();
+    WORK_STATUS status = WORK_DRAINED;
+
+    for (int done = 0; !user.pending_lines.empty(); done++) {
+        if (done == max_lines) {
+            status = WORK_YIELDED;
+            break ;
+        }
         Command command;
-        if (command.Parse(cmd_vector[i]) != command.OK) {
+        size_t line_size = user.pending_lines.front().size() + 2; // CRLF
+        if (command.Parse(user.pending_lines.front()) != command.OK) {
+            user.pending_lines.pop_front();
             continue ;
         }
+        CommandMap::iterator it = cmd_map.find(command.Name());
+        int penalty = (it != cmd_map.end()) ? it->second.penalty
+                                            : (int)FLOOD_DEFAULT_PENALTY;
+        if (!user.spendFloodTokens(penalty, now)) {
+            LOG(INFO) << "User " << user << " over flood budget, "
+                      << user.pending_lines.size() << " lines queued";
+            flood_throttled.inc();
+            status = WORK_THROTTLED;
+            break ;
+        }
+        user.pending_lines.pop_front();
         /* command does not exist / ill formatted command */
-        if (!cmd_map.count(command.Name())) {
+        if (it == cmd_map.end()) {
+            unknown_commands.inc();
             string msg(ERR_UNKNOWNCOMMAND+command.Name()+STR_UNKNOWNCOMMAND);
             DataToUser(fd, msg, NUMERIC_REPLY);
+        } else if (!user.isOnPongHold() || !command.Name().compare("PONG")) {
+            it->second.bytes->inc(line_size);
+            runCommand(it->second, command, fd);
+        }
+        /* QUIT, or a failed send, removes the user */
+        if (!fdExists(fd)) {
+            return WORK_GONE;
+        }
+    }
+    if (status == WORK_DRAINED && user.read_paused) {
+        resumeReading(fd);
+        user.read_paused = false;
+    } else if (status != WORK_DRAINED && !user.read_paused) {
+        pauseReading(fd);
+        user.read_paused = true;
+    }
+    return status;
+}
+
+/*
+ * Runs one handler, timed. Anything slower than slow_command_us is
+ * logged with what usually explains it : how big the arguments were,
+ * and how many lines the server had to send because of it (fan-out).
+ */
+void Server::runCommand(CommandInfo &info, Command &command, int fd) {
+    unsigned long sent_before = messages_sent.value;
+    unsigned long allocs_before = AllocProfile::allocations();
+    unsigned long start = Clock::current().monotonicUs();
+    {
+        AllocScope scope(ALLOC_COMMANDS);
+        (*this.*info.fnx)(command, fd);
+    }
+    unsigned long elapsed = Clock::current().monotonicUs() - start;
+    info.calls->inc();
+    info.duration->observe(elapsed);
+    if (info.allocs != NULL) {
+        info.allocs->inc(AllocProfile::allocations() - allocs_before);
+    }
+    if (elapsed < slow_command_us) {
+        return ;
+    }
+    LOG warn(WARNING);
+    warn << "Slow command " << command.Name() << " from fd " << fd
+         << " : " << elapsed << "us, arg sizes [";
+    for (size_t i = 1; i < command.args.size(); i++) {
+        warn << (i > 1 ? "," : "") << command.args[i].size();
+    }
+    warn << "], lines sent " << messages_sent.value - sent_before;
+}
+
+void Server::scheduleUser(int fd) {
+    User &user = getUserFromFd(fd);
+    if (!user.in_run_queue) {
+        user.in_run_queue = true;
+        run_queue.push_back(fd);
+    }
+}
+
+/*
+ * One pass over the users queued when it starts, LINES_PER_TURN lines
+ * each. Those with lines left go to the back, for the next iteration.
+ * Throttled users leave the queue : floodLoop takes care of them.
+ */
+void Server::runQueue(void) {
+    size_t turns = run_queue.size();
+    for (size_t i = 0; i < turns; i++) {
+        int fd = run_queue.front();
+        run_queue.pop_front();
+        if (!fdExists(fd)) {
             continue ;
         }
-        if (user.isOnPongHold() && command.Name().compare("PONG")) {
+        getUserFromFd(fd).in_run_queue = false;
+        if (processPendingLines(fd, LINES_PER_TURN) == WORK_YIELDED) {
+            scheduleUser(fd);
+        }
+    }
+}
+
+/*
+ * One batch of every LIST in progress. Users whose send queue is still
+ * over LIST_SENDQ_LOW wait in the queue until it drains : a client
+ * that reads slowly gets its LIST slowly, not a SendQ exceeded.
+ */
+void Server::listLoop(void) {
+    size_t turns = list_queue.size();
+    for (size_t i = 0; i < turns; i++) {
+        int fd = list_queue.front();
+        list_queue.pop_front();
+        if (!fdExists(fd)) {
             continue ;
         }
-        CommandMap::iterator it = cmd_map.find(command.Name());
-        (*this.*it->second)(command, fd);
+        User &user = getUserFromFd(fd);
+        if (user.listing && continueList(fd, user)) {
+            list_queue.push_back(fd);
+        }
+    }
+}
+
+/* Whether listLoop has something to send right away : poll must not
+ * wait then, but it must while every LIST waits for its queue to drain */
+bool Server::listCanProgress(void) {
+    for (size_t i = 0; i < list_queue.size(); i++) {
+        int fd = list_queue[i];
+        if (fdExists(fd)
+            && getUserFromFd(fd).send_queue.size() <= LIST_SENDQ_LOW)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Runs the queues of users that went over their flood budget. While
+ * paused, whatever they keep sending piles up unread in the kernel :
+ * past FLOOD_MAX_RECVQ bytes they are disconnected.
+ */
+void Server::floodLoop(void) {
+    vector<int> paused;
+    for (FdUserMap::iterator it = fd_user_map.begin();
+         it != fd_user_map.end(); it++)
+    {
+        if (it->second.read_paused && !it->second.in_run_queue) {
+            paused.push_back(it->first);
+        }
+    }
+    for (size_t i = 0; i < paused.size(); i++) {
+        if (transport->pending(paused[i]) > FLOOD_MAX_RECVQ) {
+            flood_disconnects.inc();
+            string reason = "Excess Flood";
+            removeUserFromServer(paused[i], reason);
+            continue ;
+        }
+        if (processPendingLines(paused[i], LINES_PER_TURN) == WORK_YIELDED) {
+            scheduleUser(paused[i]);
+        }
     }
 }
 
@@ -368,8 +951,11 @@ void Server::registerUser(User &user) {
     if (user.last_password == password) { // always true if password not set
         user.setPrefixFromHost(hostname);
         user.registered = true;
-        user.addServerMask(OP);
-        return sendWelcome(user.name, user.prefix, user.fd);
+        AllocScope scope(ALLOC_SENDQ);
+        string &queue = outputOf(user.fd);
+        size_t start = queue.size();
+        welcome.render(queue, user.real_nick, user.prefix);
+        return lineQueued(user.fd, start, welcome.lines());
     } else {
         sendPasswordMismatch(user.real_nick, user.fd);
         string reason = "Password missmatch";
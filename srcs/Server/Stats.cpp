@@ -0,0 +1,271 @@
+#include "Server/Server.hpp"
+#include "Channel.hpp"
+#include "User.hpp"
+#include "Tools.hpp"
+#include "BufferPool.hpp"
+#include "AllocProfile.hpp"
+#include "NumericReplies.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <list>
+#include <sstream>
+#include <vector>
+
+using std::string;
+
+/*
+ * STATS queries, operators only (see AIrcCommands::STATS) :
+ *
+ *   m  commands run, and bytes they came in       RPL_STATSCOMMANDS
+ *   u  uptime, then loop lag and stalls           RPL_STATSUPTIME, 249
+ *   l  every connection : queues and traffic      RPL_STATSLINKINFO
+ *   z  memory estimated by subsystem              249
+ *   t  top channels by bytes sent                 249
+ *   a  allocations by subsystem and by command    249
+ *      (ALLOC_PROFILE builds only, see AllocProfile)
+ *
+ * Numbers come from the metrics registry, or the per user / per channel
+ * counters beside it : nothing is computed only for STATS.
+ * Memory is an estimate from sizeof and string capacities, containers
+ * overhead is CONTAINER_OVERHEAD. malloc's own bookkeeping is not seen.
+ */
+
+typedef enum {
+    STATS_TOP_CHANNELS = 10
+} STATS_CONFIG;
+
+namespace irc {
+
+void Server::sendStatsReport(User &user, char query, int fd) {
+    switch (query) {
+        case 'm': return statsCommands(user, fd);
+        case 'u': return statsUptime(user, fd);
+        case 'l': return statsLinks(user, fd);
+        case 'z': return statsMemory(user, fd);
+        case 't': return statsTopChannels(user, fd);
+        case 'a': return statsAllocations(user, fd);
+        default: return ;
+    }
+}
+
+void Server::sendStatsLine(User &user, const char *numeric,
+                           const string &text, int fd)
+{
+    string reply = numeric + user.real_nick + " " + text;
+    DataToUser(fd, reply, NUMERIC_REPLY);
+}
+
+/* <command> <count> <byte count> <remote count>, no remote servers */
+void Server::statsCommands(User &user, int fd) {
+    for (CommandMap::iterator it = cmd_map.begin();
+         it != cmd_map.end(); it++)
+    {
+        if (it->second.calls->value == 0) {
+            continue ;
+        }
+        std::ostringstream line;
+        line << it->first << " " << it->second.calls->value
+             << " " << it->second.bytes->value << " 0";
+        sendStatsLine(user, RPL_STATSCOMMANDS, line.str(), fd);
+    }
+}
+
+void Server::statsUptime(User &user, int fd) {
+    long up = Clock::current().now() - started_at;
+    std::ostringstream uptime;
+    uptime << ":Server Up " << up / 86400 << " days "
+           << (up % 86400) / 3600 << std::setfill('0')
+           << ":" << std::setw(2) << (up % 3600) / 60
+           << ":" << std::setw(2) << up % 60;
+    sendStatsLine(user, RPL_STATSUPTIME, uptime.str(), fd);
+
+    const Metrics::Histogram &loop_lag = loopLag();
+    std::ostringstream lag;
+    lag << "u :loop lag p50 " << loop_lag.quantile(0.5)
+        << "us, p99 " << loop_lag.quantile(0.99)
+        << "us, max " << loop_lag.max
+        << "us, over " << loop_lag.count << " iterations";
+    sendStatsLine(user, RPL_STATSDEBUG, lag.str(), fd);
+    std::ostringstream stalls;
+    stalls << "u :loop stalls " << loopStalls().value
+           << " (over " << loop_stall_us << "us)";
+    sendStatsLine(user, RPL_STATSDEBUG, stalls.str(), fd);
+}
+
+/*
+ * <linkname> <sendq> <sent messages> <sent Kbytes> <received messages>
+ * <received Kbytes> :<time open>
+ * sendq is the bytes queued right now, the kernel buffer not included.
+ */
+void Server::statsLinks(User &user, int fd) {
+    time_t now = Clock::current().now();
+    for (FdUserMap::iterator it = fd_user_map.begin();
+         it != fd_user_map.end(); it++)
+    {
+        User &link = it->second;
+        std::ostringstream line;
+        line << (link.real_nick.empty() ? "*" : link.real_nick)
+             << "[" << (link.name.empty() ? "unregistered" : link.name)
+             << "@" << link.ip_address << "] "
+             << link.send_queue.size() << " "
+             << link.lines_out << " " << link.bytes_out / 1024 << " "
+             << link.lines_in << " " << link.bytes_in / 1024 << " :"
+             << now - link.connected_at;
+        sendStatsLine(user, RPL_STATSLINKINFO, line.str(), fd);
+    }
+}
+
+static size_t userBytes(const User &user, size_t &sendq, size_t &pending) {
+    size_t bytes = MAP_NODE_BYTES + sizeof(User)
+                   + tools::heapBytes(user.ip_address)
+                   + tools::heapBytes(user.real_nick)
+                   + tools::heapBytes(user.name)
+                   + tools::heapBytes(user.full_name)
+                   + tools::heapBytes(user.prefix)
+                   + tools::heapBytes(user.source)
+                   + tools::heapBytes(user.mask)
+                   + tools::heapBytes(user.afk_msg)
+                   + tools::heapBytes(user.last_password)
+                   + tools::heapBytes(user.ping_str);
+    bytes += user.ch_name_mask_map.size()
+             * (MAP_NODE_BYTES + sizeof(std::pair<Atom, unsigned char>));
+    bytes += user.ban_cache.size()
+             * (MAP_NODE_BYTES + sizeof(User::BanCache::value_type));
+    sendq += tools::heapBytes(user.send_queue);
+    for (std::list<string>::const_iterator it = user.pending_lines.begin();
+         it != user.pending_lines.end(); it++)
+    {
+        pending += LIST_NODE_BYTES + sizeof(string) + tools::heapBytes(*it);
+    }
+    return bytes;
+}
+
+/* Ban masks are stored twice : as shown, and compiled for matching */
+static size_t channelBytes(const Channel &channel) {
+    return MAP_NODE_BYTES + sizeof(Channel)
+           + (channel.users.size() + channel.white_list.size())
+             * (LIST_NODE_BYTES + sizeof(Atom))
+           + channel.black_list.size() * 2
+             * (MAP_NODE_BYTES + sizeof(BanList::MaskSetterMap::value_type))
+           + channel.ban_cached.size() * (MAP_NODE_BYTES + sizeof(int))
+           + tools::heapBytes(channel.key)
+           + tools::heapBytes(channel.topic)
+           + tools::heapBytes(channel.names_cache);
+}
+
+void Server::statsMemory(User &user, int fd) {
+    size_t sendq = 0;
+    size_t pending = 0;
+    size_t users = 0;
+    for (FdUserMap::iterator it = fd_user_map.begin();
+         it != fd_user_map.end(); it++)
+    {
+        users += userBytes(it->second, sendq, pending);
+    }
+    size_t channels = 0;
+    for (ChannelMap::iterator it = channel_map.begin();
+         it != channel_map.end(); it++)
+    {
+        channels += channelBytes(it->second);
+    }
+    for (FoldedNameMap::iterator it = channel_folds.begin();
+         it != channel_folds.end(); it++)
+    {
+        channels += MAP_NODE_BYTES + sizeof(FoldedNameMap::value_type)
+                    + tools::heapBytes(it->first);
+    }
+    size_t atoms = Atom::tableBytes();
+    size_t nicks = nick_fd_map.size()
+                   * (MAP_NODE_BYTES + sizeof(NickFdMap::value_type));
+    size_t zline_bytes = zlines.nodeBytes();
+    size_t source_bytes =
+        sources.size() * (MAP_NODE_BYTES + sizeof(SourceMap::value_type))
+        + fd_source.size() * (MAP_NODE_BYTES + sizeof(FdSourceMap::value_type));
+
+    BufferPool &pool = BufferPool::global();
+    size_t pool_bytes = (pool.inUse() + pool.pooled()) * BUFF_MAX_SIZE;
+
+    std::ostringstream lines[8];
+    lines[0] << "z :users " << fd_user_map.size() << " : " << users
+             << " bytes";
+    lines[1] << "z :send queues " << sendq << " bytes, pending lines "
+             << pending << " bytes";
+    lines[2] << "z :channels " << channel_map.size() << " : " << channels
+             << " bytes";
+    lines[3] << "z :atoms " << Atom::tableSize() << " : " << atoms
+             << " bytes, nick index " << nicks << " bytes";
+    lines[4] << "z :z-lines " << zlines.size() << " : " << zline_bytes
+             << " bytes";
+    lines[5] << "z :sources " << sources.size() << " : " << source_bytes
+             << " bytes";
+    lines[6] << "z :receive buffers " << pool.inUse() << " in use, "
+             << pool.pooled() << " pooled : " << pool_bytes << " bytes";
+    lines[7] << "z :total " << users + sendq + pending + channels + atoms
+                               + nicks + zline_bytes + source_bytes
+                               + pool_bytes
+             << " bytes";
+    for (int i = 0; i < 8; i++) {
+        sendStatsLine(user, RPL_STATSDEBUG, lines[i].str(), fd);
+    }
+}
+
+/* Channels ranked by bytes written to their members */
+void Server::statsTopChannels(User &user, int fd) {
+    typedef std::pair<unsigned long, Channel*> Ranked;
+    std::vector<Ranked> ranked;
+    for (ChannelMap::iterator it = channel_map.begin();
+         it != channel_map.end(); it++)
+    {
+        ranked.push_back(Ranked(it->second.bytes_out, &it->second));
+    }
+    size_t top = std::min(ranked.size(), (size_t)STATS_TOP_CHANNELS);
+    std::partial_sort(ranked.begin(), ranked.begin() + top, ranked.end(),
+                      std::greater<Ranked>());
+    for (size_t i = 0; i < top; i++) {
+        Channel &channel = *ranked[i].second;
+        std::ostringstream line;
+        line << "t :" << channel.name << " users " << channel.users.size()
+             << ", messages " << channel.messages
+             << ", bytes sent " << channel.bytes_out;
+        sendStatsLine(user, RPL_STATSDEBUG, line.str(), fd);
+    }
+}
+
+/* Subsystems as tagged by AllocScope, then the commands, nested
+ * allocations included (a JOIN's channel store work is in JOIN too) */
+void Server::statsAllocations(User &user, int fd) {
+    if (!AllocProfile::enabled()) {
+        return sendStatsLine(user, RPL_STATSDEBUG,
+                             "a :allocation profiling off, build the server"
+                             " with make re ALLOC_PROFILE=1", fd);
+    }
+    for (int i = 0; i < ALLOC_TAGS; i++) {
+        ALLOC_TAG tag = static_cast<ALLOC_TAG>(i);
+        const AllocProfile::Counters &counters = AllocProfile::counters(tag);
+        std::ostringstream line;
+        line << "a :" << AllocProfile::name(tag)
+             << " allocs " << counters.allocs
+             << ", bytes " << counters.bytes
+             << ", live " << counters.live
+             << " : " << counters.live_bytes << " bytes";
+        sendStatsLine(user, RPL_STATSDEBUG, line.str(), fd);
+    }
+    for (CommandMap::iterator it = cmd_map.begin();
+         it != cmd_map.end(); it++)
+    {
+        unsigned long calls = it->second.calls->value;
+        if (calls == 0) {
+            continue ;
+        }
+        std::ostringstream line;
+        line << "a :" << it->first
+             << " allocs " << it->second.allocs->value
+             << ", per call " << std::fixed << std::setprecision(1)
+             << (double)it->second.allocs->value / calls;
+        sendStatsLine(user, RPL_STATSDEBUG, line.str(), fd);
+    }
+}
+
+} // namespace
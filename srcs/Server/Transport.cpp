@@ -0,0 +1,176 @@
+#include "Server/Transport.hpp"
+#include "Log.hpp"
+#include "libft.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netdb.h>
+
+#include <poll.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+#include <unistd.h>
+#include <cerrno>
+
+using std::string;
+
+typedef enum {
+    LISTENER_BACKLOG = 20
+} TRANSPORT_CONFIG;
+
+namespace irc {
+
+Transport::~Transport() {}
+
+Transport& Transport::kernel(void) {
+    static KernelTransport transport;
+    return transport;
+}
+
+KernelTransport::KernelTransport(void) {}
+
+KernelTransport::~KernelTransport() {}
+
+static int get_addrinfo_from_params(const char* hostname,
+                                    const char *port,
+                                    struct addrinfo *hints,
+                                    struct addrinfo **servinfo)
+{
+    int ret = -1;
+
+    if ((ret = getaddrinfo(hostname, port, hints, servinfo)) != 0) {
+        string error("getaddrinfo error :");
+        LOG(ERROR) << error.append(gai_strerror(ret));
+        return -1;
+    }
+    /* Filter out IPv6 cases (makes me dizzy) */
+    if ((*servinfo)->ai_family == AF_INET6) {
+        LOG(ERROR) << "unsupported IP address length";
+        freeaddrinfo(*servinfo);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * tries to bind a socket to one of the addresses host:port resolves
+ * to, and then it starts listen()ing to it.
+ * returns the socket on success, -1 otherwise.
+ */
+int KernelTransport::listen(const string &host, const string &port,
+                            string &bound)
+{
+    struct addrinfo hints;
+    struct addrinfo *servinfo = NULL;
+
+    ft_memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET; // Ipv4
+    hints.ai_socktype = SOCK_STREAM; // TCP
+    if (get_addrinfo_from_params(host.c_str(), port.c_str(), &hints,
+                                 &servinfo) == -1)
+    {
+        return -1;
+    }
+    int socketfd = -1;
+    struct addrinfo *p;
+    /* loop through addresses until bind works */
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        /* open a socket given servinfo */
+        if ((socketfd = socket(p->ai_family,
+                               p->ai_socktype,
+                               p->ai_protocol)) == -1)
+        {
+            continue;
+        }
+        int yes = 1;
+        if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR,
+                       &yes, sizeof(yes)) == -1)
+        {
+            LOG(ERROR) << "setsockopt raised -1";
+            ::close(socketfd);
+            freeaddrinfo(servinfo);
+            return -1;
+        }
+        /* assign port to socket */
+        if (bind(socketfd, p->ai_addr, p->ai_addrlen) == -1) {
+            ::close(socketfd);
+            socketfd = -1;
+            continue;
+        }
+        /* if it gets to this point everything should be fine */
+        break;
+    }
+    if (socketfd == -1) {
+        freeaddrinfo(servinfo);
+        return -1;
+    }
+    if (::listen(socketfd, LISTENER_BACKLOG) == -1
+        || fcntl(socketfd, F_SETFL, O_NONBLOCK) == -1)
+    {
+        LOG(ERROR) << "listen raised -1";
+        ::close(socketfd);
+        freeaddrinfo(servinfo);
+        return -1;
+    }
+    struct sockaddr_in *sockaddrin = (struct sockaddr_in *)(p->ai_addr);
+    bound = inet_ntoa(sockaddrin->sin_addr);
+    freeaddrinfo(servinfo);
+    return socketfd;
+}
+
+int KernelTransport::accept(int listener, struct sockaddr_storage *addr) {
+    socklen_t addrlen = sizeof(struct sockaddr_storage);
+    int fd_new = ::accept(listener, (struct sockaddr *)addr, &addrlen);
+    if (fd_new == -1) {
+        return -1;
+    }
+    if (fcntl(fd_new, F_SETFL, O_NONBLOCK) == -1) {
+        int err = errno;
+        ::close(fd_new);
+        errno = err;
+        return -1;
+    }
+    return fd_new;
+}
+
+ssize_t KernelTransport::recv(int fd, char *buff, size_t len) {
+    return ::recv(fd, buff, len, 0);
+}
+
+/* MSG_DONTWAIT : refused connections are written to before
+ * accept made them non blocking */
+ssize_t KernelTransport::send(int fd, const char *buff, size_t len) {
+    return ::send(fd, buff, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+int KernelTransport::poll(struct pollfd *fds, nfds_t nfds, int timeout_ms) {
+    return ::poll(fds, nfds, timeout_ms);
+}
+
+int KernelTransport::close(int fd) {
+    return ::close(fd);
+}
+
+int KernelTransport::socketError(int fd) {
+    int err_code = 0;
+    socklen_t len = sizeof(err_code);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err_code, &len) == 0
+        && err_code != 0)
+    {
+        return err_code;
+    }
+    return errno;
+}
+
+size_t KernelTransport::pending(int fd) const {
+    int unread = 0;
+    if (ioctl(fd, FIONREAD, &unread) == -1 || unread < 0) {
+        return 0;
+    }
+    return unread;
+}
+
+} // namespace
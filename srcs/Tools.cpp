@@ -1,6 +1,7 @@
 #include "Tools.hpp"
 #include "Exceptions.hpp"
 #include "Types.hpp"
+#include "Clock.hpp"
 
 #include <vector>
 #include <string>
@@ -19,7 +20,9 @@ using std::vector;
 namespace irc {
 namespace tools {
 
-vector<string>& split(vector<string> &to_fill, string &str, string del) {
+vector<string>& split(vector<string> &to_fill, string &str,
+                      const string &del)
+{
     int start = 0;
     int end = str.find(del);
     while (end != -1) {
@@ -27,9 +30,9 @@ vector<string>& split(vector<string> &to_fill, string &str, string del) {
         start = end + del.size();
         end = str.find(del, start);
     }
-    string last = str.substr(start, end - start);
-    if (!last.empty()) {
-        to_fill.push_back(str.substr(start, end - start));
+    /* what follows the last del, if anything */
+    if ((size_t)start < str.size()) {
+        to_fill.push_back(str.substr(start));
     }
     return to_fill;
 }
@@ -102,7 +105,7 @@ bool endsWith(string const &str, string const &suffix) {
 }
 
 /* Check if str starts with suffix */
-bool starts_with_mask(string const str) {
+bool starts_with_mask(const string &str) {
     return (str[0] == '!' || str[0] == '#' || str[0] == '+' || str[0] == '&');
 }
 
@@ -124,12 +127,32 @@ bool charIsInString(const string &str, const char c) {
     return (str.find(c) != string::npos);
 }
 
+/*
+ * xorshift32 (Marsaglia), seeded once from the clock and the pid unless
+ * rngSeed was called first : a simulation seeds it, and gets the same
+ * PING tokens every run. (Seeding rand() on every call used to give the
+ * same token to everyone pinged within the same second.)
+ */
+static unsigned int rng_state = 0;
+
+void rngSeed(unsigned int seed) {
+    rng_state = (seed != 0) ? seed : 1;
+}
+
+unsigned int rngNext(void) {
+    if (rng_state == 0) {
+        rngSeed((unsigned int)Clock::current().now() * getpid());
+    }
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
 /*
  * from https://stackoverflow.com/questions/440133
- * See https://cplusplus.com/reference/cstdlib/rand/
  */
 string rngString(int len) {
-    srand((unsigned)time(NULL) * getpid());
     static const unsigned char printables[] =
         "0123456789"
         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -138,7 +161,7 @@ string rngString(int len) {
     string tmp_s;
     tmp_s.reserve(len);
     for (int i = 0; i < len; ++i) {
-        unsigned char c = printables[rand() % (sizeof(printables) - 1)];
+        unsigned char c = printables[rngNext() % (sizeof(printables) - 1)];
         tmp_s.push_back(c);
     }
     return tmp_s;
@@ -146,23 +169,13 @@ string rngString(int len) {
 
 /*
  * returns the index corresponding to the last crlf, e.g. :
- * from "Hello CRLF lol", returns the position 5.
+ * from "Hello CRLF lol", returns the position 6.
  * This is done to then call substr(0, pos),
  * which will be the contents of the string before
- * the last CRLF.
+ * the last CRLF, and substr(pos + 2) what comes after it.
  */
 size_t findLastCRLF(string& haystack) {
-    size_t CR_pos = haystack.find_last_of(CR);
-    size_t LF_pos = haystack.find_last_of(LF);
-
-    if (CR_pos != string::npos
-        && LF_pos != string::npos)
-    {
-        if (LF_pos == CR_pos + 1) {
-            return CR_pos - 1;
-        }
-    }
-    return string::npos;
+    return haystack.rfind(CRLF);
 }
 
 
@@ -172,7 +185,7 @@ void cleanBuffer(char *buff, size_t size) {
     }
 }
 
-void printError(string error_str) {
+void printError(const string &error_str) {
     std::cerr << error_str << std::endl;
 }
 
@@ -189,5 +202,64 @@ bool anyRepeatedChar(string &s) {
     return false;
 }
 
+/*
+ * '*' matches any run of chars (also empty), '?' exactly one. Iterative
+ * with a single backtrack point (the last '*' seen), so it never goes
+ * exponential on masks like *a*a*a*a*b.
+ * Comparison is case sensitive : callers upper case both sides.
+ */
+bool globMatch(const string &mask, const string &str) {
+    size_t m = 0;
+    size_t s = 0;
+    size_t star = string::npos;
+    size_t star_s = 0;
+
+    while (s < str.size()) {
+        if (m < mask.size() && (mask[m] == '?' || mask[m] == str[s])) {
+            m++;
+            s++;
+        } else if (m < mask.size() && mask[m] == '*') {
+            star = m++;
+            star_s = s;
+        } else if (star != string::npos) {
+            m = star + 1;
+            s = ++star_s;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*') {
+        m++;
+    }
+    return m == mask.size();
+}
+
+/* Microseconds from an arbitrary point. Never goes backwards, unlike
+ * time(), so it is what durations are measured with. */
+unsigned long monotonicUs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/* What a string holds outside itself. Short ones live in the object
+ * (small string optimization, up to 15 chars in libstdc++). */
+size_t heapBytes(const std::string &str) {
+    return str.capacity() > 15 ? str.capacity() + 1 : 0;
+}
+
+/* n in decimal at the end of str, with no temporary (ft_itoa mallocs) */
+void appendNumber(std::string &str, unsigned long n) {
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (len > 0) {
+        str += digits[--len];
+    }
+}
+
 } // tools 
 } // irc
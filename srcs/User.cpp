@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <string.h>
 #include "User.hpp"
+#include "Clock.hpp"
+#include "BufferPool.hpp"
 #include "libft.h"
 #include "Log.hpp"
 
@@ -19,20 +21,39 @@ User::User(int fd, const char* ip_address)
         name(),
         full_name(),
         prefix(),
+        source(),
         mask(),
         server_mode(),
         afk_msg(),
         last_password(),
         ch_name_mask_map(),
+        ban_cache(),
+        leftover_block(NULL),
         buffer_size(0),
         registered(false),
+        pending_lines(),
+        flood_tokens(FLOOD_BURST),
+        flood_refill(Clock::current().now()),
+        read_paused(false),
+        in_run_queue(false),
+        send_queue(),
+        in_flush_queue(false),
+        write_blocked(false),
+        dead(false),
+        listing(false),
+        list_next(),
+        list_filter(),
+        list_results(0),
+        connected_at(Clock::current().now()),
+        lines_in(0),
+        bytes_in(0),
+        lines_out(0),
+        bytes_out(0),
         on_pong_hold(false),
-        last_received(time(NULL)),
+        last_received(Clock::current().now()),
         ping_send_time(0),
         ping_str()
-{
-    ft_memset(buffer, '\0', BUFF_MAX_SIZE);
-}
+{}
 
 User::User(const User &other)
 :
@@ -43,22 +64,40 @@ User::User(const User &other)
     name(other.name),
     full_name(other.full_name),
     prefix(other.prefix),
+    source(other.source),
     mask(other.mask),
     server_mode(other.server_mode),
     afk_msg(other.afk_msg),
     last_password(other.last_password),
     ch_name_mask_map(other.ch_name_mask_map),
-    buffer_size(other.buffer_size),
+    ban_cache(other.ban_cache),
+    leftover_block(NULL),
+    buffer_size(0),
     registered(other.registered),
+    pending_lines(other.pending_lines),
+    flood_tokens(other.flood_tokens),
+    flood_refill(other.flood_refill),
+    read_paused(other.read_paused),
+    in_run_queue(other.in_run_queue),
+    send_queue(other.send_queue),
+    in_flush_queue(other.in_flush_queue),
+    write_blocked(other.write_blocked),
+    dead(other.dead),
+    listing(other.listing),
+    list_next(other.list_next),
+    list_filter(other.list_filter),
+    list_results(other.list_results),
+    connected_at(other.connected_at),
+    lines_in(other.lines_in),
+    bytes_in(other.bytes_in),
+    lines_out(other.lines_out),
+    bytes_out(other.bytes_out),
     on_pong_hold(other.on_pong_hold),
     last_received(other.last_received),
     ping_send_time(other.ping_send_time),
     ping_str(other.ping_str)
 {
-    ft_memset(buffer, '\0', BUFF_MAX_SIZE);
-    if (other.buffer_size > 0) {
-        ft_memcpy(buffer, other.buffer, other.buffer_size);
-    }
+    copyLeftovers(other);
 }
 
 User& User::operator=(const User& other) {
@@ -70,16 +109,33 @@ User& User::operator=(const User& other) {
         name = other.name;
         full_name = other.full_name;
         prefix = other.prefix;
+        source = other.source;
         mask = other.mask;
         server_mode = other.server_mode;
         afk_msg = other.afk_msg;
         last_password = other.last_password;
         ch_name_mask_map = other.ch_name_mask_map;
-        ft_memset(buffer, '\0', BUFF_MAX_SIZE);
-        if (other.buffer_size > 0) {
-            ft_memcpy(buffer, other.buffer, other.buffer_size);
-        }
-        buffer_size = other.buffer_size;
+        ban_cache = other.ban_cache;
+        resetBuffer();
+        copyLeftovers(other);
+        pending_lines = other.pending_lines;
+        flood_tokens = other.flood_tokens;
+        flood_refill = other.flood_refill;
+        read_paused = other.read_paused;
+        in_run_queue = other.in_run_queue;
+        send_queue = other.send_queue;
+        in_flush_queue = other.in_flush_queue;
+        write_blocked = other.write_blocked;
+        dead = other.dead;
+        listing = other.listing;
+        list_next = other.list_next;
+        list_filter = other.list_filter;
+        list_results = other.list_results;
+        connected_at = other.connected_at;
+        lines_in = other.lines_in;
+        bytes_in = other.bytes_in;
+        lines_out = other.lines_out;
+        bytes_out = other.bytes_out;
         registered = other.registered;
         on_pong_hold = other.on_pong_hold;
         last_received = other.last_received;
@@ -98,10 +154,15 @@ bool User::operator==(User const &other) const {
 
 /*
  * Prefix from host is done with the real nick ! The other
- * (nick) is always in uppercase.
+ * (nick) is always in uppercase. The source is kept ready to be
+ * copied in front of every message the user causes.
  */
-void User::setPrefixFromHost(string &host) {
+void User::setPrefixFromHost(const string &host) {
     prefix = real_nick + "!" + name + "@" + host;
+    source.reserve(prefix.size() + 2);
+    source.assign(1, ':');
+    source += prefix;
+    source += ' ';
 }
 
 bool User::isReadyForRegistration(bool server_password_on) {
@@ -115,17 +176,56 @@ bool User::hasLeftovers(void) const {
 }
 
 void User::resetBuffer(void) {
-   tools::cleanBuffer(buffer, buffer_size);
-   buffer_size = 0;
+    if (leftover_block != NULL) {
+        BufferPool::global().give(leftover_block);
+        leftover_block = NULL;
+    }
+    buffer_size = 0;
 }
 
+/* The total never goes past BUFF_MAX_SIZE : longer is not a line, and
+ * Server::processLeftovers drops it before */
 void User::addLeftovers(string &leftovers) {
-    ft_memcpy(buffer + buffer_size, leftovers.c_str(), leftovers.size());
-    buffer_size += leftovers.size();
+    size_t size = buffer_size + leftovers.size();
+    if (size > LEFTOVER_INLINE && leftover_block == NULL) {
+        leftover_block = BufferPool::global().take();
+        ft_memcpy(leftover_block, leftover_inline, buffer_size);
+    }
+    ft_memcpy((leftover_block ? leftover_block : leftover_inline)
+              + buffer_size, leftovers.data(), leftovers.size());
+    buffer_size = size;
+}
+
+const char* User::leftovers(void) const {
+    return leftover_block ? leftover_block : leftover_inline;
+}
+
+/* A copy gets a block of its own, if the line needs one */
+void User::copyLeftovers(const User &other) {
+    if (other.leftover_block != NULL) {
+        leftover_block = BufferPool::global().take();
+    }
+    ft_memcpy(leftover_block ? leftover_block : leftover_inline,
+              other.leftovers(), other.buffer_size);
+    buffer_size = other.buffer_size;
 }
 
-string User::BufferToString(void) const {
-    return string(buffer, buffer_size);
+/*
+ * Refills the bucket for the time elapsed, then takes penalty tokens
+ * from it. Returns false, taking nothing, if there are not enough.
+ */
+bool User::spendFloodTokens(int penalty, time_t now) {
+    if (now > flood_refill) {
+        long refill = (now - flood_refill) * FLOOD_REFILL_PER_S;
+        flood_tokens = (flood_tokens + refill > FLOOD_BURST)
+                       ? (int)FLOOD_BURST : (int)(flood_tokens + refill);
+        flood_refill = now;
+    }
+    if (flood_tokens < penalty) {
+        return false;
+    }
+    flood_tokens -= penalty;
+    return true;
 }
 
 time_t User::getLastMsgTime(void) {
@@ -143,13 +243,13 @@ bool User::isOnPongHold(void) {
 void User::resetPingStatus(void) {
     on_pong_hold = false;
     ping_str = "";
-    last_received = time(NULL);
+    last_received = Clock::current().now();
 }
 
 void User::updatePingStatus(string &random) {
     ping_str = random;
     on_pong_hold = true;
-    ping_send_time = time(NULL);
+    ping_send_time = Clock::current().now();
 }
 
 bool User::isResgistered(void) {
@@ -160,7 +260,7 @@ bool User::isAway(void) {
     return ((server_mode & 0x40) >> 6);
 }
 
-bool User::isChannelModerator(string name) {
+bool User::isChannelModerator(const Atom &name) {
     return ((ch_name_mask_map.find(name)->second & 0x04) >> CH_MOD);
 }
 
@@ -168,22 +268,28 @@ bool User::isOperator(void) {
     return ((server_mode & 0x80) >> 7);
 }
 
-bool User::isChannelOperator(string name) {
+bool User::isChannelOperator(const Atom &name) {
     return ((ch_name_mask_map.find(name)->second & 0x80) >> 7);
 }
 
-bool User::isInChannel(string &channel_name) {
+bool User::isInChannel(const Atom &channel_name) {
     return ch_name_mask_map.count(channel_name);
 }
 
+/* Fuera del canal : sus modos y el veredicto de ban cacheado se van */
+void User::leaveChannel(const Atom &channel_name) {
+    ch_name_mask_map.erase(channel_name);
+    ban_cache.erase(channel_name);
+}
+
 /* LLamar después de comprobar que un canal existe ! (importante) */
-void User::addChannelMask(string &channel, int bits) {
+void User::addChannelMask(const Atom &channel, int bits) {
     unsigned char &mask = ch_name_mask_map.find(channel)->second;
     mask |= (0x01 << bits);
 }
 
 /* Lo mismo que arriba */
-void User::deleteChannelMask(string &channel, int bits) {
+void User::deleteChannelMask(const Atom &channel, int bits) {
     unsigned char &mask = ch_name_mask_map.find(channel)->second;
     mask &= ~(0x01 << bits);
 }
@@ -197,6 +303,7 @@ void User::deleteServerMask(int bits) {
 }
 
 User::~User() {
+    resetBuffer();
 }
 
 } // namespace
@@ -0,0 +1,153 @@
+#include "WelcomeBurst.hpp"
+#include "NumericReplies.hpp"
+#include "Types.hpp"
+#include "Tools.hpp"
+#include "libft.h"
+
+#include <fstream>
+
+using std::string;
+
+namespace irc {
+
+WelcomeBurst::WelcomeBurst(void)
+:
+    motd(),
+    has_motd(false),
+    text(),
+    holes(),
+    line_count(0)
+{}
+
+WelcomeBurst::~WelcomeBurst() {}
+
+/*
+ * One 372 per line of the file. A MOTD that can't be read is no MOTD,
+ * not the previous one : the file is what the operator sees.
+ * Returns the number of lines, -1 if the file can't be opened.
+ */
+int WelcomeBurst::loadMotd(const string &path) {
+    motd.clear();
+    std::ifstream file(path.c_str());
+    has_motd = file.is_open();
+    if (!has_motd) {
+        return -1;
+    }
+    string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        motd.push_back(line);
+    }
+    return motd.size();
+}
+
+void WelcomeBurst::startLine(const string &server_prefix,
+                             const char *numeric)
+{
+    text += server_prefix;
+    text += numeric;
+    addHole(NICK_HOLE);
+}
+
+void WelcomeBurst::addHole(HOLE_TYPE type) {
+    holes.push_back(Hole(text.size(), type));
+}
+
+void WelcomeBurst::endLine(void) {
+    text += CRLF;
+    line_count++;
+}
+
+void WelcomeBurst::build(const string &server_prefix, const string &hostname,
+                         time_t created)
+{
+    text.clear();
+    holes.clear();
+    line_count = 0;
+
+    startLine(server_prefix, RPL_WELCOME);
+    text += RPL_WELCOME_STR_1;
+    addHole(PREFIX_HOLE);
+    endLine();
+
+    startLine(server_prefix, RPL_YOURHOST);
+    text += STR_YOURHOST;
+    text += hostname;
+    text += ", running version " SERVER_VERSION;
+    endLine();
+
+    char date[64];
+    struct tm *utc = gmtime(&created);
+    if (utc == NULL || !strftime(date, sizeof(date),
+                                 "%a %b %d %Y at %H:%M:%S UTC", utc))
+    {
+        date[0] = '\0';
+    }
+    startLine(server_prefix, RPL_CREATED);
+    text += STR_CREATED;
+    text += date;
+    endLine();
+
+    /* user modes, then channel modes : only what MODE takes. No user
+     * mode can be set (MODE <nick> is ignored), the field says so */
+    startLine(server_prefix, RPL_MYINFO);
+    text += ' ';
+    text += hostname;
+    text += " " SERVER_VERSION " - bikmov";
+    endLine();
+
+    /* ELIST : see ListFilter. SAFELIST : a LIST never floods the
+     * client off the server (see AIrcCommands::continueList). */
+    startLine(server_prefix, RPL_ISUPPORT);
+    text += " CASEMAPPING=ascii CHANTYPES=#&+! CHANMODES=b,k,,im"
+            " PREFIX=(ov)@+ ELIST=CMNTU SAFELIST NICKLEN=";
+    tools::appendNumber(text, NAME_MAX_SIZE);
+    text += STR_ISUPPORT;
+    endLine();
+
+    if (!has_motd) {
+        startLine(server_prefix, ERR_NOMOTD);
+        text += STR_NOMOTD;
+        endLine();
+        return ;
+    }
+    startLine(server_prefix, RPL_MOTDSTART);
+    text += " :- ";
+    text += hostname;
+    text += STR_MOTDSTART;
+    endLine();
+    /* lines longer than a message allows are cut */
+    size_t room = BUFF_MAX_SIZE - server_prefix.size()
+                  - ft_strlen(RPL_MOTD) - NAME_MAX_SIZE
+                  - ft_strlen(STR_MOTD) - 2;
+    for (size_t i = 0; i < motd.size(); i++) {
+        startLine(server_prefix, RPL_MOTD);
+        text += STR_MOTD;
+        text.append(motd[i], 0, room);
+        endLine();
+    }
+    startLine(server_prefix, RPL_ENDOFMOTD);
+    text += STR_ENDOFMOTD;
+    endLine();
+}
+
+/* Appends the burst to out, for the user with this nick and prefix */
+void WelcomeBurst::render(string &out, const string &nick,
+                          const string &prefix) const
+{
+    size_t from = 0;
+    for (size_t i = 0; i < holes.size(); i++) {
+        out.append(text, from, holes[i].first - from);
+        out += holes[i].second == NICK_HOLE ? nick : prefix;
+        from = holes[i].first;
+    }
+    out.append(text, from, string::npos);
+}
+
+int WelcomeBurst::lines(void) const {
+    return line_count;
+}
+
+} // namespace
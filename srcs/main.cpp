@@ -42,22 +42,25 @@ int main(int argc, char **argv) {
     try {
         if (argc == 1) {
             Server server;
+            server.run();
             return 0;
         } else if (argc == 2) { // only password set ! 
             string password = argv[1];
             Server server(password);
+            server.run();
             return 0;
         } else if (argc == 3) {
             string hostname(argv[1]);
             string port(argv[2]);
-            Server(hostname, port);
-            // connect to server using params
+            Server server(hostname, port);
+            server.run();
             return 0;
         } else if (argc == 4) {
             string hostname(argv[1]);
             string port(argv[2]);
             string password = argv[3];
-            Server(hostname, port, password);
+            Server server(hostname, port, password);
+            server.run();
             return 0;
         } else {
             return 42;